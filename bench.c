@@ -0,0 +1,429 @@
+/* vim:set ts=4 sw=4 tw=80 et cindent ai si cino=(0,ml,\:0:
+ * ( settings from: http://datapax.com.au/code_conventions/ )
+ */
+
+/**********************************************************************
+    RatSlap
+    Copyright (C) 2016-2020 Todd Harbour
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    version 2 ONLY, as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program, in the file COPYING or COPYING.txt; if
+    not, see http://www.gnu.org/licenses/ , or write to:
+      The Free Software Foundation, Inc.,
+      51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ **********************************************************************/
+
+/*
+ * CPU microbenchmarks for the paths the offline tools (ratslap-compile,
+ * ratslap-fuzz, validation jobs) spend their time in: the key binding parser,
+ * the mode setters, mode_print, key name lookup and log formatting.
+ *
+ * Each benchmark is timed in rounds of (at least) -m milliseconds, keeping the
+ * fastest round, and reported in ns/op and as a ratio to a calibration loop
+ * timed alongside each round. Baselines hold the ratios, so they carry over
+ * (roughly) to other clock speeds and loads. A benchmark that looks slower is
+ * timed again (up to BENCH_RETRIES times) before it counts, as a busy machine
+ * can slow a whole run down. Given a baseline (-b), anything more than the
+ * tolerance (-t, percent) slower than it (and by more than a couple of ns,
+ * which is just jitter) fails the run:
+ *     make bench-cpu
+ *     make bench-cpu BENCH_TOLERANCE=10
+ *
+ * bench.baseline is checked in. Ratios still differ some between CPUs and
+ * compilers, so when comparing changes on another machine, remake it (-w)
+ * there first:
+ *     make bench-baseline
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "app.h"
+#include "lang.h"
+#include "log.h"
+#include "mode.h"
+#include "model.h"
+
+#define BENCH_ROUNDS                9
+#define BENCH_RETRIES               3
+#define BENCH_CAL_TABLE             8192 // Bytes
+#define BENCH_MS_DEFAULT            50
+#define BENCH_TOLERANCE_DEFAULT     25 // Percent
+#define BENCH_NOISE_NS              2  // Too small a change to be more than jitter
+#define BENCH_NAME_LEN              32
+#define BENCH_HEADER                "# " BIN_NAME "-bench baseline (ratio to calibration loop)\n"
+
+typedef struct s_bench {
+    const char *name;
+    void      (*run)(const unsigned long n);
+    double      ns;       // Per op, fastest round
+    double      ratio;    // ns relative to the calibration loop's
+    double      baseline; // ratio, 0 if none
+} t_bench;
+
+// Where everything printed goes (/dev/null), and somewhere for results to go
+// so the work isn't optimised away
+FILE *_sink = NULL;
+volatile unsigned long _result = 0;
+
+unsigned char _mode_data[MODE_DATA_LEN];
+
+// A typical spread of bindings: modifiers, buttons, keys, combos and a few
+// that are rejected
+const char *_bindings[] = {
+     "LeftCtrl+C"
+    ,"Button6"
+    ,"LeftCtrl+LeftAlt+PageUp"
+    ,"F13"
+    ,"Num+"
+    ,"LeftShift+RightAlt+Delete"
+    ,"NumEnter"
+    ,"NotAKey"
+};
+#define BINDINGS (sizeof(_bindings) / sizeof(_bindings[0]))
+
+// Last plain key name in the table, the worst case for name lookup
+const char *_key_last = NULL;
+
+
+
+static void bench_calibrate(const unsigned long n);
+static void bench_binding(const unsigned long n);
+static void bench_dpi(const unsigned long n);
+static void bench_colour(const unsigned long n);
+static void bench_print(const unsigned long n);
+static void bench_key_lookup(const unsigned long n);
+static void bench_key_name(const unsigned long n);
+static void bench_log(const unsigned long n);
+static unsigned long bench_ops(const t_bench *b, const unsigned long min_us);
+static void bench_time(t_bench *b, const unsigned long min_us);
+static int baseline_read(t_bench *bench, const size_t nbench, const char *path);
+static int baseline_write(const t_bench *bench, const size_t nbench, const char *path);
+static void help_usage(void);
+
+
+
+// Work like the others' (dependent loads from a table the size of the key
+// tables, and branches on what's loaded), that nothing here changes, to
+// measure them against
+static void bench_calibrate(const unsigned long n) {
+    static unsigned char table[BENCH_CAL_TABLE];
+    unsigned long x = _result | 1;
+    unsigned long sum = 0;
+    unsigned long i;
+
+    for (i = 0; i < n; ++i) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+
+        if (table[(x + sum) % BENCH_CAL_TABLE] == (x & 0xff)) ++sum;
+        table[x % BENCH_CAL_TABLE] = x >> 8;
+    }
+
+    _result += sum;
+}
+
+static void bench_binding(const unsigned long n) {
+    unsigned long i;
+
+    for (i = 0; i < n; ++i) _result += set_mode_button(&_mode_data[0], 4, _bindings[i % BINDINGS]);
+}
+
+static void bench_dpi(const unsigned long n) {
+    unsigned long i;
+
+    for (i = 0; i < n; ++i) {
+        _result += set_mode_dpi(&_mode_data[0], i % _model->n_dpi, _model->dpi_step * (1 + i % 16));
+        _result += set_mode_defdpi(&_mode_data[0], i % _model->n_dpi);
+    }
+}
+
+static void bench_colour(const unsigned long n) {
+    unsigned long i;
+
+    for (i = 0; i < n; ++i) _result += set_mode_colour(&_mode_data[0], i % colour_COUNT);
+}
+
+static void bench_print(const unsigned long n) {
+    unsigned long i;
+
+    for (i = 0; i < n; ++i) _result += mode_print(_sink, &_mode_data[0], _model->mode_len);
+}
+
+static void bench_key_lookup(const unsigned long n) {
+    unsigned long i;
+
+    for (i = 0; i < n; ++i) _result += set_mode_button(&_mode_data[0], 4, _key_last);
+}
+
+static void bench_key_name(const unsigned long n) {
+    unsigned char but[3] = {0, 0x05, 0};
+    char out[128];
+    unsigned long i;
+
+    for (i = 0; i < n; ++i) {
+        but[2] = 0x04 + i % 0x60;
+        _result += mode_button_str(&out[0], sizeof(out), &but[0]);
+    }
+}
+
+static void bench_log(const unsigned long n) {
+    unsigned long i;
+
+    for (i = 0; i < n; ++i) {
+        std_output(_sink, __FILE__, __LINE__, __FUNCTION__, "[I]"
+            , "Saving Mode: %s (%lu)\nSelecting Mode: %s\n", s_mode[i % mode_COUNT], i, s_mode[mode_f3]);
+    }
+}
+
+t_bench _bench[] = {
+     {"set_mode_button",  bench_binding,    0, 0}
+    ,{"set_mode_dpi",     bench_dpi,        0, 0}
+    ,{"set_mode_colour",  bench_colour,     0, 0}
+    ,{"mode_print",       bench_print,      0, 0}
+    ,{"key_lookup",       bench_key_lookup, 0, 0}
+    ,{"key_name",         bench_key_name,   0, 0}
+    ,{"std_output",       bench_log,        0, 0}
+};
+#define BENCHES (sizeof(_bench) / sizeof(_bench[0]))
+
+t_bench _calibrate = {"calibrate", bench_calibrate, 0, 0, 0};
+
+static unsigned long now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+// Returns how many ops of b take at least min_us (warming caches on the way)
+static unsigned long bench_ops(const t_bench *b, const unsigned long min_us) {
+    unsigned long n = 1;
+    unsigned long next;
+    unsigned long t;
+
+    for (;;) {
+        t = now_ns();
+        b->run(n);
+        t = now_ns() - t;
+
+        if (t >= min_us * 1000) break;
+
+        // Aim for min_us next time, but at least double
+        next = t ? n * (min_us * 1000 / t) + 1 : n * 16;
+        n = next > n * 2 ? next : n * 2;
+    }
+
+    return n;
+}
+
+// Times BENCH_ROUNDS rounds of b, each of enough ops to take at least min_us
+// and each following a round of the calibration loop, keeping the fastest
+// (b->ns, ns/op) and the lowest ratio between the two (b->ratio) seen so far
+static void bench_time(t_bench *b, const unsigned long min_us) {
+    static unsigned long cal_n = 0;
+    unsigned long n;
+    unsigned long t;
+    double cal_ns;
+    double ns;
+    int r;
+
+    if (!cal_n) cal_n = bench_ops(&_calibrate, min_us / 4 + 1);
+    n = bench_ops(b, min_us);
+
+    for (r = 0; r < BENCH_ROUNDS; ++r) {
+        t = now_ns();
+        _calibrate.run(cal_n);
+        cal_ns = (double)(now_ns() - t) / cal_n;
+
+        t = now_ns();
+        b->run(n);
+        ns = (double)(now_ns() - t) / n;
+
+        if (!b->ns || ns < b->ns)                   b->ns         = ns;
+        if (!b->ratio || ns / cal_ns < b->ratio)    b->ratio      = ns / cal_ns;
+        if (!_calibrate.ns || cal_ns < _calibrate.ns) _calibrate.ns = cal_ns;
+    }
+}
+
+// Reads "<name> <ratio>" lines ('#' comments) into the matching benchmarks.
+// Returns the number read, or -1 on error (including a baseline of ns/op, as
+// made before they were ratios)
+static int baseline_read(t_bench *bench, const size_t nbench, const char *path) {
+    char line[256];
+    char name[BENCH_NAME_LEN];
+    double ratio;
+    int found = 0;
+    FILE *fp;
+    size_t i;
+
+    fp = fopen(path, "r");
+    if (!fp) {
+        perror(path);
+        return -1;
+    }
+
+    if (!fgets(&line[0], sizeof(line), fp) || strcmp(&line[0], BENCH_HEADER) != 0) {
+        fprintf(stderr, "%s: Not a baseline of ratios, remake it (make bench-baseline)\n", path);
+        fclose(fp);
+        return -1;
+    }
+
+    while (fgets(&line[0], sizeof(line), fp)) {
+        if (line[0] == '#' || sscanf(&line[0], "%31s %lf", &name[0], &ratio) != 2) continue;
+
+        for (i = 0; i < nbench; ++i) {
+            if (strcmp(bench[i].name, &name[0]) != 0) continue;
+
+            bench[i].baseline = ratio;
+            ++found;
+        }
+    }
+
+    fclose(fp);
+
+    return found;
+}
+
+// Returns 1 on success, 0 on error
+static int baseline_write(const t_bench *bench, const size_t nbench, const char *path) {
+    FILE *fp;
+    size_t i;
+
+    fp = fopen(path, "w");
+    if (!fp) {
+        perror(path);
+        return 0;
+    }
+
+    fprintf(fp, BENCH_HEADER);
+    for (i = 0; i < nbench; ++i) fprintf(fp, "%-20s %.4f\n", bench[i].name, bench[i].ratio);
+
+    return fclose(fp) == 0;
+}
+
+static void help_usage(void) {
+    printf("\
+\n\
+%s: %s-bench [-b <baseline>] [-t <percent>] [-m <ms>] [-w <baseline>]\n\
+\n\
+-b <baseline> - %s\n\
+-t <percent>  - %s (%d)\n\
+-m <ms>       - %s (%d)\n\
+-w <baseline> - %s\n\
+\n\
+",
+     _("Usage"), BIN_NAME
+    ,_("Fails if any benchmark is slower than in <baseline>")
+    ,_("How much slower counts, as a percentage"), BENCH_TOLERANCE_DEFAULT
+    ,_("Minimum time per round, in milliseconds"), BENCH_MS_DEFAULT
+    ,_("Writes the results as a new <baseline>")
+    );
+}
+
+int main(int argc, char *argv[]) {
+    const char *base_path  = NULL;
+    const char *write_path = NULL;
+    double tolerance = BENCH_TOLERANCE_DEFAULT;
+    unsigned long ms = BENCH_MS_DEFAULT;
+    int regressed = 0;
+    size_t i;
+    int c;
+
+    while ((c = getopt(argc, argv, "hb:t:m:w:")) != -1) {
+        switch (c) {
+            case 'b': base_path  = optarg;                   break;
+            case 't': tolerance  = strtod(optarg, NULL);     break;
+            case 'm': ms         = strtoul(optarg, NULL, 0); break;
+            case 'w': write_path = optarg;                   break;
+            case 'h':
+            default:
+                help_usage();
+                return c == 'h' ? 0 : 1;
+        }
+    }
+
+    if (!ms) ms = 1;
+
+    _sink = fopen("/dev/null", "w");
+    if (!_sink) {
+        perror("/dev/null");
+        return 1;
+    }
+
+    // Setter chatter goes to stdout, which isn't what's being measured
+    _mode_verbose = 0;
+
+    // Parser errors for the rejected bindings
+    _logfile = _sink;
+
+    for (i = 0xe0; i-- > 0;) {
+        if (strncmp(s_keys[i], "UNKNOWN", 7) != 0) {
+            _key_last = s_keys[i];
+            break;
+        }
+    }
+
+    // Something worth printing
+    memset(&_mode_data[0], 0, sizeof(_mode_data));
+    _mode_data[0] = _model->mode_id[mode_f3];
+    set_mode_rate(&_mode_data[0], _model->rates[0]);
+    set_mode_colour(&_mode_data[0], colour_cyan);
+    for (c = 0; c < _model->n_dpi; ++c) set_mode_dpi(&_mode_data[0], c, _model->dpi_step * (c + 1));
+    for (c = 1; c <= _model->n_buttons; ++c) set_mode_button(&_mode_data[0], c, _bindings[c % BINDINGS]);
+
+    if (base_path && baseline_read(&_bench[0], BENCHES, base_path) < 0) return 1;
+
+    printf("%-20s %12s %12s %12s %8s\n", "Benchmark", "ns/op", "Ratio", "Baseline", "Change");
+
+    for (i = 0; i < BENCHES; ++i) {
+        t_bench *b = &_bench[i];
+        double change = 0;
+        int reg = 0;
+        int retry;
+
+        for (retry = 0; retry <= BENCH_RETRIES; ++retry) {
+            bench_time(b, ms * 1000);
+            if (!b->baseline) break;
+
+            // Noise is judged in ns, at this run's speed
+            change = (b->ratio - b->baseline) * 100 / b->baseline;
+            reg = (change > tolerance && b->ns - b->baseline * b->ns / b->ratio > BENCH_NOISE_NS);
+            if (!reg) break;
+        }
+
+        if (!b->baseline) {
+            printf("%-20s %12.1f %12.2f %12s %8s\n", b->name, b->ns, b->ratio, "-", "-");
+            continue;
+        }
+
+        printf("%-20s %12.1f %12.2f %12.2f %+7.1f%%%s\n", b->name, b->ns, b->ratio, b->baseline, change
+            , reg ? " REGRESSED" : "");
+
+        if (reg) ++regressed;
+    }
+
+    printf("%-20s %12.2f %12s %12s %8s\n", _calibrate.name, _calibrate.ns, "1", "-", "-");
+
+    fclose(_sink);
+
+    if (write_path && !baseline_write(&_bench[0], BENCHES, write_path)) return 1;
+
+    if (base_path) printf("Regressions: %d (tolerance %.0f%%)\n", regressed, tolerance);
+
+    return regressed ? 2 : 0;
+}
@@ -0,0 +1,314 @@
+/* vim:set ts=4 sw=4 tw=80 et cindent ai si cino=(0,ml,\:0:
+ * ( settings from: http://datapax.com.au/code_conventions/ )
+ */
+
+/**********************************************************************
+    RatSlap
+    Copyright (C) 2016-2020 Todd Harbour
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    version 2 ONLY, as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program, in the file COPYING or COPYING.txt; if
+    not, see http://www.gnu.org/licenses/ , or write to:
+      The Free Software Foundation, Inc.,
+      51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ **********************************************************************/
+
+/*
+ * Compiles a directory of text profiles (see profile_parse) into binary
+ * profile files, as read by ratslap's --file and --restore options, so no text
+ * parsing is needed while a mouse is attached. Files are compiled in parallel,
+ * one worker thread per CPU by default. With -s they're saved to a profile
+ * store (see store.h) instead, named after the text file.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "app.h"
+#include "lang.h"
+#include "log.h"
+#include "mode.h"
+#include "profile.h"
+#include "store.h"
+
+typedef struct s_job {
+    char in[PATH_MAX];
+    char out[PATH_MAX];
+    char err[320];
+    char name[STORE_NAME_LEN]; // For the store (-s)
+    t_profile prof;            // Compiled (-s)
+} t_job;
+
+t_job     *_jobs  = NULL;
+size_t     _njobs = 0;
+size_t     _next  = 0; // Next job to be picked up (shared by workers)
+t_profile  _base;
+int        _store = 0; // Saving to a store (-s), not files
+
+
+
+static void help_usage(void);
+static int compile_one(t_job *job);
+static void *compile_worker(void *arg);
+static int job_cmp(const void *a, const void *b);
+static int jobs_scan(const char *indir, const char *outdir);
+
+
+
+static void help_usage(void) {
+    printf("\
+\n\
+%s: %s-compile [-b <base>] [-o <outdir> | -s <store>] [-j <jobs>] <indir>\n\
+\n\
+-b <base>   - %s\n\
+-o <outdir> - %s\n\
+-s <store>  - %s\n\
+-j <jobs>   - %s\n\
+\n\
+%s\n\
+",
+     _("Usage"), BIN_NAME
+    ,_("Binary profile to start from (default: factory settings)")
+    ,_("Where to write compiled profiles (default: <indir>)")
+    ,_("Save compiled profiles to a profile store, as @<name>")
+    ,_("Number of worker threads (default: one per CPU)")
+    ,_("Compiles every text profile in <indir> to <outdir>/<name>.bin")
+    );
+}
+
+static int compile_one(t_job *job) {
+    t_profile prof = _base;
+    char err[256];
+    FILE *fp;
+    t_mode mode;
+    int line;
+
+    fp = fopen(job->in, "r");
+    if (!fp) {
+        snprintf(job->err, sizeof(job->err), "failed to open");
+        return 0;
+    }
+
+    line = profile_parse(&prof, fp, &err[0], sizeof(err));
+    fclose(fp);
+
+    if (line) {
+        snprintf(job->err, sizeof(job->err), "line %d: %s", line, err);
+        return 0;
+    }
+
+    if (!prof.present) {
+        snprintf(job->err, sizeof(job->err), "no modes");
+        return 0;
+    }
+
+    for (mode = 0; mode < mode_COUNT; ++mode) {
+        if (!(prof.present & (1 << mode))) continue;
+
+        if (!mode_validate(&prof.mode_data[mode][0], &err[0], sizeof(err))) {
+            snprintf(job->err, sizeof(job->err), "%s: %s", s_mode[mode], err);
+            return 0;
+        }
+    }
+
+    if (_store) {
+        job->prof = prof;
+        return 1;
+    }
+
+    if (profile_write(&prof, job->out) < 0) {
+        snprintf(job->err, sizeof(job->err), "failed to write compiled profile");
+        return 0;
+    }
+
+    return 1;
+}
+
+static void *compile_worker(void *arg) {
+    size_t j;
+
+    while ((j = __sync_fetch_and_add(&_next, 1)) < _njobs) compile_one(&_jobs[j]);
+
+    return NULL;
+}
+
+static int job_cmp(const void *a, const void *b) {
+    return strcmp(((const t_job *)a)->in, ((const t_job *)b)->in);
+}
+
+// Every regular, non-hidden, non .bin file in indir is a text profile
+static int jobs_scan(const char *indir, const char *outdir) {
+    struct dirent *de;
+    struct stat st;
+    size_t alloc = 0;
+    DIR *dir;
+
+    dir = opendir(indir);
+    if (!dir) {
+        perror(indir);
+        return 0;
+    }
+
+    while ((de = readdir(dir))) {
+        const char *ext = strrchr(de->d_name, '.');
+        t_job *job;
+        int baselen;
+
+        if (de->d_name[0] == '.') continue;
+        if (ext && strcmp(ext, ".bin") == 0) continue;
+
+        if (_njobs == alloc) {
+            t_job *jobs;
+
+            alloc = alloc ? alloc * 2 : 256;
+            jobs = realloc(_jobs, alloc * sizeof(*_jobs));
+            if (!jobs) {
+                perror("realloc");
+                closedir(dir);
+                return 0;
+            }
+            _jobs = jobs;
+        }
+
+        job = &_jobs[_njobs];
+        job->err[0] = '\0';
+
+        if (snprintf(job->in, sizeof(job->in), "%s/%s", indir, de->d_name) >= sizeof(job->in)) continue;
+        if (stat(job->in, &st) != 0 || !S_ISREG(st.st_mode)) continue;
+
+        baselen = ext ? ext - de->d_name : strlen(de->d_name);
+        if (snprintf(job->out, sizeof(job->out), "%s/%.*s.bin", outdir, baselen, de->d_name) >= sizeof(job->out)) continue;
+        if (snprintf(job->name, sizeof(job->name), "%.*s", baselen, de->d_name) >= sizeof(job->name)) continue;
+
+        ++_njobs;
+    }
+
+    closedir(dir);
+
+    // Report in a predictable order
+    if (_njobs) qsort(_jobs, _njobs, sizeof(*_jobs), job_cmp);
+
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    const char *outdir = NULL;
+    const char *store  = NULL;
+    long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    pthread_t *threads;
+    struct timespec t0, t1;
+    double elapsed;
+    size_t errors = 0;
+    size_t j;
+    long t;
+    int c;
+
+    memset(&_base, 0, sizeof(_base));
+
+    while ((c = getopt(argc, argv, "hb:o:s:j:")) != -1) {
+        switch (c) {
+            case 'b':
+                if (profile_read(&_base, optarg) < 0) {
+                    fprintf(stderr, "%s: %s\n", optarg, _("invalid base profile"));
+                    return 1;
+                }
+            break;
+
+            case 'o': outdir   = optarg;         break;
+            case 's': store    = optarg;         break;
+            case 'j': nthreads = atol(optarg);   break;
+
+            case 'h':
+            default:
+                help_usage();
+                return c == 'h' ? 0 : 1;
+        }
+    }
+
+    if (optind != argc - 1) {
+        help_usage();
+        return 1;
+    }
+
+    if (outdir && store) {
+        help_usage();
+        return 1;
+    }
+
+    if (store) {
+        if (!store_open(store)) return 1;
+        _store = 1;
+    }
+
+    if (!outdir) outdir = argv[optind];
+    if (nthreads < 1) nthreads = 1;
+
+    // Setters report what they're setting, which is just noise here
+    _mode_verbose = 0;
+
+    if (!jobs_scan(argv[optind], outdir)) return 1;
+
+    if ((size_t)nthreads > _njobs) nthreads = _njobs ? _njobs : 1;
+
+    threads = calloc(nthreads, sizeof(*threads));
+    if (!threads) {
+        perror("calloc");
+        return 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    for (t = 0; t < nthreads; ++t) {
+        if (pthread_create(&threads[t], NULL, compile_worker, NULL) != 0) break;
+    }
+
+    // Couldn't start any threads? Do it ourselves
+    if (!t) compile_worker(NULL);
+
+    while (t--) pthread_join(threads[t], NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+    // The store is locked per write, so keep it out of the workers
+    for (j = 0; _store && j < _njobs; ++j) {
+        if (_jobs[j].err[0]) continue;
+
+        if (store_put(_jobs[j].name, store_profile, &_jobs[j].prof) < 0) {
+            snprintf(_jobs[j].err, sizeof(_jobs[j].err), "failed to save to store");
+        }
+    }
+
+    for (j = 0; j < _njobs; ++j) {
+        if (!_jobs[j].err[0]) continue;
+
+        ++errors;
+        fprintf(stderr, "%s: %s\n", _jobs[j].in, _jobs[j].err);
+    }
+
+    printf("Compiled: %zu of %zu files (%zu errors), %ld threads\n", _njobs - errors, _njobs, errors, nthreads);
+    printf("Time:     %.3fs (%.0f files/s)\n", elapsed, elapsed > 0 ? _njobs / elapsed : 0);
+
+    free(threads);
+    free(_jobs);
+    store_close();
+
+    return errors ? 2 : 0;
+}
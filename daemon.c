@@ -0,0 +1,198 @@
+/* vim:set ts=4 sw=4 tw=80 et cindent ai si cino=(0,ml,\:0:
+ * ( settings from: http://datapax.com.au/code_conventions/ )
+ */
+
+/**********************************************************************
+    RatSlap
+    Copyright (C) 2016-2020 Todd Harbour
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    version 2 ONLY, as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program, in the file COPYING or COPYING.txt; if
+    not, see http://www.gnu.org/licenses/ , or write to:
+      The Free Software Foundation, Inc.,
+      51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ **********************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <stdint.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
+
+#include "log.h"
+#include "daemon.h"
+
+typedef struct s_watch {
+    int         fd;
+    t_daemon_cb cb;
+    void        *arg;
+} t_watch;
+
+t_watch _daemon_watch[DAEMON_WATCH_MAX];
+int _daemon_nwatch = 0;
+int _daemon_sigfd  = -1;
+int _daemon_wakefd = -1;
+int _daemon_status = 0;
+int _daemon_stop   = 0;
+
+
+
+// SIGINT/SIGTERM stop the daemon cleanly
+static int daemon_signal(const int fd, void *arg) {
+    struct signalfd_siginfo si;
+
+    if (read(fd, &si, sizeof(si)) == sizeof(si)) {
+        ilog("Received signal %d, stopping\n", si.ssi_signo);
+    }
+
+    _daemon_stop = 1;
+
+    return 0;
+}
+
+// Wakes the loop from daemon_stop() (possibly on another thread)
+static int daemon_wake(const int fd, void *arg) {
+    uint64_t val;
+
+    if (read(fd, &val, sizeof(val)) < 0) dlog(LOG, "Failed to read wake event: %s\n", strerror(errno));
+
+    return 0;
+}
+
+// Must be called before any other threads are started, so they inherit the
+// blocked signals. Returns 1 on success, 0 on error
+int daemon_init(void) {
+    sigset_t mask;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) != 0) {
+        elog("ERROR: Failed to block signals: %s\n", strerror(errno));
+        return 0;
+    }
+
+    _daemon_sigfd = signalfd(-1, &mask, SFD_CLOEXEC);
+    if (_daemon_sigfd < 0) {
+        elog("ERROR: Failed to create signal fd: %s\n", strerror(errno));
+        return 0;
+    }
+
+    _daemon_wakefd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (_daemon_wakefd < 0) {
+        elog("ERROR: Failed to create event fd: %s\n", strerror(errno));
+        return 0;
+    }
+
+    _daemon_stop   = 0;
+    _daemon_status = 0;
+
+    return (daemon_watch(_daemon_sigfd, daemon_signal, NULL)
+         && daemon_watch(_daemon_wakefd, daemon_wake, NULL));
+}
+
+void daemon_end(void) {
+    _daemon_nwatch = 0;
+
+    if (_daemon_sigfd  >= 0) close(_daemon_sigfd);
+    if (_daemon_wakefd >= 0) close(_daemon_wakefd);
+    _daemon_sigfd  = -1;
+    _daemon_wakefd = -1;
+}
+
+// Returns 1 on success, 0 on error
+int daemon_watch(const int fd, t_daemon_cb cb, void *arg) {
+    if (fd < 0 || !cb) return 0;
+
+    if (_daemon_nwatch == DAEMON_WATCH_MAX) {
+        elog("ERROR: Too many watched files (max %d)\n", DAEMON_WATCH_MAX);
+        return 0;
+    }
+
+    _daemon_watch[_daemon_nwatch].fd  = fd;
+    _daemon_watch[_daemon_nwatch].cb  = cb;
+    _daemon_watch[_daemon_nwatch].arg = arg;
+    ++_daemon_nwatch;
+
+    return 1;
+}
+
+// Returns 1 if 'fd' was being watched, 0 otherwise
+int daemon_unwatch(const int fd) {
+    int w;
+
+    for (w = 0; w < _daemon_nwatch; ++w) {
+        if (_daemon_watch[w].fd != fd) continue;
+
+        memmove(&_daemon_watch[w], &_daemon_watch[w + 1], (_daemon_nwatch - w - 1) * sizeof(_daemon_watch[0]));
+        --_daemon_nwatch;
+        return 1;
+    }
+
+    return 0;
+}
+
+// Runs until stopped (signal or daemon_stop()). Returns the stop status
+int daemon_run(void) {
+    struct pollfd pfd[DAEMON_WATCH_MAX];
+    int npfd;
+    int w;
+
+    while (!__atomic_load_n(&_daemon_stop, __ATOMIC_ACQUIRE)) {
+        // Callbacks may (un)watch, so rebuild each time around
+        npfd = _daemon_nwatch;
+        for (w = 0; w < npfd; ++w) {
+            pfd[w].fd      = _daemon_watch[w].fd;
+            pfd[w].events  = POLLIN;
+            pfd[w].revents = 0;
+        }
+
+        if (poll(&pfd[0], npfd, -1) < 0) {
+            if (errno == EINTR) continue;
+
+            elog("ERROR: poll failed: %s\n", strerror(errno));
+            _daemon_status = -1;
+            break;
+        }
+
+        for (w = 0; w < npfd; ++w) {
+            if (!pfd[w].revents) continue;
+
+            // Still watched (and by the same callback)?
+            if (w >= _daemon_nwatch || _daemon_watch[w].fd != pfd[w].fd) continue;
+
+            if (_daemon_watch[w].cb(pfd[w].fd, _daemon_watch[w].arg) != 0) {
+                daemon_unwatch(pfd[w].fd);
+                break;
+            }
+        }
+    }
+
+    return _daemon_status;
+}
+
+// Safe to call from any thread
+void daemon_stop(const int status) {
+    uint64_t val = 1;
+
+    if (status) _daemon_status = status;
+    __atomic_store_n(&_daemon_stop, 1, __ATOMIC_RELEASE);
+
+    if (_daemon_wakefd >= 0 && write(_daemon_wakefd, &val, sizeof(val)) < 0) {
+        dlog(LOG, "Failed to wake daemon: %s\n", strerror(errno));
+    }
+}
@@ -0,0 +1,44 @@
+/* vim:set ts=4 sw=4 tw=80 et cindent ai si cino=(0,ml,\:0:
+ * ( settings from: http://datapax.com.au/code_conventions/ )
+ */
+
+/**********************************************************************
+    RatSlap
+    Copyright (C) 2016-2020 Todd Harbour
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    version 2 ONLY, as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program, in the file COPYING or COPYING.txt; if
+    not, see http://www.gnu.org/licenses/ , or write to:
+      The Free Software Foundation, Inc.,
+      51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ **********************************************************************/
+
+#ifndef   DAEMON_H
+#define   DAEMON_H
+
+// Resident (--daemon) event loop. Everything the daemon does is driven by file
+// descriptors (sockets, timerfds, inotify etc.) registered here, each with a
+// callback that's run (on the main thread) when it becomes readable.
+
+#define DAEMON_WATCH_MAX 32
+
+// Returns 0 to keep watching 'fd', anything else to stop watching it
+typedef int (*t_daemon_cb)(const int fd, void *arg);
+
+int daemon_init(void);
+void daemon_end(void);
+int daemon_watch(const int fd, t_daemon_cb cb, void *arg);
+int daemon_unwatch(const int fd);
+int daemon_run(void);
+void daemon_stop(const int status);
+
+#endif /* DAEMON_H */
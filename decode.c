@@ -0,0 +1,945 @@
+/* vim:set ts=4 sw=4 tw=80 et ai si cindent cino=L0,b1,(1s,U1,m1,j1,J1,)50,*90 cinkeys=0{,0},0),0],\:,0#,!^F,o,O,e,0=break:
+ **********************************************************************
+ * RatSlap - Configuration tool for Logitech mice (currently only G300/G300S)
+ * Copyright (C) 2014-2020 Todd Harbour (krayon)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 ONLY, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program, in the file COPYING or LICENSE. If
+ * not, see http://www.gnu.org/licenses/ , or write to:
+      The Free Software Foundation, Inc.,
+      51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ **********************************************************************/
+
+/*
+ * Decodes usbmon captures of mouse traffic into named commands (as per the
+ * model, see model.c and G300s_USB_sniffing.txt) and mode contents. Reads usbmon text (as from
+ * /sys/kernel/debug/usb/usbmon/<bus>u, live or saved), pcap files (eg. from
+ * tcpdump -i usbmon<bus>) and the raw binary interface (/dev/usbmon<bus>).
+ *
+ * Captures are streamed, regular files through a sliding mmap window, so any
+ * size of capture is decoded in constant memory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/hid.h>
+
+#include "app.h"
+#include "lang.h"
+#include "log.h"
+#include "mode.h"
+#include "model.h"
+
+#define WINDOW_LEN    (64 << 20) // mmap window onto regular files
+#define READ_LEN      (1 << 20)  // Buffer for everything else (pipes, live)
+#define TEXT_LINE_MAX 65536      // Longer text lines are skipped
+#define DATA_MAX      64         // Data kept per event (enough for a mode)
+#define PENDING_MAX   64         // Requests awaiting their callback
+
+#define BUS_MAX       256
+#define DEV_MAX       128
+
+// Binary usbmon packet header (struct usbmon_packet), 64 bytes when captured
+// through the mmap interface (pcap DLT_USB_LINUX_MMAPPED)
+#define USBMON_HDR_LEN        48
+#define USBMON_HDR_LEN_MMAP   64
+
+#define PCAP_HDR_LEN          24
+#define PCAP_REC_LEN          16
+#define DLT_USB_LINUX        189
+#define DLT_USB_LINUX_MMAPPED 220
+
+typedef enum e_format {
+     format_auto = 0
+    ,format_text
+    ,format_pcap
+    ,format_usbmon
+} t_format;
+
+// What's known about each device (by bus and address): unknown, not a mouse
+// we know, or its model (index + 1)
+#define DEV_UNKNOWN 0x00
+#define DEV_OTHER   0xff
+
+typedef struct s_reader {
+    int            fd;
+    int            mapped; // Regular file, read through mmap windows
+    off_t          size;   // (mapped) File size
+    off_t          off;    // File offset of buf[0]
+    unsigned char *buf;
+    size_t         len;    // Bytes in buf
+    size_t         pos;    // Bytes of buf consumed
+    size_t         cap;    // (not mapped) Size of buf
+    int            eof;
+} t_reader;
+
+typedef struct s_event {
+    uint64_t      id;      // URB tag (0 if not captured)
+    char          type;    // 'S'ubmission, 'C'allback or 'E'rror
+    char          xfer;    // 'C'ontrol, 'I'nterrupt, 'B'ulk, 'Z' (isochronous)
+    int           in;      // Device to host
+    int           bus;
+    int           dev;
+    int           ep;
+    unsigned long ts;      // us
+    int           setup;   // Setup packet captured (below)
+    uint8_t       request_type;
+    uint8_t       request;
+    uint16_t      value;
+    uint16_t      index;
+    uint16_t      length;
+    int           status;
+    unsigned int  len;     // Data length
+    unsigned int  caplen;  // Data captured (up to DATA_MAX kept)
+    unsigned char data[DATA_MAX];
+} t_event;
+
+typedef struct s_pending {
+    int            used;
+    const t_model *model;
+    t_event        req;
+} t_pending;
+
+unsigned char _devices[BUS_MAX][DEV_MAX];
+t_pending     _pending[PENDING_MAX];
+int           _pending_next = 0;
+
+// Filters
+int _all = 0;
+int _only_bus = -1;
+int _only_dev = -1;
+
+// Flush after every command (live captures)
+int _live = 0;
+
+unsigned long _nevents   = 0;
+unsigned long _ncommands = 0;
+
+
+
+static void help_usage(void);
+static int reader_open(t_reader *r, const char *path);
+static void reader_close(t_reader *r);
+static int reader_fill(t_reader *r, const size_t n);
+static const char *reader_line(t_reader *r, size_t *linelen);
+static int parse_text(const char *line, const size_t len, t_event *ev);
+static int parse_usbmon(const unsigned char *hdr, const size_t hdrlen, const unsigned char *data, const size_t datalen, t_event *ev);
+static void devices_seed(void);
+static unsigned char device_state(const uint16_t vendor_id, const uint16_t product_id);
+static const t_model *device_wanted(const t_event *ev);
+static void decode_event(const t_event *ev);
+static int decode_text(t_reader *r);
+static int decode_pcap(t_reader *r);
+static int decode_usbmon(t_reader *r);
+
+
+
+static void help_usage(void) {
+    printf("\
+\n\
+%s: %s-decode [-a] [-d <bus>:<dev>] [-f text|pcap|usbmon] [<capture>]\n\
+\n\
+-a           - %s\n\
+-d <bus:dev> - %s\n\
+-f <format>  - %s\n\
+\n\
+%s\n\
+"
+    ,_("Usage"), BIN_NAME
+    ,_("Decodes requests to every device, not just known mice")
+    ,_("Only decodes requests to device <dev> on bus <bus>")
+    ,_("Capture format (default: pcap if it looks like it, else text)")
+    ,_("Decodes mouse commands in a usbmon <capture> (default: stdin)")
+    );
+}
+
+static int reader_open(t_reader *r, const char *path) {
+    struct stat st;
+
+    memset(r, 0, sizeof(*r));
+
+    if (!path || strcmp(path, "-") == 0) {
+        r->fd = STDIN_FILENO;
+    } else {
+        r->fd = open(path, O_RDONLY);
+        if (r->fd < 0) {
+            perror(path);
+            return 0;
+        }
+    }
+
+    if (fstat(r->fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        r->mapped = 1;
+        r->size   = st.st_size;
+        return 1;
+    }
+
+    // Pipes, and files that only look empty (debugfs) are read
+    r->cap = READ_LEN;
+    r->buf = malloc(r->cap);
+    if (!r->buf) {
+        perror("malloc");
+        if (r->fd != STDIN_FILENO) close(r->fd);
+        return 0;
+    }
+
+    return 1;
+}
+
+static void reader_close(t_reader *r) {
+    if (r->mapped) {
+        if (r->buf) munmap(r->buf, r->len);
+    } else {
+        free(r->buf);
+    }
+    r->buf = NULL;
+
+    if (r->fd != STDIN_FILENO) close(r->fd);
+}
+
+// Makes sure there's at least n bytes from pos onwards. Returns 0 if there
+// isn't that much left
+static int reader_fill(t_reader *r, const size_t n) {
+    if (r->pos + n <= r->len) return 1;
+
+    if (r->mapped) {
+        const off_t start  = r->off + r->pos;
+        const off_t window = start & ~((off_t)sysconf(_SC_PAGESIZE) - 1);
+        size_t maplen;
+        void *map;
+
+        if (start + (off_t)n > r->size) return 0;
+
+        maplen = r->size - window < WINDOW_LEN ? r->size - window : WINDOW_LEN;
+
+        if (r->buf) munmap(r->buf, r->len);
+        r->buf = NULL;
+        r->len = r->pos = 0;
+
+        map = mmap(NULL, maplen, PROT_READ, MAP_PRIVATE, r->fd, window);
+        if (map == MAP_FAILED) {
+            perror("mmap");
+            r->eof = 1;
+            return 0;
+        }
+        madvise(map, maplen, MADV_SEQUENTIAL);
+
+        r->buf = map;
+        r->off = window;
+        r->len = maplen;
+        r->pos = start - window;
+
+        return r->pos + n <= r->len;
+    }
+
+    if (n > r->cap) return 0;
+
+    if (r->pos) {
+        memmove(r->buf, r->buf + r->pos, r->len - r->pos);
+        r->off += r->pos;
+        r->len -= r->pos;
+        r->pos = 0;
+    }
+
+    while (r->len < n && !r->eof) {
+        ssize_t rd = read(r->fd, r->buf + r->len, r->cap - r->len);
+
+        if (rd < 0 && errno == EINTR) continue;
+        if (rd < 0) perror("read");
+        if (rd <= 0) {
+            r->eof = 1;
+            break;
+        }
+
+        r->len += rd;
+    }
+
+    return r->len >= n;
+}
+
+// The next line (without the newline), valid until the next read, or NULL at
+// the end
+static const char *reader_line(t_reader *r, size_t *linelen) {
+    int skipping = 0;
+
+    for (;;) {
+        const size_t avail = r->len - r->pos;
+        const char *line   = (const char *)r->buf + r->pos;
+        const char *nl     = avail ? memchr(line, '\n', avail) : NULL;
+
+        if (nl) {
+            r->pos += (nl - line) + 1;
+            if (skipping) {
+                skipping = 0;
+                continue;
+            }
+
+            *linelen = nl - line;
+            return line;
+        }
+
+        if (avail >= TEXT_LINE_MAX) {
+            // Not a usbmon line
+            r->pos = r->len;
+            skipping = 1;
+            continue;
+        }
+
+        if (!reader_fill(r, avail + 1)) {
+            // Last line, with no newline
+            if (!avail || skipping) return NULL;
+
+            line = (const char *)r->buf + r->pos;
+            r->pos += avail;
+            *linelen = avail;
+            return line;
+        }
+    }
+}
+
+static const signed char hexval[256] = {
+     ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5
+    ,['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10
+    ,['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16
+    ,['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16
+};
+
+// Value of a hex token, -1 if it isn't one (or is too long)
+static long long hex_token(const char *tok, const size_t len) {
+    long long v = 0;
+    size_t i;
+
+    if (!len || len > 16) return -1;
+
+    for (i = 0; i < len; ++i) {
+        const int h = hexval[(unsigned char)tok[i]];
+
+        if (!h) return -1;
+        v = (v << 4) | (h - 1);
+    }
+
+    return v;
+}
+
+// Value of a decimal token (optionally negative), 0 if it isn't one
+static int dec_token(const char *tok, const size_t len, long long *v) {
+    size_t i = 0;
+    int neg = 0;
+
+    if (len && tok[0] == '-') {
+        neg = 1;
+        ++i;
+    }
+    if (i == len || len - i > 18) return 0;
+
+    for (*v = 0; i < len; ++i) {
+        if (tok[i] < '0' || tok[i] > '9') return 0;
+        *v = *v * 10 + (tok[i] - '0');
+    }
+    if (neg) *v = -*v;
+
+    return 1;
+}
+
+// Next space separated token in [*p, end)
+static int next_token(const char **p, const char *end, const char **tok, size_t *toklen) {
+    const char *s = *p;
+
+    while (s < end && (*s == ' ' || *s == '\t' || *s == '\r')) ++s;
+    if (s == end) return 0;
+
+    *tok = s;
+    while (s < end && *s != ' ' && *s != '\t' && *s != '\r') ++s;
+    *toklen = s - *tok;
+    *p = s;
+
+    return 1;
+}
+
+// Parses a usbmon text line, with or without the URB tag and timestamp, eg.
+//     ffff8800b8b4e3c0 2117030035 S Co:2:039:0 s 21 09 03f0 0001 0004 4 = f0423900
+// Returns 0 for anything that isn't a control transfer event
+static int parse_text(const char *line, const size_t len, t_event *ev) {
+    const char *end = line + len;
+    const char *p   = line;
+    const char *tok[4];
+    size_t toklen[4];
+    const char *a;
+    long long v;
+    int ntok;
+    int t;
+    int n;
+
+    // The event type is followed by the address (eg. "Co:2:039:0"), at most 2
+    // tokens in
+    for (ntok = 0; ntok < 4 && next_token(&p, end, &tok[ntok], &toklen[ntok]); ++ntok);
+
+    for (t = 0; t + 1 < ntok; ++t) {
+        if (toklen[t] == 1 && (tok[t][0] == 'S' || tok[t][0] == 'C' || tok[t][0] == 'E')
+         && toklen[t + 1] >= 4 && tok[t + 1][2] == ':') break;
+    }
+    if (t + 1 >= ntok || t > 2) return 0;
+
+    a = tok[t + 1];
+    if (a[0] != 'C') return 0; // Only control transfers matter
+
+    memset(ev, 0, offsetof(t_event, data));
+    ev->type = tok[t][0];
+    ev->xfer = a[0];
+    ev->in   = a[1] == 'i';
+
+    if (t == 2) {
+        ev->id = (uint64_t)hex_token(tok[0], toklen[0]);
+        if (dec_token(tok[1], toklen[1], &v)) ev->ts = v;
+    } else if (t == 1) {
+        if (dec_token(tok[0], toklen[0], &v)) ev->ts = v;
+    }
+
+    // "Co:<bus>:<dev>:<ep>" (1u), or "Co:<dev>:<ep>" (0u)
+    {
+        const char *s  = a + 3;
+        const char *ae = a + toklen[t + 1];
+        int nums[3];
+        int nn = 0;
+
+        while (s < ae && nn < 3) {
+            const char *c = memchr(s, ':', ae - s);
+            if (!c) c = ae;
+            if (!dec_token(s, c - s, &v)) return 0;
+            nums[nn++] = v;
+            s = c + 1;
+        }
+
+        if (nn == 3) {
+            ev->bus = nums[0];
+            ev->dev = nums[1];
+            ev->ep  = nums[2];
+        } else if (nn == 2) {
+            ev->dev = nums[0];
+            ev->ep  = nums[1];
+        } else {
+            return 0;
+        }
+    }
+
+    // Carry on from just after the address
+    p = a + toklen[t + 1];
+
+    if (!next_token(&p, end, &tok[0], &toklen[0])) return 1;
+
+    if (ev->type == 'S' && toklen[0] == 1 && tok[0][0] == 's') {
+        long long setup[5];
+
+        for (n = 0; n < 5; ++n) {
+            if (!next_token(&p, end, &tok[0], &toklen[0])) return 0;
+            if ((setup[n] = hex_token(tok[0], toklen[0])) < 0) return 0;
+        }
+
+        ev->setup        = 1;
+        ev->request_type = setup[0];
+        ev->request      = setup[1];
+        ev->value        = setup[2];
+        ev->index        = setup[3];
+        ev->length       = setup[4];
+    } else {
+        // Status (or a setup tag for an uncaptured setup packet)
+        if (dec_token(tok[0], toklen[0], &v)) ev->status = v;
+    }
+
+    if (!next_token(&p, end, &tok[0], &toklen[0])) return 1;
+    if (dec_token(tok[0], toklen[0], &v) && v >= 0) ev->len = v;
+
+    if (!next_token(&p, end, &tok[0], &toklen[0])) return 1;
+    if (toklen[0] != 1 || tok[0][0] != '=') return 1;
+
+    // Data words, eg. "f5000384 04040440 ..." (only the first 32 bytes are
+    // captured by default)
+    while (next_token(&p, end, &tok[0], &toklen[0])) {
+        for (n = 0; n + 1 < (int)toklen[0]; n += 2) {
+            const int h = hexval[(unsigned char)tok[0][n]];
+            const int l = hexval[(unsigned char)tok[0][n + 1]];
+
+            if (!h || !l) return 1;
+            if (ev->caplen < DATA_MAX) ev->data[ev->caplen] = ((h - 1) << 4) | (l - 1);
+            ++ev->caplen;
+        }
+    }
+
+    return 1;
+}
+
+static uint16_t get16(const unsigned char *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const unsigned char *p) {
+    return get16(p) | ((uint32_t)get16(p + 2) << 16);
+}
+
+static uint64_t get64(const unsigned char *p) {
+    return get32(p) | ((uint64_t)get32(p + 4) << 32);
+}
+
+// Parses a binary usbmon packet (struct usbmon_packet, little endian)
+static int parse_usbmon(const unsigned char *hdr, const size_t hdrlen, const unsigned char *data, const size_t datalen, t_event *ev) {
+    static const char xfer_types[] = "ZICB";
+
+    if (hdrlen < USBMON_HDR_LEN) return 0;
+    if (hdr[9] > 3 || xfer_types[hdr[9]] != 'C') return 0;
+
+    memset(ev, 0, offsetof(t_event, data));
+    ev->id     = get64(&hdr[0]);
+    ev->type   = hdr[8];
+    ev->xfer   = 'C';
+    ev->in     = !!(hdr[10] & 0x80);
+    ev->ep     = hdr[10] & 0x7f;
+    ev->dev    = hdr[11];
+    ev->bus    = get16(&hdr[12]);
+    ev->ts     = get64(&hdr[16]) * 1000000UL + get32(&hdr[24]);
+    ev->status = (int32_t)get32(&hdr[28]);
+    ev->len    = get32(&hdr[32]);
+    ev->caplen = datalen < get32(&hdr[36]) ? datalen : get32(&hdr[36]);
+
+    // flag_setup of 0 means the setup packet was captured
+    if (ev->type == 'S' && hdr[14] == 0) {
+        ev->setup        = 1;
+        ev->request_type = hdr[40];
+        ev->request      = hdr[41];
+        ev->value        = get16(&hdr[42]);
+        ev->index        = get16(&hdr[44]);
+        ev->length       = get16(&hdr[46]);
+    }
+
+    memcpy(&ev->data[0], data, ev->caplen < DATA_MAX ? ev->caplen : DATA_MAX);
+
+    return 1;
+}
+
+// When decoding live, the devices attached now are the ones in the capture
+static void devices_seed(void) {
+    const char *base = "/sys/bus/usb/devices";
+    struct dirent *de;
+    DIR *dir;
+
+    dir = opendir(base);
+    if (!dir) return;
+
+    while ((de = readdir(dir))) {
+        unsigned int vals[4];
+        const char *names[] = { "idVendor", "idProduct", "busnum", "devnum" };
+        int n;
+
+        if (de->d_name[0] == '.' || strchr(de->d_name, ':')) continue;
+
+        for (n = 0; n < 4; ++n) {
+            char path[512];
+            FILE *fp;
+
+            snprintf(&path[0], sizeof(path), "%s/%s/%s", base, de->d_name, names[n]);
+            if (!(fp = fopen(path, "r"))) break;
+            if (fscanf(fp, n < 2 ? "%x" : "%u", &vals[n]) != 1) n = 4;
+            fclose(fp);
+            if (n == 4) break;
+        }
+        if (n != 4 || vals[2] >= BUS_MAX || vals[3] >= DEV_MAX) continue;
+
+        _devices[vals[2]][vals[3]] = device_state(vals[0], vals[1]);
+    }
+
+    closedir(dir);
+}
+
+static unsigned char device_state(const uint16_t vendor_id, const uint16_t product_id) {
+    const t_model *model = model_find(vendor_id, product_id);
+
+    return model ? model - &models[0] + 1 : DEV_OTHER;
+}
+
+// Whether a request looks like one of the model's
+static int model_request(const t_model *model, const t_event *req) {
+    int i;
+
+    if (req->index != model->interface) return 0;
+
+    for (i = 0; i < mode_COUNT; ++i) {
+        if (req->value == model->mode_value[i] || req->value == model->select[i].value) return 1;
+    }
+    for (i = 0; i < model->n_editmode; ++i) {
+        if (req->value == model->editmode[i].value) return 1;
+    }
+
+    return 0;
+}
+
+// The model of the mouse a request is to, NULL if it isn't to one we know
+static const t_model *device_model(const t_event *ev) {
+    int i;
+
+    if (ev->bus < BUS_MAX && ev->dev < DEV_MAX) {
+        const unsigned char st = _devices[ev->bus][ev->dev];
+
+        if (st == DEV_OTHER)   return NULL;
+        if (st != DEV_UNKNOWN) return &models[st - 1];
+    }
+
+    // Not seen enumerated, so go by what it looks like
+    for (i = 0; i < n_models; ++i) {
+        if (model_request(&models[i], ev)) return &models[i];
+    }
+
+    return NULL;
+}
+
+static const t_model *device_wanted(const t_event *ev) {
+    const t_model *model = device_model(ev);
+
+    if (_only_bus >= 0 && (ev->bus != _only_bus || ev->dev != _only_dev)) return NULL;
+
+    // Decoded as the default model, if nothing else
+    if (!model && (_all || _only_bus >= 0)) return _model;
+
+    return model;
+}
+
+static void print_data(const t_event *ev) {
+    unsigned int i;
+
+    printf("  Data:               ");
+    for (i = 0; i < ev->caplen && i < DATA_MAX; ++i) {
+        printf("%s%.2x", i && i % 4 == 0 ? " " : "", ev->data[i]);
+    }
+    printf("\n");
+}
+
+static void print_mode(const t_model *model, const t_event *ev) {
+    unsigned char mode_data[MODE_DATA_LEN];
+    const unsigned int len = model->mode_len;
+
+    memset(&mode_data[0], 0, sizeof(mode_data));
+    memcpy(&mode_data[0], &ev->data[0], ev->caplen < len ? ev->caplen : len);
+
+    // mode_print() decodes as per _model
+    _model = model;
+    mode_print(stdout, &mode_data[0], MODE_DATA_LEN);
+
+    if (ev->caplen < len) {
+        printf("  (only %u of %u bytes captured)\n", ev->caplen, len);
+    }
+}
+
+// The model's command that xfer (with the data captured) is, NULL if none
+static const t_model_xfer *model_command(const t_model *model, const t_event *req, const t_event *ev) {
+    int i;
+
+#define matches(x) ((x)->value == req->value && (x)->len == ev->len \
+                 && memcmp(&(x)->data[0], &ev->data[0], ev->caplen < (x)->len ? ev->caplen : (x)->len) == 0)
+
+    for (i = 0; i < mode_COUNT; ++i) {
+        if (matches(&model->select[i])) return &model->select[i];
+    }
+    for (i = 0; i < model->n_editmode; ++i) {
+        if (matches(&model->editmode[i])) return &model->editmode[i];
+    }
+
+#undef matches
+
+    return NULL;
+}
+
+// Names (and prints) the command a request is
+static void decode_command(const t_model *model, const t_event *req, const t_event *ev) {
+    const t_model_xfer *cmd = NULL;
+    const char *mname = NULL;
+    int active = 0;
+    int raw = 0;
+    char name[64];
+    t_mode mode;
+
+    for (mode = mode_f3; mode < mode_COUNT; ++mode) {
+        if (req->value == model->mode_value[mode]) mname = s_mode[mode];
+    }
+
+    if (req->request_type == 0x21 && req->request == HID_REQ_SET_REPORT) {
+        if (mname) {
+            snprintf(&name[0], sizeof(name), "Save Mode: %s", mname);
+        } else if ((cmd = model_command(model, req, ev))) {
+            snprintf(&name[0], sizeof(name), "%s", cmd->name);
+        } else {
+            snprintf(&name[0], sizeof(name), "SET_REPORT 0x%.4x", req->value);
+            raw = 1;
+        }
+    } else if (req->request_type == 0xa1 && req->request == HID_REQ_GET_REPORT) {
+        if (mname) snprintf(&name[0], sizeof(name), "Load Mode: %s", mname);
+        else if (req->value == model->select[0].value) {
+            snprintf(&name[0], sizeof(name), "Read Active Mode");
+            active = 1;
+        } else {
+            snprintf(&name[0], sizeof(name), "GET_REPORT 0x%.4x", req->value);
+            raw = 1;
+        }
+    } else {
+        return;
+    }
+
+    ++_ncommands;
+
+    printf("%lu.%.6lu %d:%.3d %s", ev->ts / 1000000, ev->ts % 1000000, ev->bus, ev->dev, name);
+    if (ev->status != 0) printf(" (failed: %d)", ev->status);
+    printf("\n");
+
+    if (ev->status == 0 && ev->caplen) {
+        if (mname && ev->caplen >= 4) {
+            print_mode(model, ev);
+        } else if (active) {
+            mode = model_active(model, &ev->data[0], ev->caplen);
+            printf("  %-21s%s\n", "Mode:", mode < mode_COUNT ? s_mode[mode] : "unknown");
+        } else if (raw) {
+            print_data(ev);
+        }
+    }
+
+    if (_live) fflush(stdout);
+}
+
+static void decode_event(const t_event *ev) {
+    const t_model *model;
+    t_pending *pend = NULL;
+    int i;
+
+    ++_nevents;
+
+    // Learn who's who from device descriptors as they're read
+    if (ev->type == 'C' && ev->in && ev->ep == 0 && ev->status == 0
+     && ev->caplen >= 12 && ev->data[0] == 18 && ev->data[1] == 1
+     && ev->bus < BUS_MAX && ev->dev < DEV_MAX) {
+        _devices[ev->bus][ev->dev] = device_state(get16(&ev->data[8]), get16(&ev->data[10]));
+        return;
+    }
+
+    if (ev->type == 'S') {
+        if (!ev->setup) return;
+        if ((ev->request_type & 0x7f) != 0x21) return; // Class, interface
+        if (!(model = device_wanted(ev))) return;
+
+        // SET_REPORT data goes out with the request (and captures often have
+        // no callbacks), GET_REPORT data comes back with the callback
+        if (!ev->in) {
+            t_event out = *ev;
+
+            out.status = 0; // -EINPROGRESS
+            decode_command(model, ev, &out);
+        }
+
+        pend = &_pending[_pending_next];
+        _pending_next = (_pending_next + 1) % PENDING_MAX;
+        pend->used  = 1;
+        pend->model = model;
+        pend->req   = *ev;
+        return;
+    }
+
+    // Callback (or submission error): find the request it's for, by URB tag if
+    // we have it, else the most recent on the same endpoint
+    for (i = 1; i <= PENDING_MAX; ++i) {
+        t_pending *p = &_pending[(_pending_next + PENDING_MAX - i) % PENDING_MAX];
+
+        if (!p->used) continue;
+        if (ev->id ? p->req.id != ev->id
+                   : (p->req.bus != ev->bus || p->req.dev != ev->dev || p->req.ep != ev->ep || p->req.in != ev->in)) continue;
+
+        pend = p;
+        break;
+    }
+    if (!pend) return;
+
+    pend->used = 0;
+
+    if (!pend->req.in) {
+        // Already decoded, all that's left is whether it worked
+        if (ev->status != 0 || ev->type == 'E') {
+            printf("%lu.%.6lu %d:%.3d (%.4x failed: %d)\n"
+                ,ev->ts / 1000000, ev->ts % 1000000, ev->bus, ev->dev
+                ,pend->req.value, ev->status ? ev->status : -1);
+            if (_live) fflush(stdout);
+        }
+    } else {
+        t_event res = *ev;
+
+        if (res.type == 'E' && !res.status) res.status = -1;
+        decode_command(pend->model, &pend->req, &res);
+    }
+}
+
+static int decode_text(t_reader *r) {
+    const char *line;
+    size_t len;
+    t_event ev;
+
+    while ((line = reader_line(r, &len))) {
+        if (parse_text(line, len, &ev)) decode_event(&ev);
+    }
+
+    return 1;
+}
+
+static int decode_pcap(t_reader *r) {
+    const unsigned char *p;
+    uint32_t linktype;
+    size_t hdrlen;
+    t_event ev;
+
+    if (!reader_fill(r, PCAP_HDR_LEN)) return 0;
+    p = r->buf + r->pos;
+
+    if (get32(p) != 0xa1b2c3d4 && get32(p) != 0xa1b23c4d) {
+        fprintf(stderr, "%s\n", _("Not a (little endian) pcap capture"));
+        return 0;
+    }
+
+    linktype = get32(p + 20);
+    if      (linktype == DLT_USB_LINUX)         hdrlen = USBMON_HDR_LEN;
+    else if (linktype == DLT_USB_LINUX_MMAPPED) hdrlen = USBMON_HDR_LEN_MMAP;
+    else {
+        fprintf(stderr, "%s: %u\n", _("Not a usbmon capture, link type"), linktype);
+        return 0;
+    }
+    r->pos += PCAP_HDR_LEN;
+
+    while (reader_fill(r, PCAP_REC_LEN)) {
+        const uint32_t incl = get32(r->buf + r->pos + 8);
+
+        r->pos += PCAP_REC_LEN;
+        if (!reader_fill(r, incl)) break;
+
+        p = r->buf + r->pos;
+        if (incl >= hdrlen && parse_usbmon(p, hdrlen, p + hdrlen, incl - hdrlen, &ev)) decode_event(&ev);
+
+        r->pos += incl;
+    }
+
+    return 1;
+}
+
+// As read from /dev/usbmon<bus>: each event's header followed by the data
+// captured
+static int decode_usbmon(t_reader *r) {
+    const unsigned char *p;
+    uint32_t caplen;
+    t_event ev;
+
+    while (reader_fill(r, USBMON_HDR_LEN)) {
+        caplen = get32(r->buf + r->pos + 36);
+        if (!reader_fill(r, USBMON_HDR_LEN + caplen)) break;
+
+        p = r->buf + r->pos;
+        if (parse_usbmon(p, USBMON_HDR_LEN, p + USBMON_HDR_LEN, caplen, &ev)) decode_event(&ev);
+
+        r->pos += USBMON_HDR_LEN + caplen;
+    }
+
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    t_format format = format_auto;
+    const char *path = NULL;
+    struct timespec t0, t1;
+    double elapsed;
+    off_t bytes;
+    t_reader r;
+    int ok;
+    int c;
+
+    while ((c = getopt(argc, argv, "had:f:")) != -1) {
+        switch (c) {
+            case 'a': _all = 1; break;
+
+            case 'd':
+                if (sscanf(optarg, "%d:%d", &_only_bus, &_only_dev) != 2 || _only_bus < 0 || _only_dev < 0) {
+                    fprintf(stderr, "%s: %s\n", optarg, _("invalid device (expected <bus>:<dev>)"));
+                    return 1;
+                }
+            break;
+
+            case 'f':
+                if      (strcmp(optarg, "text")   == 0) format = format_text;
+                else if (strcmp(optarg, "pcap")   == 0) format = format_pcap;
+                else if (strcmp(optarg, "usbmon") == 0) format = format_usbmon;
+                else {
+                    fprintf(stderr, "%s: %s\n", optarg, _("invalid format"));
+                    return 1;
+                }
+            break;
+
+            case 'h':
+            default:
+                help_usage();
+                return c == 'h' ? 0 : 1;
+        }
+    }
+
+    if (optind < argc - 1) {
+        help_usage();
+        return 1;
+    }
+    if (optind == argc - 1) path = argv[optind];
+
+    if (!reader_open(&r, path)) return 1;
+
+    // Live capture, so the devices in it are attached now
+    _live = !r.mapped;
+    if (path && (strncmp(path, "/sys/kernel/debug/usb/usbmon/", 29) == 0 || strncmp(path, "/dev/usbmon", 11) == 0)) {
+        devices_seed();
+    }
+
+    if (format == format_auto) {
+        if (path && strncmp(path, "/dev/usbmon", 11) == 0) {
+            format = format_usbmon;
+        } else if (reader_fill(&r, 4)
+               && (get32(r.buf + r.pos) == 0xa1b2c3d4 || get32(r.buf + r.pos) == 0xa1b23c4d)) {
+            format = format_pcap;
+        } else {
+            format = format_text;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    switch (format) {
+        case format_pcap:   ok = decode_pcap(&r);   break;
+        case format_usbmon: ok = decode_usbmon(&r); break;
+        default:            ok = decode_text(&r);   break;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+    bytes = r.off + r.pos;
+    reader_close(&r);
+
+    fprintf(stderr, "Decoded: %lu commands from %lu control transfer events\n", _ncommands, _nevents);
+    fprintf(stderr, "Time:    %.3fs (%.1f MiB, %.0f MiB/s)\n"
+        ,elapsed, bytes / 1048576.0, elapsed > 0 ? bytes / 1048576.0 / elapsed : 0);
+
+    return ok ? 0 : 2;
+}
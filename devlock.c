@@ -0,0 +1,177 @@
+/* vim:set ts=4 sw=4 tw=80 et cindent ai si cino=(0,ml,\:0:
+ * ( settings from: http://datapax.com.au/code_conventions/ )
+ */
+
+/**********************************************************************
+    RatSlap
+    Copyright (C) 2016-2020 Todd Harbour
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    version 2 ONLY, as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program, in the file COPYING or COPYING.txt; if
+    not, see http://www.gnu.org/licenses/ , or write to:
+      The Free Software Foundation, Inc.,
+      51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "log.h"
+#include "metrics.h"
+#include "devlock.h"
+
+#define DEVLOCK_POLL_MIN   1000 // us, doubling each time it's still busy
+#define DEVLOCK_POLL_MAX  50000 // us
+
+int _devlock_fd = -1;
+
+
+
+static int lock_path(char *out, const size_t outlen, const char *device) {
+    const char *dir = DEVLOCK_DIR;
+
+    if (access(dir, W_OK) != 0) {
+        dir = getenv("TMPDIR");
+        if (!dir || !*dir) dir = "/tmp";
+    }
+
+    return snprintf(out, outlen, "%s/ratslap-%s.lock", dir, device) < outlen;
+}
+
+// Writes our PID (and whether we're a daemon) to the lock file we hold, if it's
+// ours to write. Returns 1 on success, 0 on error
+static int holder_write(const int daemon) {
+    char pid[32];
+    int len;
+
+    if (_devlock_fd < 0) return 0;
+    if ((fcntl(_devlock_fd, F_GETFL) & O_ACCMODE) != O_RDWR) return 1;
+
+    len = snprintf(&pid[0], sizeof(pid), "%d%s\n", (int)getpid(), daemon ? " daemon" : "");
+
+    return ftruncate(_devlock_fd, 0) == 0 && pwrite(_devlock_fd, &pid[0], len, 0) == len;
+}
+
+// Locks device, waiting up to timeout_us if another process has it. The time
+// spent waiting is returned in waited_us. Returns 1 once locked, 0 if it was
+// still busy after timeout_us, -1 if locking isn't possible (eg. no lock file)
+int devlock_acquire(const char *device, const unsigned long timeout_us, unsigned long *waited_us) {
+    const unsigned long start = metrics_now_us();
+    unsigned long poll = DEVLOCK_POLL_MIN;
+    char path[256];
+    int fd;
+
+    if (waited_us) *waited_us = 0;
+
+    if (_devlock_fd >= 0) return 1;
+
+    if (!device || !*device || !lock_path(&path[0], sizeof(path), device)) return -1;
+
+    // Only whoever created it can write the holder's PID; anyone else can
+    // still lock it (flock() doesn't need write access)
+    fd = open(&path[0], O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0644);
+    if (fd < 0 && errno == EACCES) fd = open(&path[0], O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        elog("WARNING: Failed to open lock file %s: %s\n", &path[0], strerror(errno));
+        return -1;
+    }
+
+    // No way to give flock() a timeout, so poll (backing off)
+    while (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        unsigned long waited = metrics_now_us() - start;
+
+        if (errno != EWOULDBLOCK && errno != EINTR) {
+            elog("WARNING: Failed to lock %s: %s\n", &path[0], strerror(errno));
+            close(fd);
+            return -1;
+        }
+
+        if (waited >= timeout_us) {
+            if (waited_us) *waited_us = waited;
+            close(fd);
+            return 0;
+        }
+
+        if (poll > timeout_us - waited) poll = timeout_us - waited;
+        usleep(poll);
+        if (poll < DEVLOCK_POLL_MAX) poll *= 2;
+    }
+
+    if (waited_us) *waited_us = metrics_now_us() - start;
+
+    _devlock_fd = fd;
+
+    // Let anyone waiting know who has it (if it's ours to write)
+    if (!holder_write(0)) dlog(LOG_USB, "Failed to write PID to lock file %s\n", &path[0]);
+
+    return 1;
+}
+
+// Notes that the holder is a daemon, so there's no point waiting for it.
+// Returns 1 on success, 0 on error (including not holding a lock)
+int devlock_set_daemon(void) {
+    return holder_write(1);
+}
+
+// The PID of whoever has device locked, 0 if nobody (or unknown), and in daemon
+// (if not NULL) whether it's a daemon. Only a lock file root (or we) created is
+// believed, anyone else could have written it.
+pid_t devlock_holder(const char *device, int *daemon) {
+    struct stat st;
+    char path[256];
+    char pid[32];
+    ssize_t rd;
+    int fd;
+
+    if (daemon) *daemon = 0;
+
+    if (!device || !*device || !lock_path(&path[0], sizeof(path), device)) return 0;
+
+    fd = open(&path[0], O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) return 0;
+
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || (st.st_uid != 0 && st.st_uid != geteuid())) {
+        close(fd);
+        return 0;
+    }
+
+    // Not locked, so whatever's in there is stale
+    if (flock(fd, LOCK_SH | LOCK_NB) == 0) {
+        close(fd);
+        return 0;
+    }
+
+    rd = pread(fd, &pid[0], sizeof(pid) - 1, 0);
+    close(fd);
+    if (rd <= 0) return 0;
+
+    pid[rd] = '\0';
+
+    if (daemon) *daemon = (strstr(&pid[0], " daemon") != NULL);
+
+    return (pid_t)atoi(&pid[0]);
+}
+
+void devlock_release(void) {
+    if (_devlock_fd < 0) return;
+
+    // Closing releases the lock
+    close(_devlock_fd);
+    _devlock_fd = -1;
+}
@@ -0,0 +1,44 @@
+/* vim:set ts=4 sw=4 tw=80 et cindent ai si cino=(0,ml,\:0:
+ * ( settings from: http://datapax.com.au/code_conventions/ )
+ */
+
+/**********************************************************************
+    RatSlap
+    Copyright (C) 2016-2020 Todd Harbour
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    version 2 ONLY, as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program, in the file COPYING or COPYING.txt; if
+    not, see http://www.gnu.org/licenses/ , or write to:
+      The Free Software Foundation, Inc.,
+      51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ **********************************************************************/
+
+#ifndef   DEVLOCK_H
+#define   DEVLOCK_H
+
+#include <sys/types.h>
+
+// Advisory locks keeping ratslap processes from using the same mouse at once
+// (their edit sessions would interleave), keyed by device (sysfs name, ie. bus
+// and port path, eg. "2-1.4"). Lock files live in DEVLOCK_DIR, or the temp
+// directory if that's not writable, and hold the PID of the holder (followed by
+// "daemon" if it's a daemon, which keeps the mouse until it's stopped).
+
+#define DEVLOCK_DIR       "/run/lock"
+#define DEVLOCK_WAIT_MS   30000 // Default time to wait for another process
+
+int devlock_acquire(const char *device, const unsigned long timeout_us, unsigned long *waited_us);
+pid_t devlock_holder(const char *device, int *daemon);
+int devlock_set_daemon(void);
+void devlock_release(void);
+
+#endif /* DEVLOCK_H */
@@ -0,0 +1,357 @@
+/* vim:set ts=4 sw=4 tw=80 et cindent ai si cino=(0,ml,\:0:
+ * ( settings from: http://datapax.com.au/code_conventions/ )
+ */
+
+/**********************************************************************
+    RatSlap
+    Copyright (C) 2016-2020 Todd Harbour
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    version 2 ONLY, as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program, in the file COPYING or COPYING.txt; if
+    not, see http://www.gnu.org/licenses/ , or write to:
+      The Free Software Foundation, Inc.,
+      51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "log.h"
+#include "devsel.h"
+
+#define DEVSEL_SYSFS      "/sys/bus/usb/devices"
+#define DEVSEL_CACHE_MAX  16   // Entries kept in the cache file
+
+// Each line of the cache file maps a device selection to where it was last
+// found:
+//     <vid>:<pid> <device|-> <serial|-> <bus> <address> <path>
+// eg.
+//     046d:c246 - 1234ABCD 2 17 2-1.4
+typedef struct s_cache_entry {
+    unsigned short vendor_id;
+    unsigned short product_id;
+    char           path[DEVSEL_PATH_LEN];
+    char           serial[DEVSEL_SERIAL_LEN];
+    t_devloc       loc;
+} t_cache_entry;
+
+
+
+// Parses a device path of the form "bus:port[.port...]" (or the sysfs form,
+// "bus-port[.port...]"). Returns 1 on success, 0 on error
+int devsel_parse_path(t_devsel *sel, const char *arg) {
+    uint8_t ports[DEVSEL_PORTS_MAX];
+    unsigned long val;
+    const char *p = arg;
+    char *end = NULL;
+    int bus = 0;
+    int nports = 0;
+
+    if (!sel || !arg || !isdigit((unsigned char)*p)) return 0;
+
+    val = strtoul(p, &end, 10);
+    if (val < 1 || val > 255 || (*end != ':' && *end != '-')) return 0;
+    bus = (int)val;
+
+    do {
+        p = end + 1;
+        if (!isdigit((unsigned char)*p) || nports == DEVSEL_PORTS_MAX) return 0;
+
+        val = strtoul(p, &end, 10);
+        if (val < 1 || val > 255) return 0;
+        ports[nports++] = (uint8_t)val;
+    } while (*end == '.');
+
+    if (*end != '\0') return 0;
+
+    return devsel_path(&sel->path[0], sizeof(sel->path), (uint8_t)bus, &ports[0], nports);
+}
+
+// Formats bus and port numbers as a sysfs device name. Returns 1 on success, 0
+// on error
+int devsel_path(char *out, const size_t outlen, const uint8_t bus, const uint8_t *ports, const int nports) {
+    size_t len;
+    int i;
+
+    if (!out || !ports || nports < 1) return 0;
+
+    len = snprintf(out, outlen, "%d-%d", bus, ports[0]);
+    for (i = 1; i < nports && len < outlen; ++i) {
+        len += snprintf(out + len, outlen - len, ".%d", ports[i]);
+    }
+
+    return (len < outlen);
+}
+
+// Reads a (single line) sysfs attribute of the device, without the newline.
+// Returns 1 on success, 0 on error
+static int sysfs_attr(const char *path, const char *attr, char *out, const size_t outlen) {
+    char fn[128];
+    FILE *fp;
+
+    if (snprintf(&fn[0], sizeof(fn), "%s/%s/%s", DEVSEL_SYSFS, path, attr) >= sizeof(fn)) return 0;
+
+    fp = fopen(&fn[0], "r");
+    if (!fp) return 0;
+
+    if (!fgets(out, outlen, fp)) {
+        fclose(fp);
+        return 0;
+    }
+
+    fclose(fp);
+
+    out[strcspn(out, "\n")] = '\0';
+
+    return 1;
+}
+
+// Checks the device at 'loc' is (still) the one we're after. The device
+// address changes on every reconnect so this catches devices being swapped
+// around. Returns 1 if it matches, 0 otherwise
+static int sysfs_check(const t_devloc *loc, const uint16_t vendor_id, const uint16_t product_id, const char *serial) {
+    char val[DEVSEL_SERIAL_LEN];
+
+    if (!sysfs_attr(&loc->path[0], "busnum", &val[0], sizeof(val))
+     || atoi(&val[0]) != loc->bus) return 0;
+
+    if (!sysfs_attr(&loc->path[0], "devnum", &val[0], sizeof(val))
+     || atoi(&val[0]) != loc->address) return 0;
+
+    if (!sysfs_attr(&loc->path[0], "idVendor", &val[0], sizeof(val))
+     || strtoul(&val[0], NULL, 16) != vendor_id) return 0;
+
+    if (!sysfs_attr(&loc->path[0], "idProduct", &val[0], sizeof(val))
+     || strtoul(&val[0], NULL, 16) != product_id) return 0;
+
+    if (serial && serial[0]) {
+        if (!sysfs_attr(&loc->path[0], "serial", &val[0], sizeof(val))
+         || strcmp(&val[0], serial) != 0) return 0;
+    }
+
+    return 1;
+}
+
+// Reads the USB serial number of the device at path (eg. "2-1.4"). Returns 1
+// on success, 0 on error (eg. the device has none)
+int devsel_serial(const char *path, char *out, const size_t outlen) {
+    if (!path || !path[0] || !out || !outlen) return 0;
+
+    if (!sysfs_attr(path, "serial", out, outlen)) return 0;
+
+    return (out[0] != '\0');
+}
+
+// Checks whether the sysfs device name is a device (not an interface, eg.
+// "2-1.4:1.0", or root hub, eg. "usb2") of vendor_id:product_id, matching sel.
+// Fills in loc if it is. Returns 1 if it matches, 0 otherwise
+static int sysfs_match(const char *name, const t_devsel *sel, const uint16_t vendor_id, const uint16_t product_id, t_devloc *loc) {
+    char val[DEVSEL_SERIAL_LEN];
+
+    if (!isdigit((unsigned char)name[0]) || strchr(name, ':')) return 0;
+    if (strlen(name) >= sizeof(loc->path)) return 0;
+
+    // Cheapest rejection first, most devices won't be ours
+    if (!sysfs_attr(name, "idVendor", &val[0], sizeof(val))
+     || strtoul(&val[0], NULL, 16) != vendor_id) return 0;
+
+    if (!sysfs_attr(name, "idProduct", &val[0], sizeof(val))
+     || strtoul(&val[0], NULL, 16) != product_id) return 0;
+
+    if (sel->serial[0]) {
+        if (!sysfs_attr(name, "serial", &val[0], sizeof(val))
+         || strcmp(&val[0], &sel->serial[0]) != 0) return 0;
+    }
+
+    if (!sysfs_attr(name, "busnum", &val[0], sizeof(val))) return 0;
+    loc->bus = atoi(&val[0]);
+
+    if (!sysfs_attr(name, "devnum", &val[0], sizeof(val))) return 0;
+    loc->address = atoi(&val[0]);
+
+    strcpy(&loc->path[0], name);
+
+    return (loc->bus > 0 && loc->address > 0);
+}
+
+// Finds the selected device from sysfs alone, so nothing is opened (or even
+// enumerated by libusb) but the device itself. With a device path selected
+// only that device is looked at. If more than one matches, loc is the first
+// (by path). Returns the number that match, or -1 if sysfs can't be read
+int devsel_sysfs_find(const t_devsel *sel, const uint16_t vendor_id, const uint16_t product_id, t_devloc *loc) {
+    struct dirent *de;
+    t_devloc cand;
+    int found = 0;
+    DIR *dir;
+
+    if (!sel || !loc) return -1;
+
+    if (sel->path[0]) return sysfs_match(&sel->path[0], sel, vendor_id, product_id, loc);
+
+    dir = opendir(DEVSEL_SYSFS);
+    if (!dir) {
+        dlog(LOG_USB, "Failed to open %s: %s\n", DEVSEL_SYSFS, strerror(errno));
+        return -1;
+    }
+
+    while ((de = readdir(dir))) {
+        if (!sysfs_match(de->d_name, sel, vendor_id, product_id, &cand)) continue;
+
+        if (!found++ || strcmp(&cand.path[0], &loc->path[0]) < 0) memcpy(loc, &cand, sizeof(*loc));
+    }
+
+    closedir(dir);
+
+    return found;
+}
+
+// Determines the cache file name, (optionally) creating the directory for it.
+// Returns 1 on success, 0 on error
+static int cache_file(char *out, const size_t outlen, const int create) {
+    char dir[4096];
+    const char *base = getenv("XDG_CACHE_HOME");
+
+    if (base && base[0]) {
+        if (snprintf(&dir[0], sizeof(dir), "%s", base) >= sizeof(dir)) return 0;
+    } else {
+        base = getenv("HOME");
+        if (!base || !base[0]) return 0;
+
+        if (snprintf(&dir[0], sizeof(dir), "%s/.cache", base) >= sizeof(dir)) return 0;
+    }
+
+    if (create && mkdir(&dir[0], 0700) != 0 && errno != EEXIST) return 0;
+
+    if (strlen(&dir[0]) + sizeof("/ratslap") > sizeof(dir)) return 0;
+    strcat(&dir[0], "/ratslap");
+
+    if (create && mkdir(&dir[0], 0700) != 0 && errno != EEXIST) return 0;
+
+    return (snprintf(out, outlen, "%s/devices", &dir[0]) < outlen);
+}
+
+// Reads up to 'max' entries from the cache file. Returns number read
+static int cache_read(t_cache_entry *entries, const int max) {
+    char fn[4096];
+    char line[512];
+    FILE *fp;
+    int n = 0;
+
+    if (!cache_file(&fn[0], sizeof(fn), 0)) return 0;
+
+    fp = fopen(&fn[0], "r");
+    if (!fp) return 0;
+
+    while (n < max && fgets(&line[0], sizeof(line), fp)) {
+        t_cache_entry *ent = &entries[n];
+
+        if (sscanf(&line[0], "%4hx:%4hx %31s %127s %d %d %31s"
+                ,&ent->vendor_id, &ent->product_id
+                ,&ent->path[0], &ent->serial[0]
+                ,&ent->loc.bus, &ent->loc.address, &ent->loc.path[0]) != 7) continue;
+
+        if (strcmp(&ent->path[0],   "-") == 0) ent->path[0]   = '\0';
+        if (strcmp(&ent->serial[0], "-") == 0) ent->serial[0] = '\0';
+
+        ++n;
+    }
+
+    fclose(fp);
+
+    return n;
+}
+
+static int cache_match(const t_cache_entry *ent, const t_devsel *sel, const uint16_t vendor_id, const uint16_t product_id) {
+    return (ent->vendor_id == vendor_id && ent->product_id == product_id
+         && strcmp(&ent->path[0],   &sel->path[0])   == 0
+         && strcmp(&ent->serial[0], &sel->serial[0]) == 0);
+}
+
+// Looks up where the selected device was last found and checks it's still
+// there. Returns 1 (and fills in 'loc') if so, 0 otherwise
+int devsel_cache_lookup(const t_devsel *sel, const uint16_t vendor_id, const uint16_t product_id, t_devloc *loc) {
+    t_cache_entry entries[DEVSEL_CACHE_MAX];
+    int n, i;
+
+    if (!sel || !loc) return 0;
+
+    n = cache_read(&entries[0], DEVSEL_CACHE_MAX);
+    for (i = 0; i < n; ++i) {
+        if (!cache_match(&entries[i], sel, vendor_id, product_id)) continue;
+
+        if (!sysfs_check(&entries[i].loc, vendor_id, product_id, &sel->serial[0])) {
+            dlog(LOG_USB, "Cached device %s (%d:%d) is gone\n"
+                ,&entries[i].loc.path[0], entries[i].loc.bus, entries[i].loc.address);
+            return 0;
+        }
+
+        memcpy(loc, &entries[i].loc, sizeof(*loc));
+        return 1;
+    }
+
+    return 0;
+}
+
+// Remembers where the selected device was found, most recent first. Returns 1
+// on success, 0 on error
+int devsel_cache_store(const t_devsel *sel, const uint16_t vendor_id, const uint16_t product_id, const t_devloc *loc) {
+    t_cache_entry entries[DEVSEL_CACHE_MAX];
+    char fn[4096];
+    char tmpfn[4096];
+    FILE *fp;
+    int n, i;
+
+    if (!sel || !loc) return 0;
+
+    // Serials are free text, don't try to store any we couldn't read back
+    if (strcmp(&sel->serial[0], "-") == 0 || strpbrk(&sel->serial[0], " \t\r\n")) return 0;
+
+    if (!cache_file(&fn[0], sizeof(fn), 1)) return 0;
+    if (snprintf(&tmpfn[0], sizeof(tmpfn), "%s.tmp", &fn[0]) >= sizeof(tmpfn)) return 0;
+
+    n = cache_read(&entries[0], DEVSEL_CACHE_MAX);
+
+    fp = fopen(&tmpfn[0], "w");
+    if (!fp) {
+        dlog(LOG_USB, "Failed to create device cache %s: %s\n", &tmpfn[0], strerror(errno));
+        return 0;
+    }
+
+    fprintf(fp, "%.4x:%.4x %s %s %d %d %s\n"
+        ,vendor_id, product_id
+        ,sel->path[0]   ? &sel->path[0]   : "-"
+        ,sel->serial[0] ? &sel->serial[0] : "-"
+        ,loc->bus, loc->address, &loc->path[0]);
+
+    for (i = 0; i < n && i < DEVSEL_CACHE_MAX - 1; ++i) {
+        if (cache_match(&entries[i], sel, vendor_id, product_id)) continue;
+
+        fprintf(fp, "%.4x:%.4x %s %s %d %d %s\n"
+            ,entries[i].vendor_id, entries[i].product_id
+            ,entries[i].path[0]   ? &entries[i].path[0]   : "-"
+            ,entries[i].serial[0] ? &entries[i].serial[0] : "-"
+            ,entries[i].loc.bus, entries[i].loc.address, &entries[i].loc.path[0]);
+    }
+
+    if (fclose(fp) != 0 || rename(&tmpfn[0], &fn[0]) != 0) {
+        remove(&tmpfn[0]);
+        return 0;
+    }
+
+    return 1;
+}
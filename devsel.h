@@ -0,0 +1,57 @@
+/* vim:set ts=4 sw=4 tw=80 et cindent ai si cino=(0,ml,\:0:
+ * ( settings from: http://datapax.com.au/code_conventions/ )
+ */
+
+/**********************************************************************
+    RatSlap
+    Copyright (C) 2016-2020 Todd Harbour
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    version 2 ONLY, as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program, in the file COPYING or COPYING.txt; if
+    not, see http://www.gnu.org/licenses/ , or write to:
+      The Free Software Foundation, Inc.,
+      51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ **********************************************************************/
+
+#ifndef   DEVSEL_H
+#define   DEVSEL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Devices are identified by their sysfs name, ie. bus number followed by the
+// port path, eg. "2-1.4" is port 4 of the hub on port 1 of bus 2.
+#define DEVSEL_PATH_LEN    32
+#define DEVSEL_SERIAL_LEN 128
+#define DEVSEL_PORTS_MAX    7 // USB limits tiers to 7 (inc. root hub port)
+
+// Device selectors (--device / --serial), empty for "any"
+typedef struct s_devsel {
+    char path[DEVSEL_PATH_LEN];
+    char serial[DEVSEL_SERIAL_LEN];
+} t_devsel;
+
+// A resolved device location
+typedef struct s_devloc {
+    int  bus;
+    int  address;
+    char path[DEVSEL_PATH_LEN];
+} t_devloc;
+
+int devsel_parse_path(t_devsel *sel, const char *arg);
+int devsel_path(char *out, const size_t outlen, const uint8_t bus, const uint8_t *ports, const int nports);
+int devsel_serial(const char *path, char *out, const size_t outlen);
+int devsel_sysfs_find(const t_devsel *sel, const uint16_t vendor_id, const uint16_t product_id, t_devloc *loc);
+int devsel_cache_lookup(const t_devsel *sel, const uint16_t vendor_id, const uint16_t product_id, t_devloc *loc);
+int devsel_cache_store(const t_devsel *sel, const uint16_t vendor_id, const uint16_t product_id, const t_devloc *loc);
+
+#endif /* DEVSEL_H */
@@ -0,0 +1,270 @@
+/* vim:set ts=4 sw=4 tw=80 et cindent ai si cino=(0,ml,\:0:
+ * ( settings from: http://datapax.com.au/code_conventions/ )
+ */
+
+/**********************************************************************
+    RatSlap
+    Copyright (C) 2016-2020 Todd Harbour
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    version 2 ONLY, as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program, in the file COPYING or COPYING.txt; if
+    not, see http://www.gnu.org/licenses/ , or write to:
+      The Free Software Foundation, Inc.,
+      51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ **********************************************************************/
+
+/*
+ * Fuzz target and throughput benchmark for the key binding parser
+ * (set_mode_button).
+ *
+ * Every binding the parser accepts is rendered the way mode_print displays it,
+ * then parsed again; the resulting button data must be identical.
+ *
+ * Standalone (generated bindings):
+ *     make fuzz
+ *     ./ratslap-fuzz -n 5000000 -s 1234
+ *
+ * Coverage guided (libFuzzer):
+ *     make ratslap-fuzz CC=clang LINK="clang -o" \
+ *         OPT_FLAGS="-O1 -g -fsanitize=fuzzer,address" BUILDOPTS=-DFUZZ_LIBFUZZER
+ *     ./ratslap-fuzz corpus/
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "app.h"
+#include "lang.h"
+#include "log.h"
+#include "mode.h"
+#include "model.h"
+
+// Button the bindings are assigned to (G4, the first without a fixed default)
+#define FUZZ_BUTTON                 4
+
+// Generated bindings are parsed in batches so generation isn't timed
+#define FUZZ_BATCH                  4096
+#define FUZZ_MAXLEN                 96
+
+unsigned long _accepted   = 0;
+unsigned long _rejected   = 0;
+unsigned long _mismatched = 0;
+int _quiet = 0;
+
+
+
+static int binding_check(const char *keys);
+#ifndef FUZZ_LIBFUZZER
+static size_t binding_generate(char *out, const size_t outlen, unsigned int *seed);
+#endif
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+
+
+// Returns 0 if keys was accepted but didn't survive the round trip
+static int binding_check(const char *keys) {
+    unsigned char mode_data[MODE_DATA_LEN];
+    unsigned char mode_back[MODE_DATA_LEN];
+    const unsigned char *but = &mode_data[_model->off_buttons[FUZZ_BUTTON]];
+    const unsigned char *bak = &mode_back[_model->off_buttons[FUZZ_BUTTON]];
+    char shown[128];
+    char again[128];
+    char *pi, *po;
+
+    memset(&mode_data[0], 0, sizeof(mode_data));
+    memset(&mode_back[0], 0, sizeof(mode_back));
+
+    if (!set_mode_button(&mode_data[0], FUZZ_BUTTON, keys)) {
+        ++_rejected;
+        return 1;
+    }
+
+    ++_accepted;
+
+    // mode_print pads the '+' between names with spaces ("LeftCtrl + C"),
+    // which aren't valid in a binding
+    mode_button_str(&shown[0], sizeof(shown), but);
+    for (pi = &shown[0], po = &again[0]; *pi; ++pi) {
+        if (*pi != ' ') *po++ = *pi;
+    }
+    *po = '\0';
+
+    // An unassigned button displays as nothing at all
+    if (!again[0]) strcpy(&again[0], s_buttons[0]);
+
+    if (!set_mode_button(&mode_back[0], FUZZ_BUTTON, &again[0])
+    || memcmp(&mode_data[0], &mode_back[0], sizeof(mode_data)) != 0) {
+        ++_mismatched;
+        if (!_quiet) fprintf(stderr, "MISMATCH: \"%s\" -> %.2x%.2x%.2x -> \"%s\" -> %.2x%.2x%.2x\n"
+            , keys, but[0], but[1], but[2], shown, bak[0], bak[1], bak[2]);
+        return 0;
+    }
+
+    return 1;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    char keys[256];
+
+    _mode_verbose = 0;
+
+    if (size >= sizeof(keys)) size = sizeof(keys) - 1;
+    memcpy(&keys[0], data, size);
+    keys[size] = '\0';
+
+    if (!binding_check(&keys[0])) abort();
+
+    return 0;
+}
+
+#ifndef FUZZ_LIBFUZZER
+
+// Builds a binding from real modifier/button/key names (so a useful proportion
+// are accepted), mutated with case changes, junk names, and stray '+'s
+static size_t binding_generate(char *out, const size_t outlen, unsigned int *seed) {
+    const char junk[] = "+-=_.,;:'\"!@#$%^&*()[]{}<>|\\/ ?`~0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    size_t o = 0;
+    int tokens = 1 + rand_r(seed) % 4;
+    int t;
+
+    out[0] = '\0';
+
+    // Empty binding
+    if (rand_r(seed) % 256 == 0) return 0;
+
+    // Stray leading '+'
+    if (rand_r(seed) % 32 == 0) out[o++] = '+';
+
+    for (t = 0; t < tokens && o < outlen - 1; ++t) {
+        const char *name;
+        char word[64];
+        int r = rand_r(seed) % 100;
+        size_t i;
+
+        if (t < tokens - 1 && r < 80) {
+            // Modifier (before the last token)
+            name = s_keys[0xe0 + rand_r(seed) % 8];
+        } else if (r < 25) {
+            name = s_keys[0xe0 + rand_r(seed) % 8];
+        } else if (r < 50) {
+            name = s_buttons[rand_r(seed) % 16];
+        } else if (r < 95) {
+            name = s_keys[rand_r(seed) % 0xff];
+        } else {
+            // Junk
+            size_t len = 1 + rand_r(seed) % (sizeof(word) - 1);
+            for (i = 0; i < len; ++i) word[i] = junk[rand_r(seed) % (sizeof(junk) - 1)];
+            word[len] = '\0';
+            name = &word[0];
+        }
+
+        if (name != &word[0]) {
+            snprintf(&word[0], sizeof(word), "%s", name);
+        }
+
+        // Case mangling (names are case insensitive)
+        if (rand_r(seed) % 8 == 0) {
+            for (i = 0; word[i]; ++i) {
+                if (isalpha((unsigned char)word[i]) && rand_r(seed) % 2) word[i] ^= 0x20;
+            }
+        }
+
+        // Truncation/corruption of a real name
+        if (rand_r(seed) % 32 == 0 && word[0]) {
+            word[rand_r(seed) % strlen(word)] = junk[rand_r(seed) % (sizeof(junk) - 1)];
+        }
+
+        o += snprintf(&out[o], outlen - o, "%s%s", t ? "+" : "", word);
+    }
+
+    // Stray trailing '+' (modifier only, or "Num+" style key)
+    if (o < outlen - 1 && rand_r(seed) % 16 == 0) {
+        out[o++] = '+';
+        out[o  ] = '\0';
+    }
+
+    return o < outlen ? o : outlen - 1;
+}
+
+static void help_usage(void) {
+    printf("\
+\n\
+%s: %s-fuzz [-n <count>] [-s <seed>] [-q]\n\
+\n\
+-n <count> - %s (%d)\n\
+-s <seed>  - %s\n\
+-q         - %s\n\
+\n\
+",
+     _("Usage"), BIN_NAME
+    ,_("Number of bindings to generate"), 1000000
+    ,_("Random seed (default: time based)")
+    ,_("Don't report individual mismatches")
+    );
+}
+
+int main(int argc, char *argv[]) {
+    static char batch[FUZZ_BATCH][FUZZ_MAXLEN];
+    unsigned long count = 1000000;
+    unsigned long done  = 0;
+    unsigned int seed = (unsigned int)time(NULL) ^ (unsigned int)getpid();
+    unsigned int seed_start;
+    struct timespec t0, t1;
+    double elapsed = 0;
+    int c;
+
+    while ((c = getopt(argc, argv, "hn:s:q")) != -1) {
+        switch (c) {
+            case 'n': count = strtoul(optarg, NULL, 0); break;
+            case 's': seed  = strtoul(optarg, NULL, 0); break;
+            case 'q': _quiet = 1; break;
+            case 'h':
+            default:
+                help_usage();
+                return c == 'h' ? 0 : 1;
+        }
+    }
+
+    seed_start = seed;
+
+    // Parser chatter ("Setting button ...") would dominate the timing
+    _mode_verbose = 0;
+
+    while (done < count) {
+        unsigned long n = count - done < FUZZ_BATCH ? count - done : FUZZ_BATCH;
+        unsigned long i;
+
+        for (i = 0; i < n; ++i) binding_generate(&batch[i][0], FUZZ_MAXLEN, &seed);
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (i = 0; i < n; ++i) binding_check(&batch[i][0]);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+
+        elapsed += (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+        done += n;
+    }
+
+    printf("Seed:       %u\n", seed_start);
+    printf("Bindings:   %lu (accepted: %lu, rejected: %lu)\n", done, _accepted, _rejected);
+    printf("Mismatched: %lu\n", _mismatched);
+    printf("Time:       %.3fs\n", elapsed);
+    printf("Rate:       %.0f bindings/s\n", elapsed > 0 ? done / elapsed : 0);
+
+    return _mismatched ? 1 : 0;
+}
+
+#endif /* FUZZ_LIBFUZZER */
@@ -32,7 +32,6 @@
 #define max_src_len "16"
 
 FILE *_logfile = NULL;
-struct tm _timey;
 
 /*
 LOG LINE FORMAT:
@@ -53,10 +52,14 @@ int log_end(void) {
     return 0;
 }
 
+// Called from several threads at once (ratslap-compile's workers, the daemon's
+// remap reader and macro player), so all formatting is on the stack and each
+// message's lines go out together
 void std_output(FILE *strm, const char *srcfile, const int line
 , const char *func, const char *head, const char *text, ...) {
-    static char _logout[4096];
-    static char _logtime[32];
+    char logout[4096];
+    char logtime[32];
+    struct tm timey;
 
     char *st; // start of string
     char *nl; // new line ptr
@@ -66,28 +69,32 @@ void std_output(FILE *strm, const char *srcfile, const int line
     if (!strm) return;
 
     t = time(NULL);
-    localtime_r(&t, &_timey);
-    if (strftime(_logtime, sizeof(_logtime), "%0Y%0m%0dT%0H%0M%0S%z", &_timey) == 0) {
-        //                     "20140815T231613+1000"
-        snprintf(_logtime, 32, "===== UNKNOWN  =====");
+    localtime_r(&t, &timey);
+    if (strftime(logtime, sizeof(logtime), "%0Y%0m%0dT%0H%0M%0S%z", &timey) == 0) {
+        //                    "20140815T231613+1000"
+        snprintf(logtime, 32, "===== UNKNOWN  =====");
     }
 
     va_start(ap, text);
-        vsprintf(_logout, text, ap);
+        vsnprintf(logout, sizeof(logout), text, ap);
     va_end(ap);
 
-    st = _logout;
-    nl = strchr(_logout, '\n');
+    flockfile(strm);
+
+    st = logout;
+    nl = strchr(logout, '\n');
     while(nl) {
         *nl = '\0';
-        fprintf(strm, "%s %s %"max_src_len"s:%05d:%-15s %s\n", _logtime, head
+        fprintf(strm, "%s %s %"max_src_len"s:%05d:%-15s %s\n", logtime, head
             , srcfile, line, func, st);
         st = nl + 1;
         nl = strchr(st, '\n');
     }
 
     if(*st) {
-        fprintf(strm, "%s %s %"max_src_len"s:%05d:%-15s %s",   _logtime, head
+        fprintf(strm, "%s %s %"max_src_len"s:%05d:%-15s %s",   logtime, head
             , srcfile, line, func, st);
     }
+
+    funlockfile(strm);
 }
@@ -24,9 +24,16 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <unistd.h>
 #include <getopt.h>
 #include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+#include <sys/inotify.h>
 #include <libusb-1.0/libusb.h>
 #include <linux/hid.h>
 
@@ -34,9 +41,20 @@
 #include "lang.h"
 #include "git.h"
 #include "log.h"
-
-#define LOGITECH_G300S_VENDOR_ID   0x046d
-#define LOGITECH_G300S_PRODUCT_ID  0xc246
+#include "mode.h"
+#include "model.h"
+#include "profile.h"
+#include "store.h"
+#include "devsel.h"
+#include "devlock.h"
+#include "metrics.h"
+#include "status.h"
+#include "daemon.h"
+#include "remap.h"
+#include "probe.h"
+#include "probes.h"
+#include "plan.h"
+#include "replay.h"
 
 // QB#111 - Older version (eg 1.0.14) didn't support libusb_strerror
 #ifndef libusb_strerror
@@ -49,350 +67,69 @@ typedef enum e_exit {
     ,exit_param   = 63
     ,exit_usberr
     ,exit_modesel
+    ,exit_profile
+    ,exit_daemon
+    ,exit_deadline             // Ran out of time (--deadline) opening the mouse
+    ,exit_deadline_change_mode // ... selecting a mode
+    ,exit_deadline_mode_load   // ... reading a mode
+    ,exit_deadline_mode_save   // ... saving a mode
+    ,exit_deadline_editmode    // ... entering edit mode (all as per t_cmd)
+    ,exit_replay               // Replayed session didn't go as recorded
+    ,exit_busy                 // Another process had the mouse for too long
 } t_exit;
 
-typedef enum e_mode {
-     mode_f3 = 0
-    ,mode_f4
-    ,mode_f5
-    ,mode_COUNT
-} t_mode;
-
-const char *s_mode[] = {
-     "F3"
-    ,"F4"
-    ,"F5"
+// Control transfer command types, each with their own transfer policy
+typedef enum e_cmd {
+     cmd_change_mode = 0
+    ,cmd_mode_load
+    ,cmd_mode_save
+    ,cmd_editmode
+    ,cmd_COUNT
+} t_cmd;
+
+const char *s_cmd[] = {
+     "change_mode"
+    ,"mode_load"
+    ,"mode_save"
+    ,"editmode"
     ,"INVALID"
 };
 
-typedef enum e_colour {
-     colour_black = 0
-    ,colour_red
-    ,colour_green
-    ,colour_yellow
-    ,colour_blue
-    ,colour_magenta
-    ,colour_cyan
-    ,colour_white
-    ,colour_COUNT
-} t_colour;
-
-const char *s_colour[] = {
-     "black"
-    ,"red"
-    ,"green"
-    ,"yellow"
-    ,"blue"
-    ,"magenta"
-    ,"cyan"
-    ,"white"
-    ,"INVALID"
+typedef struct s_xfer_policy {
+    unsigned int timeout; // Per attempt (ms)
+    int          retries; // Attempts after the first
+    unsigned int backoff; // Base delay before first retry (ms), doubled after
+                          // each retry with up to the same again in jitter
+} t_xfer_policy;
+
+// Errors that are usually transient (busy hub, stalled pipe) get retried,
+// anything else (eg. device gone) fails straight away
+const t_xfer_policy xfer_policy[] = {
+     {  500, 3,  20 } // cmd_change_mode
+    ,{ 1000, 3,  20 } // cmd_mode_load
+    ,{ 2000, 2, 100 } // cmd_mode_save
+    ,{  500, 3,  20 } // cmd_editmode
 };
 
-// F5040302 84060844 01000002 00000300 00040000 05000006 00000700 00080000 090000
-// ^                 ^     ^      ^      ^      ^      ^      ^      ^      ^
-// 0                 8    11     14     17     20     23     26     29     32
-const unsigned char offsets_buttons[] = {
-      0
-    , 8
-    ,11
-    ,14
-    ,17
-    ,20
-    ,23
-    ,26
-    ,29
-    ,32
-};
+// A control transfer's round trip, when a dry run hasn't timed any (us)
+#define DRY_RUN_XFER_US 2000
 
-const char *s_buttons[] = {
-     "NONE"
-    ,"Button1"
-    ,"Button2"
-    ,"Button3"
-    ,"Button6"
-    ,"Button7"
-    ,"Button8"
-    ,"Button9"
-    ,"Button10"
-    ,"Button11"
-    ,"DPIUp"
-    ,"DPIDown"
-    ,"DPICycle"
-    ,"ModeSwitch"
-    ,"DPIShift"
-    ,"DPIDefault"
-};
+// How long the daemon gathers edits to a watched profile before saving them,
+// unless --debounce says otherwise
+#define DEBOUNCE_DEFAULT_MS 100
 
-// Turns out these are likely HID standard codes!
-// ( https://www.usb.org/sites/default/files/documents/hut1_12v2.pdf )
-const char *s_keys[] = {
-     "NONE"
-    ,"UNKNOWN:01" // 01 ==   1 // "HID: Keyboard Err: Rollover - not a key
-    ,"UNKNOWN:02" // 02 ==   2 // "HID: Keyboard Err: POST Fail - not a key
-    ,"UNKNOWN:03" // 03 ==   3 // "HID: Keyboard Err: Undefined - not a key
-    ,"A"          // 04 ==   4
-    ,"B"
-    ,"C"
-    ,"D"
-    ,"E"
-    ,"F"
-    ,"G"
-    ,"H"
-    ,"I"
-    ,"J"
-    ,"K"
-    ,"L"
-    ,"M"
-    ,"N"
-    ,"O"
-    ,"P"
-    ,"Q"
-    ,"R"
-    ,"S"
-    ,"T"
-    ,"U"
-    ,"V"
-    ,"W"
-    ,"X"
-    ,"Y"
-    ,"Z"          // 1D ==  29
-    ,"1"          // 1E ==  30
-    ,"2"
-    ,"3"
-    ,"4"
-    ,"5"
-    ,"6"
-    ,"7"
-    ,"8"
-    ,"9"
-    ,"0"           // 27 ==  39
-    ,"Enter"       // 28 ==  40
-    ,"Escape"      // 29 ==  41
-    ,"Backspace"   // 2a ==  42
-    ,"Tab"         // 2b ==  43
-    ,"Space"       // 2c ==  44
-    ,"-"           // 2d ==  45
-    ,"="           // 2e ==  46
-    ,"["           // 2f ==  47
-    ,"]"           // 30 ==  48
-    ,"\\"          // 31 ==  49
-    ,"NonUS#"      // 32 ==  50
-    ,";"           // 33 ==  51
-    ,"'"           // 34 ==  52
-    ,"`"           // 35 ==  53
-    ,","           // 36 ==  54
-    ,"."           // 37 ==  55
-    ,"/"           // 38 ==  56
-    ,"CapsLock"    // 39 ==  57
-    ,"F1"          // 3a ==  58
-    ,"F2"          // 3b ==  59
-    ,"F3"          // 3c ==  60
-    ,"F4"          // 3d ==  61
-    ,"F5"          // 3e ==  62
-    ,"F6"          // 3f ==  63
-    ,"F7"          // 40 ==  64
-    ,"F8"          // 41 ==  65
-    ,"F9"          // 42 ==  66
-    ,"F10"         // 43 ==  67
-    ,"F11"         // 44 ==  68
-    ,"F12"         // 45 ==  69
-    ,"PrintScreen" // 46 ==  70
-    ,"ScrollLock"  // 47 ==  71
-    ,"Pause"       // 48 ==  72
-    ,"Insert"      // 49 ==  73
-    ,"Home"        // 4a ==  74
-    ,"PageUp"      // 4b ==  75
-    ,"Delete"      // 4c ==  76
-    ,"End"         // 4d ==  77
-    ,"PageDown"    // 4e ==  78
-    ,"Right"       // 4f ==  79
-    ,"Left"        // 50 ==  80
-    ,"Down"        // 51 ==  81
-    ,"Up"          // 52 ==  82
-    ,"NumLock"     // 53 ==  83
-    ,"Num/"        // 54 ==  84
-    ,"Num*"        // 55 ==  85
-    ,"Num-"        // 56 ==  86
-    ,"Num+"        // 57 ==  87
-    ,"NumEnter"    // 58 ==  88
-    ,"Num1"        // 59 ==  89
-    ,"Num2"        // 5a ==  90
-    ,"Num3"        // 5b ==  91
-    ,"Num4"        // 5c ==  92
-    ,"Num5"        // 5d ==  93
-    ,"Num6"        // 5e ==  94
-    ,"Num7"        // 5f ==  95
-    ,"Num8"        // 60 ==  96
-    ,"Num9"        // 61 ==  97
-    ,"Num0"        // 62 ==  98
-    ,"Num."        // 63 ==  99
-    ,"NonUS\\"     // 64 == 100
-    ,"Application" // 65 == 101
-    ,"Power"       // 66 == 102
-    ,"Num="        // 67 == 103
-    ,"F13"         // 68 == 104
-    ,"F14"         // 69 == 105
-    ,"F15"         // 6a == 106
-    ,"F16"         // 6b == 107
-    ,"F17"         // 6c == 108
-    ,"F18"         // 6d == 109
-    ,"F19"         // 6e == 110
-    ,"F20"         // 6f == 111
-    ,"F21"         // 70 == 112
-    ,"F22"         // 71 == 113
-    ,"F23"         // 72 == 114
-    ,"F24"         // 73 == 115
-    ,"Execute"     // 74 == 116
-    ,"Help"        // 75 == 117
-    ,"Menu"        // 76 == 118
-    ,"Select"      // 77 == 119
-    ,"Stop"        // 78 == 120
-    ,"Again"       // 79 == 121
-    ,"Undo"        // 7a == 122
-    ,"Cut"         // 7b == 123
-    ,"Copy"        // 7c == 124
-    ,"Paste"       // 7d == 125
-    ,"Find"        // 7e == 126
-    ,"Mute"        // 7f == 127
-    ,"VolumeUp"    // 80 == 128
-    ,"VolumeDown"  // 81 == 129
-    ,"UNKNOWN:82"  // 82 == 130 // Locking CapsLock but legacy so not defining
-    ,"UNKNOWN:83"  // 83 == 131 // Locking CapsLock but legacy so not defining
-    ,"UNKNOWN:84"  // 84 == 132 // Locking CapsLock but legacy so not defining
-    ,"Num,"        // 85 == 133 // Brazillian keypad period (.)?
-    ,"AS400Num="   // 86 == 134 // Keypad Equal Sign on AS/400 keyboards
-    ,"UNKNOWN:87"  // 87 == 135 // International 1?
-    ,"UNKNOWN:88"  // 88 == 136 // International 2?
-    ,"UNKNOWN:89"  // 89 == 137 // International 3?
-    ,"UNKNOWN:8a"  // 8a == 138 // International 4?
-    ,"UNKNOWN:8b"  // 8b == 139 // International 5?
-    ,"UNKNOWN:8c"  // 8c == 140 // International 6?
-    ,"UNKNOWN:8d"  // 8d == 141 // International 7?
-    ,"UNKNOWN:8e"  // 8e == 142 // International 8?
-    ,"UNKNOWN:8f"  // 8f == 143 // International 9?
-    ,"UNKNOWN:90"  // 90 == 144 // LANG1 - Hangul/English toggle - Korean?
-    ,"UNKNOWN:91"  // 91 == 145 // LANG2 - Hanja conversion key - Korean?
-    ,"UNKNOWN:92"  // 92 == 146 // LANG3 - Katakana key - Japanese?
-    ,"UNKNOWN:93"  // 93 == 147 // LANG4 - Hiragana key - Japanese?
-    ,"UNKNOWN:94"  // 94 == 148 // LANG5 - Zenkaku/Hankaku key - Japanese?
-    ,"UNKNOWN:95"  // 95 == 149 // LANG6 - Reserved?
-    ,"UNKNOWN:96"  // 96 == 150 // LANG7 - Reserved?
-    ,"UNKNOWN:97"  // 97 == 151 // LANG8 - Reserved?
-    ,"UNKNOWN:98"  // 98 == 152 // LANG9 - Reserved?
-    ,"UNKNOWN:99"  // 99 == 153 // Alternate Erase (Erase-Eaze(tm))?
-    ,"SysReq"      // 9a == 154 // SysReq/Attention
-    ,"Cancel"      // 9b == 155
-    ,"Clear"       // 9c == 156
-    ,"Prior"       // 9d == 157
-    ,"Return"      // 9e == 158
-    ,"Separator"   // 9f == 159
-    ,"Out"         // a0 == 160
-    ,"Oper"        // a1 == 161
-    ,"ClearAgain"  // a2 == 162
-    ,"CrSelProps"  // a3 == 163
-    ,"ExSel"       // a4 == 164
-    ,"UNKNOWN:a5"  // a5 == 165 // Reserved
-    ,"UNKNOWN:a6"  // a6 == 166 // Reserved
-    ,"UNKNOWN:a7"  // a7 == 167 // Reserved
-    ,"UNKNOWN:a8"  // a8 == 168 // Reserved
-    ,"UNKNOWN:a9"  // a9 == 169 // Reserved
-    ,"UNKNOWN:aa"  // aa == 170 // Reserved
-    ,"UNKNOWN:ab"  // ab == 171 // Reserved
-    ,"UNKNOWN:ac"  // ac == 172 // Reserved
-    ,"UNKNOWN:ad"  // ad == 173 // Reserved
-    ,"UNKNOWN:ae"  // ae == 174 // Reserved
-    ,"UNKNOWN:af"  // af == 175 // Reserved
-    ,"Num00"       // b0 == 176
-    ,"Num000"      // b1 == 177
-    ,"Sep1000s"    // b2 == 178 // Thousands separator - locale specific?
-    ,"SepDec"      // b3 == 179 // Decimal   separator - locale specific?
-    ,"CurrUnit"    // b4 == 180 // Currency Unit       - locale specific?
-    ,"CurrSubUnit" // b5 == 181 // Currency Sub-Unit   - locale specific?
-    ,"Num("        // b6 == 182
-    ,"Num)"        // b7 == 183
-    ,"Num{"        // b8 == 184
-    ,"Num}"        // b9 == 185
-    ,"NumTab"      // ba == 186
-    ,"NumBackspace"// bb == 187
-    ,"NumA"        // bc == 188
-    ,"NumB"        // bd == 189
-    ,"NumC"        // be == 190
-    ,"NumD"        // bf == 191
-    ,"NumE"        // c0 == 192
-    ,"NumF"        // c1 == 193
-    ,"NumXOR"      // c2 == 194
-    ,"Num^"        // c3 == 195
-    ,"Num%"        // c4 == 196
-    ,"Num<"        // c5 == 197
-    ,"Num>"        // c6 == 198
-    ,"Num&"        // c7 == 199
-    ,"Num&&"       // c8 == 200
-    ,"Num|"        // c9 == 201
-    ,"Num||"       // ca == 202
-    ,"Num:"        // cb == 203
-    ,"Num#"        // cc == 204
-    ,"NumSpace"    // cd == 205
-    ,"Num@"        // ce == 206
-    ,"Num!"        // cf == 207
-    ,"NumMemStore" // d0 == 208
-    ,"NumMemRecall"// d1 == 209
-    ,"NumMemClear" // d2 == 210
-    ,"NumMemAdd"   // d3 == 211
-    ,"NumMemSub"   // d4 == 212
-    ,"NumMemMul"   // d5 == 213
-    ,"NumMemDiv"   // d6 == 214
-    ,"NumPlusMinus"// d7 == 215
-    ,"NumClear"    // d8 == 216
-    ,"NumClearEntry"// d9 == 217
-    ,"NumBinary"   // da == 218
-    ,"NumOctal"    // db == 219
-    ,"NumDecimal"  // dc == 220
-    ,"NumHex"      // dd == 221
-    ,"UNKNOWN:de"  // de == 222 // Reserved
-    ,"UNKNOWN:df"  // df == 223 // Reserved
-    ,"LeftCtrl"    // e0 == 224
-    ,"LeftShift"   // e1 == 225
-    ,"LeftAlt"     // e2 == 226
-    ,"Super_L"     // e3 == 227 // Left GUI
-    ,"RightCtrl"   // e4 == 228
-    ,"RightShift"  // e5 == 229
-    ,"RightAlt"    // e6 == 230
-    ,"Super_R"     // e7 == 231 // Right GUI
-    ,"UNKNOWN:e8"  // e8 == 232 // Reserved
-    ,"UNKNOWN:e9"  // e9 == 233 // Reserved
-    ,"UNKNOWN:ea"  // ea == 234 // Reserved
-    ,"UNKNOWN:eb"  // eb == 235 // Reserved
-    ,"UNKNOWN:ec"  // ec == 236 // Reserved
-    ,"UNKNOWN:ed"  // ed == 237 // Reserved
-    ,"UNKNOWN:ee"  // ee == 238 // Reserved
-    ,"UNKNOWN:ef"  // ef == 239 // Reserved
-    ,"UNKNOWN:f0"  // f0 == 240 // Reserved
-    ,"UNKNOWN:f1"  // f1 == 241 // Reserved
-    ,"UNKNOWN:f2"  // f2 == 242 // Reserved
-    ,"UNKNOWN:f3"  // f3 == 243 // Reserved
-    ,"UNKNOWN:f4"  // f4 == 244 // Reserved
-    ,"UNKNOWN:f5"  // f5 == 245 // Reserved
-    ,"UNKNOWN:f6"  // f6 == 246 // Reserved
-    ,"UNKNOWN:f7"  // f7 == 247 // Reserved
-    ,"UNKNOWN:f8"  // f8 == 248 // Reserved
-    ,"UNKNOWN:f9"  // f9 == 249 // Reserved
-    ,"UNKNOWN:fa"  // fa == 250 // Reserved
-    ,"UNKNOWN:fb"  // fb == 251 // Reserved
-    ,"UNKNOWN:fc"  // fc == 252 // Reserved
-    ,"UNKNOWN:fd"  // fd == 253 // Reserved
-    ,"UNKNOWN:fe"  // fe == 254 // Reserved
-                   // ff = 255  // Reserved (and even if it weren't, it's not
-                   //              used in the loops :P)
-};
+// How often the daemon rewrites the metrics file (--metrics)
+#define METRICS_INTERVAL_MS 10000
+
+// What a dry run (--dry-run) found the mouse would have been asked to do
+typedef struct s_dry_run {
+    unsigned int  saves;     // Modes written, each read back to verify
+    unsigned int  editmodes; // Edit mode entries
+    unsigned int  selects;   // Mode changes
+    unsigned int  xfers;     // Control transfers, all told
+    unsigned long sleep_us;  // Left for the mouse to settle after them
+} t_dry_run;
 
-const int report_rate[] = {
-     1000
-    , 125
-    , 250
-    , 500
-};
-const int n_report_rates = 4;
 
 
 
@@ -400,44 +137,191 @@ libusb_context                     *_usb_ctx        = NULL;
 libusb_device_handle               *_usb_dev_handle = NULL;
 libusb_device                      *_usb_device     = NULL;
 struct libusb_device_descriptor    _usb_desc;
+int _usb_dev_fd = -1; // Device node, when opened directly (mouse_open_cached)
+char _usb_dev_path[DEVSEL_PATH_LEN]; // Where the mouse was found, eg. "2-1.4"
 int _usb_interface_index = -1;
 int _mouse_primed = 0;
+t_mode _active_mode = mode_COUNT; // As selected or seen, mode_COUNT if unknown
+unsigned int _xfer_seed = 0;
+
+// Offline profile (--file), used in place of the mouse when set
+t_profile _profile;
+const char *_profile_path = NULL;
+int _profile_dirty = 0;
+
+// Device selection (--device / --serial)
+t_devsel _devsel;
+
+// When the whole command must be done by (--deadline), as per
+// metrics_now_us(), 0 for no deadline
+unsigned long _deadline = 0;
+
+// The step that ran out of time (t_cmd, cmd_COUNT for opening the mouse), -1
+// for none
+int _deadline_missed = -1;
+
+// When main() started, as per metrics_now_us()
+unsigned long _start_us = 0;
+
+// How long to wait for another process using the mouse (--wait)
+unsigned long _lock_wait_us = DEVLOCK_WAIT_MS * 1000UL;
+
+// Modes a read-only plan needs (0 if it writes anything). If another process
+// has the mouse and has already read them, they're taken from its status page
+// (_shared_status) rather than waiting.
+unsigned int _share_modes = 0;
+int _shared = 0;
+t_status _shared_status;
+
+// Run by udev for a newly plugged in device (--on-udev), at _udev_loc
+int _udev = 0;
+t_devloc _udev_loc;
+
+// Session recording to write (--record) or replay (--replay, --replay-timed)
+const char *_record_path = NULL;
+const char *_replay_path = NULL;
+int _replay_timed = 0;
+
+// Prometheus text file to write metrics to when done (--metrics), and every
+// METRICS_INTERVAL_MS while running as a daemon
+const char *_metrics_path = NULL;
+
+// What the command line asks for, run once it's all been parsed
+t_plan _plan;
+
+// Resident mode (--daemon), with button remaps (--remap)
+int _daemon = 0;
+t_remap_table _remap_table;
+
+// The mouse's modes as the daemon last read or saved them, and the input
+// endpoint it reads key presses from
+t_profile _daemon_modes;
+unsigned char _daemon_endpoint = 0;
+
+// Profile the daemon keeps the mouse in line with (--watch), reapplied
+// whenever it's saved. Text profiles apply on top of the modes the mouse had
+// when the daemon started (_watch_base).
+const char *_watch_path = NULL;
+t_profile _watch_base;
+
+// How long edits to the watched profile are gathered before saving them
+// (--debounce), 0 to save each straight away. _watch_pending is the latest
+// edit, still to be saved when _debounce_fd goes off.
+unsigned long _debounce_us = DEBOUNCE_DEFAULT_MS * 1000;
+t_profile _watch_pending;
+int _watch_pending_set = 0;
+int _debounce_fd = -1;
+
+// How often the daemon reads back a mode (--probe), 0 for never, and the
+// transfers a minute it can make doing so (--probe-budget)
+unsigned long _probe_interval_us = 0;
+unsigned int _probe_budget = PROBE_BUDGET_DEFAULT;
+
+// Profile store (--store), see store.h
+const char *_store_path = NULL;
+
+// Show what would change without changing it (--dry-run)
+int _dry_run = 0;
+t_dry_run _dry_run_est;
 
 
 
-static int dpi_point(int dpip);
 static void help_version(void);
 static void help_usage(void);
 static void keylist_print(void);
-static libusb_context *usb_init(void);
+static libusb_context *usb_init(const int discovery);
 static int usb_deinit(void);
-static libusb_device_handle *mouse_init(const uint16_t vendor_id, const uint16_t product_id, const char* product_name);
+static libusb_device_handle *mouse_open_cached(const t_devloc *loc);
+static libusb_device_handle *mouse_scan(t_devloc *loc);
+static libusb_device_handle *mouse_init(const t_devloc *cached);
 static int mouse_deinit(void);
 static void display_mouse_hid(const uint16_t vendor_id, const uint16_t product_id);
+static unsigned char mouse_hid_endpoint(const int iface);
+static int udev_device(t_devloc *loc);
 int mouse_hid_detach_kernel(int iface);
 int mouse_hid_attach_kernel(int iface);
+// Notes that a step (t_cmd, cmd_COUNT for opening the mouse) ran out of time
+static void deadline_miss(const int step) {
+    if (_deadline_missed >= 0) return;
+
+    _deadline_missed = step;
+    elog("ERROR: Deadline reached %s\n", step < cmd_COUNT ? s_cmd[step] : "opening mouse");
+}
+
+// Time left before the deadline (us), ULONG_MAX if there isn't one, or 0 (with
+// the step noted as having missed it) if it's passed
+static unsigned long deadline_left(const int step) {
+    unsigned long now;
+
+    if (!_deadline) return ULONG_MAX;
+    if (_deadline_missed >= 0) return 0;
+
+    now = metrics_now_us();
+    if (now < _deadline) return _deadline - now;
+
+    deadline_miss(step);
+    return 0;
+}
+
+// Waits for the mouse to settle, unless there's not enough time left for it to
+// (in which case there's no point starting). Returns 0 if there wasn't
+static int deadline_sleep(const int step, const unsigned long us) {
+    if (deadline_left(step) < us) {
+        deadline_miss(step);
+        return 0;
+    }
+
+    // A replayed mouse is always settled, unless we're reproducing timings
+    PROBE2(settle__entry, step, us);
+    if (!replay_active() || replay_timed()) usleep(us);
+    PROBE2(settle__return, step, us);
+
+    return 1;
+}
+
+// Whether there's a mouse to talk to (a replayed one has no handle)
+static int usb_handle_ok(const libusb_device_handle *usb_dev_handle) {
+    return usb_dev_handle || replay_active();
+}
+
+static int usb_xfer(libusb_device_handle *usb_dev_handle, const t_cmd cmd, const uint8_t request_type, const uint8_t request, const uint16_t value, unsigned char *data, const uint16_t len);
+static unsigned int usb_xfer_resets(void);
+static void usb_xfer_stats_print(void);
+static void status_print(void);
+static int model_send(libusb_device_handle *usb_dev_handle, const t_cmd cmd, const t_model_xfer *xfer);
 static t_mode change_mode(libusb_device_handle *usb_dev_handle, t_mode mode);
 static int mode_load(unsigned char *mode_data, libusb_device_handle *usb_dev_handle, t_mode mode);
 static int mode_save(unsigned char *mode_data, libusb_device_handle *usb_dev_handle, const t_mode mode);
-static int mode_print(unsigned char *mode_data, int len);
-static int set_mode_rate(unsigned char *mode_data, const int rate);
-static int set_mode_dpi(unsigned char *mode_data, const int idx, const int dpi);
-static int set_mode_defdpi(unsigned char *mode_data, const int idx);
-static int set_mode_enabledpishift(unsigned char *mode_data);
-static int set_mode_dpishift(unsigned char *mode_data, const int dpi);
-static int set_mode_nodpishift(unsigned char *mode_data);
-static unsigned char set_mode_colour(unsigned char *mode_data, const t_colour colour);
-static int set_mode_button(unsigned char *mode_data, const unsigned char button, const char *keys);
 static int mouse_editmode(void);
+static t_mode mouse_active(void);
+static void mouse_set_active(const t_mode mode);
+static int mouse_notified(const int fd, void *arg);
+static t_exit mouse_lock(void);
 int mouse_prime(void);
 int mouse_unprime(void);
+static int mouse_apply(const t_profile *want);
+static int mouse_reload_load(t_profile *want);
+static int mouse_reload_apply(const t_profile *want);
+static int mouse_reload(void);
+static int mouse_reload_queue(void);
+static int mouse_debounced(const int fd, void *arg);
+static int mouse_watch(const int fd, void *arg);
+static int mouse_watch_start(void);
+static int mouse_probe(const int fd, void *arg);
+static int mouse_probe_start(const t_profile *modes);
+static int mouse_metrics(const int fd, void *arg);
+static int mouse_metrics_start(void);
+static t_exit mouse_daemon(void);
+static int profile_in(t_profile *prof, const char *path);
+static int profile_out(const t_profile *prof, const char *path);
+static void mouse_record(unsigned char mode_data[][MODE_DATA_LEN], const unsigned int modes);
+static void dry_run_exec(unsigned char mode_data[][MODE_DATA_LEN], unsigned char mode_orig[][MODE_DATA_LEN], const unsigned int reads, const unsigned int changed, const t_plan_step *select);
+static void dry_run_print(void);
+static t_exit plan_exec(const t_plan *plan, const int first, const int last);
+static t_exit plan_run(const t_plan *plan);
 
 
 
-static int dpi_point(int dpip) {
-    return (!dpip) ? 4000 : dpip * 250;
-}
-
 static void help_version(void) {
     printf("%s v%s (BUILT: %s)\n", (APP_NAME), (APP_VERSION), (BUILD_DATE));
     printf("%s\n", (APP_COPYRIGHT));
@@ -453,7 +337,16 @@ static void help_usage(void) {
 %s: %s -h|--help\n\
        %s -V|--version\n\
        %s --listkeys\n\
-       %s [-s|--select <mode>] [-p|--print <mode>]\n\
+       %s --status\n\
+       %s [--device <device>] [--serial <serial>] [--metrics <file>]\n\
+       [--deadline <ms>] [--wait <ms>] [--daemon [--remap <remapfile>]\n\
+       [--watch <profile> [--debounce <ms>]]\n\
+       [--probe <ms> [--probe-budget <n>]]]\n\
+       [--dry-run] [--store <store> [--drift <profile>]]\n\
+       [--record <session> | --replay <session> [--replay-timed]]\n\
+       [-f|--file <profile>] [--snapshot <profile>] [--restore <profile>]\n\
+       [--on-udev <profile>]\n\
+       [-s|--select <mode>] [-p|--print <mode>]\n\
        [-m|--modify <mode>\n\
            [-r|--rate           <rate>]\n\
            [-A|--d1|--D1        <dpi>]\n\
@@ -478,12 +371,34 @@ static void help_usage(void) {
 -h|--h[elp]             - %s\n\
 -V|--v[ersion]          - %s %s %s\n\
 --li[stkeys]            - %s\n\
--s|--s[elect]           - %s\n\
+--sta[tus]              - %s\n\
+--dev[ice]              - %s\n\
+--ser[ial]              - %s\n\
+--me[trics]             - %s\n\
+--dea[dline]            - %s\n\
+--wai[t]                - %s\n\
+--rec[ord]              - %s\n\
+--replay                - %s\n\
+--replay-[timed]        - %s\n\
+--da[emon]              - %s\n\
+--rem[ap]               - %s\n\
+--wat[ch]               - %s\n\
+--deb[ounce]            - %s\n\
+--probe                 - %s\n\
+--probe-[budget]        - %s\n\
+--dry[-run]             - %s\n\
+--sto[re]               - %s\n\
+--dri[ft]               - %s\n\
+-f|--f[ile]             - %s\n\
+--sn[apshot]            - %s\n\
+--res[tore]             - %s\n\
+--on[-udev]             - %s\n\
+-s|--sel[ect]           - %s\n\
 -p|--p[rint]            - %s\n\
 -m|--mo[dify]           - %s\n\
 -r|--ra[te]             - %s\n\
 -A|--d1 ... -D|--d4     - %s\n\
--F|--de[fault-dpi]      - %s\n\
+-F|--def[ault-dpi]      - %s\n\
 -S|--dp[ishift]         - %s\n\
 -U|--n[o-dpishift]      - %s\n\
 -c|--c[olour]|--c[olor] - %s\n\
@@ -504,6 +419,14 @@ static void help_usage(void) {
 <colour>                - %s\n\
 <keys>                  - %s\n\
                           %s\n\
+<profile>               - %s\n\
+                          %s\n\
+<device>                - %s\n\
+<serial>                - %s\n\
+<remapfile>             - %s\n\
+<ms>                    - %s\n\
+<session>               - %s\n\
+<store>                 - %s\n\
 \n\
 %s: %s -p f3 -pF4 --selec F3 -m F4 -c bLuE -9LeftCtrl+V\n\
 ",
@@ -512,11 +435,34 @@ static void help_usage(void) {
     ,_("Usage"),    BIN_NAME /* -h|--h[elp] */
     ,               BIN_NAME /* -V|--v[ersion] */
     ,               BIN_NAME /* --listkeys */
+    ,               BIN_NAME /* --status */
     ,               BIN_NAME /* -s|--s[elect] ... */
 
     ,_("Displays this help")
     ,_("Displays"), APP_NAME, _("version")
     ,_("Lists all possible modifiers, buttons and keys for assignment")
+    ,_("Shows the mouse's last known state, without accessing it")
+    ,_("Uses the mouse plugged into <device>")
+    ,_("Uses the mouse with serial number <serial>")
+    ,_("Writes transfer metrics (Prometheus format) to <file> when done")
+    ,_("Gives up on anything not done within <ms> milliseconds")
+    ,_("Waits up to <ms> milliseconds for other processes using the mouse")
+    ,_("Records the USB transfers made, with timings, to <session>")
+    ,_("Replays the recorded <session> in place of the mouse")
+    ,_("Replays transfers taking as long as they did when recorded")
+    ,_("Stays running, passing the mouse's key presses on via uinput")
+    ,_("Sends the key combos in <remapfile> for remapped buttons (--daemon)")
+    ,_("Keeps the mouse as per <profile>, saving modes as it changes (--daemon)")
+    ,_("Gathers edits to <profile> for <ms> milliseconds before saving them")
+    ,_("Reads a mode back every <ms> milliseconds, reapplying it if changed (--daemon)")
+    ,_("Limits --probe to <n> transfers a minute")
+    ,_("Shows what would change, and how long it'd take, without writing")
+    ,_("Keeps profiles (@<name>) and each mouse's modes in <store>")
+    ,_("Lists mice (as last seen) whose modes differ from <profile>")
+    ,_("Uses <profile> instead of the mouse for print/modify options")
+    ,_("Saves all modes to <profile>")
+    ,_("Writes all modes in <profile> to the mouse")
+    ,_("As --restore, for the mouse udev has just added (RUN rule)")
     ,_("Switches to <mode>")
     ,_("Prints out <mode>'s button configuration")
     ,_("Sets current <mode> to be modified")
@@ -542,6 +488,14 @@ static void help_usage(void) {
     ,_("A valid colour:        black, red, green, yellow, blue, magenta, cyan, white")
     ,_("A valid combo of keys: Any button or key combo, eg. LeftCtrl+LeftAlt+PageUp")
     ,_("Run with --listkeys to see the complete list")
+    ,_("A profile file, as saved by --snapshot or ratslap-compile,")
+    ,_("or @<name> for one in the --store (which must come first)")
+    ,_("A USB port path:      bus:port[.port...], eg. 2:1.4")
+    ,_("The mouse's USB serial number")
+    ,_("Buttons and the key combos to send for them, per mode")
+    ,_("Time allowed for the whole command, in milliseconds")
+    ,_("A recorded session file")
+    ,_("A profile store file, created if necessary")
     ,_("Example"),  BIN_NAME
     );
 }
@@ -595,17 +549,33 @@ static void keylist_print(void) {
     }
 }
 
-static libusb_context *usb_init(void) {
+// When 'discovery' is 0, libusb (1.0.27+) skips enumerating every USB device
+// on the system. Devices can then only be opened directly (see
+// mouse_open_cached)
+static libusb_context *usb_init(const int discovery) {
     if (_usb_ctx) return _usb_ctx;
 
     // Initialise the USB context
+#if LIBUSB_API_VERSION >= 0x0100010A
+    if (!discovery) {
+        struct libusb_init_option opt = { .option = LIBUSB_OPTION_NO_DEVICE_DISCOVERY };
+
+        libusb_init_context(&_usb_ctx, &opt, 1);
+    } else {
+        libusb_init(&_usb_ctx);
+    }
+#else
     libusb_init(&_usb_ctx);
+#endif
 
     if (!_usb_ctx) {
         elog("ERROR: Failed to initialise USB interface\n");
         return NULL;
     }
 
+    // Seed transfer retry jitter
+    _xfer_seed = (unsigned int)time(NULL) ^ (unsigned int)getpid();
+
     // TODO: Determine if we need to set debug here
     
 #if LIBUSBX_API_VERSION < 0x01000106
@@ -625,30 +595,172 @@ static int usb_deinit(void) {
     return 1;
 }
 
-static libusb_device_handle *mouse_init(const uint16_t vendor_id, const uint16_t product_id, const char* product_name) {
+// Opens the device at a known (cached) location without scanning the bus
+static libusb_device_handle *mouse_open_cached(const t_devloc *loc) {
+    libusb_device_handle *handle = NULL;
+
+#if LIBUSB_API_VERSION >= 0x01000107
+    char devnode[64];
+    int fd;
+
+    snprintf(&devnode[0], sizeof(devnode), "/dev/bus/usb/%.3d/%.3d", loc->bus, loc->address);
+
+    fd = open(&devnode[0], O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        dlog(LOG_USB, "Failed to open %s: %s\n", &devnode[0], strerror(errno));
+        return NULL;
+    }
+
+    if (libusb_wrap_sys_device(_usb_ctx, (intptr_t)fd, &handle) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    // libusb doesn't take ownership, closed in mouse_deinit()
+    _usb_dev_fd = fd;
+#else
+    // No way to open a device node directly, so fall back to picking it out
+    // by address. This still saves opening every candidate device.
+    libusb_device **devs = NULL;
+    ssize_t ndevs, i;
+
+    ndevs = libusb_get_device_list(_usb_ctx, &devs);
+    for (i = 0; i < ndevs; ++i) {
+        if (libusb_get_bus_number(devs[i])     != loc->bus    ) continue;
+        if (libusb_get_device_address(devs[i]) != loc->address) continue;
+
+        if (libusb_open(devs[i], &handle) != 0) handle = NULL;
+        break;
+    }
+    if (ndevs >= 0) libusb_free_device_list(devs, 1);
+#endif
+
+    return handle;
+}
+
+// Finds the (selected) mouse amongst all USB devices, of any known model (which
+// becomes _model). If more than one matches, the first is used.
+static libusb_device_handle *mouse_scan(t_devloc *loc) {
+    libusb_device **devs = NULL;
+    libusb_device_handle *handle = NULL;
+    ssize_t ndevs, i;
+    int found = 0;
+
+    ndevs = libusb_get_device_list(_usb_ctx, &devs);
+    if (ndevs < 0) {
+        elog("ERROR: Failed to list USB devices: %s\n", libusb_strerror(ndevs));
+        return NULL;
+    }
+
+    for (i = 0; i < ndevs; ++i) {
+        struct libusb_device_descriptor desc;
+        const t_model *model;
+        unsigned char serial[DEVSEL_SERIAL_LEN];
+        uint8_t ports[DEVSEL_PORTS_MAX];
+        char path[DEVSEL_PATH_LEN];
+        libusb_device_handle *h = NULL;
+        int r;
+
+        if (libusb_get_device_descriptor(devs[i], &desc) != 0) continue;
+        if (!(model = model_find(desc.idVendor, desc.idProduct))) continue;
+
+        r = libusb_get_port_numbers(devs[i], &ports[0], DEVSEL_PORTS_MAX);
+        if (!devsel_path(&path[0], sizeof(path), libusb_get_bus_number(devs[i]), &ports[0], r)) continue;
+
+        if (_devsel.path[0] && strcmp(&path[0], &_devsel.path[0]) != 0) continue;
+
+        ++found;
+        if (handle) continue; // Just counting now
+
+        if ((r = libusb_open(devs[i], &h)) != 0) {
+            elog("WARNING: Failed to open device %s: %s\n", &path[0], libusb_strerror(r));
+            continue;
+        }
+
+        if (_devsel.serial[0]) {
+            if (!desc.iSerialNumber
+             || libusb_get_string_descriptor_ascii(h, desc.iSerialNumber, &serial[0], sizeof(serial)) < 0
+             || strcmp((char *)&serial[0], &_devsel.serial[0]) != 0) {
+                libusb_close(h);
+                --found;
+                continue;
+            }
+        }
+
+        handle = h;
+        _model = model;
+
+        loc->bus     = libusb_get_bus_number(devs[i]);
+        loc->address = libusb_get_device_address(devs[i]);
+        strcpy(&loc->path[0], &path[0]);
+
+        // Serials are unique, no need to look any further
+        if (_devsel.serial[0]) break;
+    }
+
+    libusb_free_device_list(devs, 1);
+
+    if (found > 1) {
+        printf("NOTE: %d matching devices, using %s (see --device and --serial)\n", found, &loc->path[0]);
+    }
+
+    return handle;
+}
+
+static libusb_device_handle *mouse_init(const t_devloc *cached) {
+    t_devloc loc;
+
     if (!_usb_ctx) return NULL;
 
     if (!_usb_dev_handle) {
-        // Look at the mouse based on vendor and usb_device id
-        // TODO: According to doco (
-        // http://libusb.sourceforge.net/api-1.0/group__dev.html#ga11ba48adb896b1492bbd3d0bf7e0f665
-        // ):
-        // > This function is intended for those scenarios where you are using
-        // > libusb to knock up a quick test application - it allows you to
-        // > avoid calling libusb_get_device_list() and worrying about
-        // > traversing/freeing the list.
-        //
-        // > This function has limitations and is hence not intended for use
-        // > in real applications: if multiple devices have the same IDs it
-        // > will only give you the first one, etc.
-
-        _usb_dev_handle = libusb_open_device_with_vid_pid(_usb_ctx, vendor_id, product_id);
-        if (!_usb_dev_handle) {
-            elog("Failed to find %s (%.4x:%.4x)\n", product_name, vendor_id, product_id);
+        memset(&loc, 0, sizeof(loc));
+
+        if (cached) {
+            _usb_dev_handle = mouse_open_cached(cached);
+            if (_usb_dev_handle) {
+                memcpy(&loc, cached, sizeof(loc));
+            } else {
+                dlog(LOG_USB, "Failed to open cached device %s, scanning\n", &cached->path[0]);
+
+                // Context may have been created without device discovery
+                usb_deinit();
+                if (!usb_init(1)) return NULL;
+            }
+        }
+
+        // udev told us where it is, if it's not there there's no point
+        // looking elsewhere
+        if (!_usb_dev_handle && _udev) {
+            elog("ERROR: Failed to open %s (%.4x:%.4x) on %s\n", _model->name, _model->vendor_id, _model->product_id, &cached->path[0]);
             return NULL;
         }
 
-        printf("Found %s (%.4x:%.4x) @ %p\n", product_name, vendor_id, product_id, _usb_dev_handle);
+        if (!_usb_dev_handle) {
+            _usb_dev_handle = mouse_scan(&loc);
+            if (!_usb_dev_handle) {
+                char names[256];
+                size_t o = 0;
+                int i;
+
+                names[0] = '\0';
+                for (i = 0; i < n_models && o < sizeof(names); ++i) {
+                    o += snprintf(&names[o], sizeof(names) - o, "%s%s (%.4x:%.4x)"
+                        ,i ? ", " : "", models[i].name, models[i].vendor_id, models[i].product_id);
+                }
+
+                elog("Failed to find %s%s%s%s%s\n", &names[0]
+                    ,_devsel.path[0]   ? " on "        : "", &_devsel.path[0]
+                    ,_devsel.serial[0] ? " with serial " : "", &_devsel.serial[0]);
+                return NULL;
+            }
+
+            // Remember where it is for next time
+            devsel_cache_store(&_devsel, _model->vendor_id, _model->product_id, &loc);
+        }
+
+        strcpy(&_usb_dev_path[0], &loc.path[0]);
+
+        printf("Found %s (%.4x:%.4x) on %s @ %p\n", _model->name, _model->vendor_id, _model->product_id, &loc.path[0], _usb_dev_handle);
     }
 
     if (!_usb_device) {
@@ -663,7 +775,7 @@ static libusb_device_handle *mouse_init(const uint16_t vendor_id, const uint16_t
     if (libusb_get_device_descriptor(_usb_device, &_usb_desc) != 0) {
         elog("WARNING: Failed to retrieve usb_device descriptor @ %p\n", _usb_dev_handle);
     } else {
-        dlog(LOG_USB, "USB Device (%.4x:%.4x @ %p) Descriptor:\n", vendor_id, product_id, _usb_dev_handle);
+        dlog(LOG_USB, "USB Device (%.4x:%.4x @ %p) Descriptor:\n", _model->vendor_id, _model->product_id, _usb_dev_handle);
         dlog(LOG_USB, "  bLength:            %d\n",     _usb_desc.bLength           );
         dlog(LOG_USB, "  bDescriptorType:    %d\n",     _usb_desc.bDescriptorType   );
         dlog(LOG_USB, "  bcdUSB:             0x%.4x\n", _usb_desc.bcdUSB            );
@@ -689,6 +801,9 @@ static int mouse_deinit(void) {
     _usb_dev_handle = NULL;
     _usb_device     = NULL;
 
+    if (_usb_dev_fd >= 0) close(_usb_dev_fd);
+    _usb_dev_fd = -1;
+
     return 1;
 }
 
@@ -745,12 +860,95 @@ static void display_mouse_hid(const uint16_t vendor_id, const uint16_t product_i
     }
 }
 
+// Finds the interrupt IN endpoint of the interface (where its input reports
+// come from). Returns 0 if there isn't one
+static unsigned char mouse_hid_endpoint(const int iface) {
+    struct libusb_config_descriptor *config = NULL;
+    unsigned char endpoint = 0;
+    int altsetting_index;
+    int endpoint_index;
+
+    if (!_usb_device || iface < 0) return 0;
+
+    if (libusb_get_active_config_descriptor(_usb_device, &config) != 0 || !config) return 0;
+
+    if (iface < config->bNumInterfaces) {
+        const struct libusb_interface *intf = &config->interface[iface];
+
+        for (altsetting_index = 0; !endpoint && altsetting_index < intf->num_altsetting; ++altsetting_index) {
+            const struct libusb_interface_descriptor *iface_desc = &intf->altsetting[altsetting_index];
+
+            for (endpoint_index = 0; endpoint_index < iface_desc->bNumEndpoints; ++endpoint_index) {
+                const struct libusb_endpoint_descriptor *ep = &iface_desc->endpoint[endpoint_index];
+
+                if ((ep->bmAttributes & LIBUSB_TRANSFER_TYPE_MASK) == LIBUSB_TRANSFER_TYPE_INTERRUPT
+                 && (ep->bEndpointAddress & LIBUSB_ENDPOINT_DIR_MASK) == LIBUSB_ENDPOINT_IN) {
+                    endpoint = ep->bEndpointAddress;
+                    break;
+                }
+            }
+        }
+    }
+
+    libusb_free_config_descriptor(config);
+
+    return endpoint;
+}
+
+// Where the device udev is running us for is, from udev's environment. Returns
+// 1 if it's a mouse we know (which becomes _model), 0 if it isn't (or it's not
+// being added), -1 if the environment isn't udev's
+static int udev_device(t_devloc *loc) {
+    const char *action  = getenv("ACTION");
+    const char *devname = getenv("DEVNAME");
+    const char *devpath = getenv("DEVPATH");
+    const char *product = getenv("PRODUCT");
+    const char *name;
+    const t_model *model;
+    unsigned int vendor_id, product_id;
+
+    if (!devpath || !product) return -1;
+
+    // Only when it's plugged in, not every time a driver binds
+    if (action && strcmp(action, "add") != 0) return 0;
+
+    // PRODUCT is "<vendor>/<product>/<bcdDevice>" (hex, no leading zeros)
+    if (sscanf(product, "%x/%x/", &vendor_id, &product_id) != 2) return -1;
+    if (!(model = model_find(vendor_id, product_id))) return 0;
+
+    memset(loc, 0, sizeof(*loc));
+
+    // DEVNAME is the device node, eg. /dev/bus/usb/002/005
+    if (!devname || sscanf(devname, "%*[^0-9]%d/%d", &loc->bus, &loc->address) != 2) {
+        const char *busnum = getenv("BUSNUM");
+        const char *devnum = getenv("DEVNUM");
+
+        if (!busnum || !devnum) return -1;
+        loc->bus     = atoi(busnum);
+        loc->address = atoi(devnum);
+    }
+
+    // DEVPATH ends with the sysfs name, eg. /devices/.../usb2/2-1/2-1.4
+    name = strrchr(devpath, '/');
+    name = name ? name + 1 : devpath;
+    if (strlen(name) >= sizeof(loc->path)) return -1;
+    strcpy(&loc->path[0], name);
+
+    _model = model;
+
+    return 1;
+}
+
 int mouse_hid_detach_kernel(int iface) {
     int ret = 0;
 
     if (!_usb_dev_handle || iface < 0) return -1;
 
+    METRIC_INC(_metrics.detach);
+
+    PROBE1(detach__entry, iface);
     ret = libusb_detach_kernel_driver(_usb_dev_handle, iface);
+    PROBE2(detach__return, iface, ret);
     if (ret != 0) {
         elog("ERROR: Failed to detach kernel driver: %s\n", libusb_strerror(ret));
         return ret;
@@ -777,12 +975,16 @@ int mouse_hid_attach_kernel(int iface) {
 
     if (!_usb_dev_handle || iface < 0) return -1;
 
+    METRIC_INC(_metrics.attach);
+
     ret = libusb_release_interface(_usb_dev_handle, iface);
     if (ret != 0) {
         elog("ERROR: Failed to release interface: %s\n", libusb_strerror(ret));
     }
 
+    PROBE1(attach__entry, iface);
     ret = libusb_attach_kernel_driver(_usb_dev_handle, iface);
+    PROBE2(attach__return, iface, ret);
     if (ret != 0) {
         elog("ERROR: Failed to attach kernel driver: %s\n", libusb_strerror(ret));
         return ret;
@@ -791,80 +993,250 @@ int mouse_hid_attach_kernel(int iface) {
     return 0;
 }
 
-static t_mode change_mode(libusb_device_handle *usb_dev_handle, t_mode mode) {
-    unsigned char payload[] = "\xf0\xff\x00\x00";
-
+static int usb_xfer(libusb_device_handle *usb_dev_handle, const t_cmd cmd, const uint8_t request_type, const uint8_t request, const uint16_t value, unsigned char *data, const uint16_t len) {
+    const t_xfer_policy *pol = &xfer_policy[cmd];
+    t_metrics_cmd       *st  = &_metrics.cmd[cmd];
+    unsigned long start = metrics_now_us();
+    unsigned long left;
+    unsigned int timeout;
+    unsigned int delay;
+    int attempt;
     int ret;
 
-    if (!_mouse_primed || !usb_dev_handle || mode >= mode_COUNT) return mode_COUNT;
+    if (!usb_handle_ok(usb_dev_handle) || cmd >= cmd_COUNT) return LIBUSB_ERROR_INVALID_PARAM;
 
-    if (mode == mode_f3) {
-        // Top Mode
-        // S Co:2:039:0 s 21 09 03f0 0001 0004 4 = f0800000
-        // NOTE: b0, c0, f0 also seem to work
-        payload[1] = '\x80';
+    for (attempt = 0; ; ++attempt) {
+        // What's left before the deadline is shared between the attempts we've
+        // still got (including the one after a reset)
+        timeout = pol->timeout;
+        left = deadline_left(cmd);
+        if (left != ULONG_MAX) {
+            const unsigned long share = left / (pol->retries + 2 - attempt);
 
-    } else
-    if (mode == mode_f4) {
-        // (Bottom) Right Mode
-        // S Co:2:039:0 s 21 09 03f0 0001 0004 4 = f0900000
-        // NOTE: d0 also seems to work
-        payload[1] = '\x90';
+            left = (share >= 1000 ? share : left) / 1000;
+            if (!left) {
+                deadline_miss(cmd);
+                ret = LIBUSB_ERROR_TIMEOUT;
+                break;
+            }
+            if (left < timeout) timeout = left;
+        }
 
-    } else
-    if (mode == mode_f5) {
-        // (Bottom) Left Mode
-        // S Co:2:039:0 s 21 09 03f0 0001 0004 4 = f0a00000
-        // NOTE: e0 also seems to work
-        payload[1] = '\xa0';
+        METRIC_INC(st->transfers);
 
-    } else {
-        return mode_COUNT;
+        PROBE4(xfer__entry, cmd, value, len, attempt);
+        ret = replay_xfer(
+             usb_dev_handle
+            ,request_type
+            ,request
+            ,value
+            ,_model->interface
+            ,data
+            ,len
+            ,timeout
+        );
+
+        PROBE4(xfer__return, cmd, value, len, ret);
+
+        dlog(LOG_USB, "%s 0x%.4x (attempt %d) --> %d\n", s_cmd[cmd], value, attempt + 1, ret);
+
+        if (ret >= 0) {
+            metrics_observe(&st->latency, metrics_now_us() - start);
+            return ret;
+        }
+
+        if (ret != LIBUSB_ERROR_TIMEOUT && ret != LIBUSB_ERROR_PIPE && ret != LIBUSB_ERROR_BUSY) break;
+
+        if (attempt < pol->retries) {
+            // Exponential backoff, with jitter so that we don't hit a busy hub
+            // in lock step with whatever else is hammering it
+            delay = pol->backoff << attempt;
+            delay += rand_r(&_xfer_seed) % (delay + 1);
+
+            elog("WARNING: %s transfer 0x%.4x failed (%s), retrying in %ums\n"
+                , s_cmd[cmd], value, libusb_strerror(ret), delay);
+
+            METRIC_INC(st->retries);
+            if (!deadline_sleep(cmd, delay * 1000UL)) break;
+            continue;
+        }
+
+        if (attempt == pol->retries) {
+            // Last resort, reset the device and have one more go
+            elog("WARNING: %s transfer 0x%.4x failed (%s), resetting device\n"
+                , s_cmd[cmd], value, libusb_strerror(ret));
+
+            METRIC_INC(st->resets);
+            if (replay_reset(usb_dev_handle) == 0) {
+                METRIC_INC(st->retries);
+                continue;
+            }
+
+            elog("ERROR: Failed to reset device\n");
+        }
+
+        break;
+    }
+
+    METRIC_INC(st->failures);
+    metrics_observe(&st->latency, metrics_now_us() - start);
+    elog("ERROR: %s transfer 0x%.4x failed: %s\n", s_cmd[cmd], value, libusb_strerror(ret));
+
+    return ret;
+}
+
+static unsigned int usb_xfer_resets(void) {
+    unsigned int resets = 0;
+    t_cmd cmd;
+
+    for (cmd = 0; cmd < cmd_COUNT; ++cmd) resets += METRIC_GET(_metrics.cmd[cmd].resets);
 
+    return resets;
+}
+
+static void usb_xfer_stats_print(void) {
+    unsigned long retries  = 0;
+    unsigned long failures = 0;
+    t_cmd cmd;
+
+    for (cmd = 0; cmd < cmd_COUNT; ++cmd) {
+        const t_metrics_cmd *st = &_metrics.cmd[cmd];
+
+        retries  += METRIC_GET(st->retries);
+        failures += METRIC_GET(st->failures);
+
+        dlog(LOG_USB, "%-12s transfers: %lu, retries: %lu, failures: %lu, resets: %lu, avg: %luus\n"
+            , s_cmd[cmd]
+            , METRIC_GET(st->transfers)
+            , METRIC_GET(st->retries)
+            , METRIC_GET(st->failures)
+            , METRIC_GET(st->resets)
+            , METRIC_GET(st->latency.count) ? METRIC_GET(st->latency.sum_us) / METRIC_GET(st->latency.count) : 0);
+    }
+
+    // Only worth mentioning if the run wasn't clean
+    if (!retries && !failures) return;
+
+    printf("Transfer retries:\n");
+    for (cmd = 0; cmd < cmd_COUNT; ++cmd) {
+        const t_metrics_cmd *st = &_metrics.cmd[cmd];
+
+        if (!METRIC_GET(st->retries) && !METRIC_GET(st->failures)) continue;
+
+        printf("  %-12s %lu retries, %lu failures, %lu resets (%lu transfers)\n"
+            , s_cmd[cmd]
+            , METRIC_GET(st->retries)
+            , METRIC_GET(st->failures)
+            , METRIC_GET(st->resets)
+            , METRIC_GET(st->transfers));
+    }
+}
+
+// Prints the published status page (no USB involved)
+static void status_print(void) {
+    const t_status *page = status_map(NULL);
+    t_status st;
+    char updated[64];
+    time_t secs;
+    t_mode m;
+
+    if (!page || !status_read(page, &st)) {
+        elog("ERROR: No status available (nothing has talked to the mouse yet?)\n");
+        return;
+    }
+
+    secs = st.updated / 1000000;
+    strftime(&updated[0], sizeof(updated), "%Y-%m-%d %H:%M:%S", localtime(&secs));
+
+    printf("Device:      %s\n", st.device[0] ? &st.device[0] : "unknown");
+    printf("Updated:     %s (pid %d)\n", &updated[0], st.pid);
+    printf("Active Mode: %s\n", st.active_mode < mode_COUNT ? s_mode[st.active_mode] : "unknown");
+
+    for (m = 0; m < mode_COUNT; ++m) {
+        if (!st.mode[m].valid) continue;
+
+        printf("Mode: %s\n", s_mode[m]);
+        mode_print(stdout, &st.mode[m].mode_data[0], MODE_DATA_LEN);
     }
+}
+
+// Sends one of the model's commands, then leaves the mouse to settle
+static int model_send(libusb_device_handle *usb_dev_handle, const t_cmd cmd, const t_model_xfer *xfer) {
+    unsigned char data[sizeof(xfer->data)];
+    int ret;
+
+    memcpy(&data[0], &xfer->data[0], xfer->len);
 
-    ret = libusb_control_transfer(
+    ret = usb_xfer(
          usb_dev_handle
+        ,cmd
         ,LIBUSB_REQUEST_TYPE_CLASS|LIBUSB_RECIPIENT_INTERFACE|LIBUSB_ENDPOINT_OUT
         ,HID_REQ_SET_REPORT
-        ,0x03f0
-        ,0x0001
-        ,payload
-        ,sizeof(payload) - 1
-        ,1000);
+        ,xfer->value
+        ,&data[0]
+        ,xfer->len
+    );
+    if (ret < 0) return ret;
+
+    if (xfer->settle && !deadline_sleep(cmd, xfer->settle)) return LIBUSB_ERROR_TIMEOUT;
+
+    return ret;
+}
+
+static t_mode change_mode(libusb_device_handle *usb_dev_handle, t_mode mode) {
+    if (!_mouse_primed || !usb_handle_ok(usb_dev_handle) || mode >= mode_COUNT) return mode_COUNT;
 
-    // This process takes time
-    usleep(10000);
+    if (model_send(usb_dev_handle, cmd_change_mode, &_model->select[mode]) != _model->select[mode].len) {
+        elog("ERROR: Failed to change mode to %s\n", s_mode[mode]);
+        return mode_COUNT;
+    }
 
-    dlog(LOG_USB, "  --> %d\n", ret);
+    _active_mode = mode;
+    status_set_active(mode);
+    remap_set_mode(mode);
 
     return mode;
 }
 
-// Expected length: 35
+// Expected length: as per the model (35 for the G300s)
 static int mode_load(unsigned char *mode_data, libusb_device_handle *usb_dev_handle, t_mode mode) {
-    const uint16_t exp_len = 35;
+    const uint16_t exp_len = _model->mode_len;
     uint16_t mi;
     int ret;
 
-    if (!_mouse_primed || !mode_data || !usb_dev_handle || mode >= mode_COUNT) return 0;
+    if (_profile_path) {
+        if (!mode_data || mode >= mode_COUNT) return 0;
+
+        if (!profile_get(&_profile, mode, mode_data)) {
+            elog("ERROR: Mode %s not in profile %s\n", s_mode[mode], _profile_path);
+            return 0;
+        }
+
+        return exp_len;
+    }
+
+    // As read by the process we're sharing with
+    if (_shared) {
+        if (!mode_data || mode >= mode_COUNT || !_shared_status.mode[mode].valid) return 0;
+
+        memcpy(mode_data, &_shared_status.mode[mode].mode_data[0], MODE_DATA_LEN);
+        return exp_len;
+    }
+
+    if (!_mouse_primed || !mode_data || !usb_handle_ok(usb_dev_handle) || mode >= mode_COUNT) return 0;
 
-    if      (mode == mode_f3) mi = 0xf3;
-    else if (mode == mode_f4) mi = 0xf4;
-    else if (mode == mode_f5) mi = 0xf5;
-    else return 0;
+    mi = _model->mode_id[mode];
 
-    ret = libusb_control_transfer(
+    ret = usb_xfer(
          usb_dev_handle
+        ,cmd_mode_load
         ,LIBUSB_REQUEST_TYPE_CLASS|LIBUSB_RECIPIENT_INTERFACE|LIBUSB_ENDPOINT_IN
         ,HID_REQ_GET_REPORT
-        ,0x0300|mi
-        ,0x0001
+        ,_model->mode_value[mode]
         ,mode_data
         ,exp_len
-        ,1000
     );
-    usleep(10000);
+    if (!deadline_sleep(cmd_mode_load, _model->settle_load)) ret = LIBUSB_ERROR_TIMEOUT;
 
     if (ret != exp_len) {
         elog("ERROR: Failed to retrieve current mapping for mode 0x%.2x\n", mi);
@@ -882,518 +1254,1224 @@ static int mode_load(unsigned char *mode_data, libusb_device_handle *usb_dev_han
     }
     dlog(LOG_PARSE, "Mode 0x%.2x: %s\n", mi, bitout);
 
+    status_set_mode(mode, mode_data);
+
     return exp_len;
 }
 
 static int mode_save(unsigned char *mode_data, libusb_device_handle *usb_dev_handle, const t_mode mode) {
-    const uint16_t exp_len = 35;
+    const uint16_t exp_len = _model->mode_len;
+    // A failed write or verify gets a second go before we give up
+    const int max_attempts = 2;
     uint16_t mi;
     int ret;
     int bit;
+    int attempt;
+    unsigned int resets;
     char bitout[255]
          ,*po = &bitout[0];
 
     unsigned char cmp[255];
 
-    if (!_mouse_primed || !mode_data || !usb_dev_handle || mode >= mode_COUNT) return 0;
-
-    if      (mode == mode_f3) mi = 0xf3;
-    else if (mode == mode_f4) mi = 0xf4;
-    else if (mode == mode_f5) mi = 0xf5;
-    else return 0;
-
-    ret = libusb_control_transfer(
-         usb_dev_handle
-        ,LIBUSB_REQUEST_TYPE_CLASS|LIBUSB_RECIPIENT_INTERFACE|LIBUSB_ENDPOINT_OUT
-        ,HID_REQ_SET_REPORT
-        ,0x0300|mi
-        ,0x0001
-        ,mode_data
-        ,exp_len
-        ,1000
-    );
-    usleep(500000); // Writes are SLOW
-
-    if (ret != exp_len) {
-        elog("ERROR: Failed to set current mapping for mode 0x%.2x\n", mi);
-        return 0;
-    }
-
-    po = &bitout[0];
-    for (bit = 0; bit < exp_len; ++bit) {
-        sprintf(po, "%.2x", (mode_data)[bit]);
-        po += strlen(po);
-        if ((bit+1) % 4 == 0) sprintf(po, " ");
-        po += strlen(po);
-    }
-    dlog(LOG_PARSE, "Mode 0x%.2x: %s\n", mi, bitout);
-
-    dlog(LOG_PARSE, "Comparing to stored:\n");
+    if (_profile_path) {
+        if (!profile_set(&_profile, mode, mode_data)) return 0;
 
-    ret = mode_load(&cmp[0], usb_dev_handle, mode);
-    if (ret != exp_len) {
-        elog("ERROR: Failed to retrieve mapping for mode 0x%.2x\n", mi);
-        return 0;
-    }
-
-    po = &bitout[0];
-    for (bit = 0; bit < exp_len; ++bit) {
-        sprintf(po, "%.2x", (cmp)[bit]);
-        po += strlen(po);
-        if ((bit+1) % 4 == 0) sprintf(po, " ");
-        po += strlen(po);
+        _profile_dirty = 1;
+        return exp_len;
     }
-    dlog(LOG_PARSE, "Mode 0x%.2x: %s\n", mi, bitout);
 
-    if (memcmp(mode_data, cmp, exp_len) != 0) {
-        elog("ERROR: Mapping retrieved not equal to mapping saved for mode 0x%.2x\n", mi);
-        return 0;
-    }
+    if (!_mouse_primed || !mode_data || !usb_handle_ok(usb_dev_handle) || mode >= mode_COUNT) return 0;
 
-    return exp_len;
-}
+    mi = _model->mode_id[mode];
 
-static int mode_print(unsigned char *mode_data, int len) {
-    unsigned char bit = 0;
-    unsigned char but[3] = {0,0,0};
-    int i = 0;
-    int x = 0;
+    for (attempt = 1; attempt <= max_attempts; ++attempt) {
+        if (attempt > 1) {
+            if (_deadline_missed >= 0) return 0;
 
-    char rawout[255]
-         ,*po = &rawout[0];
-    for (i = 0; i < len; ++i) {
-        sprintf(po, "%.2x", (mode_data)[i]);
-        po += strlen(po);
-        if ((i+1) % 4 == 0) sprintf(po, " ");
-        po += strlen(po);
-    }
-    dlog(LOG_PARSE, "RAW: %s\n", rawout);
+            elog("WARNING: Retrying save of mode 0x%.2x (attempt %d of %d)\n", mi, attempt, max_attempts);
 
-    i = 0;
+            // If the device was reset along the way, it's no longer in edit
+            // mode
+            if (usb_xfer_resets() != resets && !mouse_editmode()) return 0;
+        }
 
-    // F5040302 84060844 01000002 00000300 00040000 05000006 00000700 00080000 090000
-    // ^^
-    //printf("MODE: %s\n", s_mode[mode]);
-    ++i;
+        resets = usb_xfer_resets();
+
+        ret = usb_xfer(
+             usb_dev_handle
+            ,cmd_mode_save
+            ,LIBUSB_REQUEST_TYPE_CLASS|LIBUSB_RECIPIENT_INTERFACE|LIBUSB_ENDPOINT_OUT
+            ,HID_REQ_SET_REPORT
+            ,_model->mode_value[mode]
+            ,mode_data
+            ,exp_len
+        );
+        if (!deadline_sleep(cmd_mode_save, _model->settle_save)) return 0;
+
+        if (ret != exp_len) {
+            elog("ERROR: Failed to set current mapping for mode 0x%.2x\n", mi);
+            continue;
+        }
 
-    // F5040302 84060844 01000002 00000300 00040000 05000006 00000700 00080000 090000
-    //   ^^
-    printf("  Colour:              %s\n", s_colour[ (mode_data)[i++] ]);
+        po = &bitout[0];
+        for (bit = 0; bit < exp_len; ++bit) {
+            sprintf(po, "%.2x", (mode_data)[bit]);
+            po += strlen(po);
+            if ((bit+1) % 4 == 0) sprintf(po, " ");
+            po += strlen(po);
+        }
+        dlog(LOG_PARSE, "Mode 0x%.2x: %s\n", mi, bitout);
 
-    // F5040302 84060844 01000002 00000300 00040000 05000006 00000700 00080000 090000
-    //     ^^
-    bit = (mode_data)[i++];
-    printf("  Report Rate:         %4d\n",
-        bit < n_report_rates
-        ? report_rate[bit]
-        : -1
-    );
+        dlog(LOG_PARSE, "Comparing to stored:\n");
 
-    // F5040302 84060844 01000002 00000300 00040000 05000006 00000700 00080000 090000
-    //       ^^ ^^^^^^
-
-    for (x = 1; x <= 4; ++x) {
-        bit = (mode_data)[i++];
-        printf("  DPI #%d:        %s %4d\n",
-             x
-            ,bit & 0x80 ? "(DEF)" : "     "
-            ,dpi_point(bit & 0x0f)
-            );
-    }
-
-    // F5040302 84060844 01000002 00000300 00040000 05000006 00000700 00080000 090000
-    //                ^^
-
-    bit = (mode_data)[i++];
-    printf("  DPI Shift:           ");
-    printf("%d", dpi_point(bit & 0x0f));
-    if (bit & 0x40) printf(" [DISABLED]");
-    printf("\n");
-
-    // F5040302 84060844 01000002 00000300 00040000 05000006 00000700 00080000 090000
-    //                   ^^
-
-    for (x = 1; x <= 9; ++x) {
-        but[0] = (mode_data)[i++];
-        but[1] = (mode_data)[i++];
-        but[2] = (mode_data)[i++];
-
-        printf("  %s",
-            x == 1 ? "Left Click (But1):   " :
-            x == 2 ? "Right Click (But2):  " :
-            x == 3 ? "Middle Click (But3): " :
-            "G");
-        if (x > 3) printf("%d:                  ", x);
-
-        // Modifiers (but[1])
-        // 0xe0 - 0xe7 match modifiers 0x01, 0x02, 0x04 ... 0x80
-        {
-            unsigned char ky = 0xe0;
-            int m = 0x00;
-            for (m = 0x01; m <= 0x80; m *= 2) {
-                if (but[1] & m) printf("%s + ", s_keys[ky]);
-                ++ky;
-            }
+        ret = mode_load(&cmp[0], usb_dev_handle, mode);
+        if (ret != exp_len) {
+            elog("ERROR: Failed to retrieve mapping for mode 0x%.2x\n", mi);
+            continue;
         }
 
-        // Buttons   (but[0])
-        if (but[0] & 0x0f) {
-            printf("%s", s_buttons[but[0] & 0x0f]);
+        po = &bitout[0];
+        for (bit = 0; bit < exp_len; ++bit) {
+            sprintf(po, "%.2x", (cmp)[bit]);
+            po += strlen(po);
+            if ((bit+1) % 4 == 0) sprintf(po, " ");
+            po += strlen(po);
+        }
+        dlog(LOG_PARSE, "Mode 0x%.2x: %s\n", mi, bitout);
 
-            if (but[2] > 0) printf(" + ");
+        if (memcmp(mode_data, cmp, exp_len) != 0) {
+            METRIC_INC(_metrics.verify_mismatches);
+            elog("ERROR: Mapping retrieved not equal to mapping saved for mode 0x%.2x\n", mi);
+            continue;
         }
 
-        // Keys      (but[2])
-        if (but[2] > 0) printf("%s", s_keys[but[2]]);
-        printf("\n");
+        return exp_len;
     }
 
-    return 1;
+    return 0;
 }
 
-static int set_mode_rate(unsigned char *mode_data, const int rate) {
+static int mouse_editmode(void) {
     int i;
 
-    if (!mode_data || rate == 0) return 0;
+    // Profile files are always editable
+    if (_profile_path) return 1;
 
-    for (i = 0; i < n_report_rates; ++i) {
-        if (rate == report_rate[i]) {
-            // Valid rate
+    if (!_mouse_primed || !usb_handle_ok(_usb_dev_handle)) return 0;
 
-            printf("    Setting report rate: %d\n", report_rate[i]);
+    for (i = 0; i < _model->n_editmode; ++i) {
+        if (model_send(_usb_dev_handle, cmd_editmode, &_model->editmode[i]) < 0) return 0;
+    }
 
-            // F5040302 84060844 01000002 00000300 00040000 05000006 00000700 00080000 090000
-            //     ^^
-            (mode_data)[2] = i;
-            return rate;
-        }
+    return 1;
+}
+
+// Reads back which mode is active, with a single transfer (rather than reading
+// every mode). Returns mode_COUNT if it couldn't be
+static t_mode mouse_active(void) {
+    const t_model_xfer *sel = &_model->select[0];
+    unsigned char data[sizeof(sel->data)];
+    int ret;
+
+    if (!_mouse_primed || !usb_handle_ok(_usb_dev_handle)) return mode_COUNT;
+
+    // A read, as far as the transfer policy's concerned
+    ret = usb_xfer(
+         _usb_dev_handle
+        ,cmd_mode_load
+        ,LIBUSB_REQUEST_TYPE_CLASS|LIBUSB_RECIPIENT_INTERFACE|LIBUSB_ENDPOINT_IN
+        ,HID_REQ_GET_REPORT
+        ,sel->value
+        ,&data[0]
+        ,sel->len
+    );
+    if (ret != sel->len) return mode_COUNT;
+
+    return model_active(_model, &data[0], ret);
+}
+
+// Publishes a mode switched to on the mouse (status page and remaps)
+static void mouse_set_active(const t_mode mode) {
+    if (mode >= mode_COUNT || mode == _active_mode) return;
+
+    if (_active_mode < mode_COUNT) {
+        METRIC_INC(_metrics.mode_switches);
+        ilog("Mode switched to %s on the mouse\n", s_mode[mode]);
     }
 
+    _active_mode = mode;
+    status_set_active(mode);
+    remap_set_mode(mode);
+}
+
+// The mouse sent a report that isn't key presses (see remap_notify_fd()).
+// Whatever mode it says is active is published; if it doesn't say, the mouse
+// is asked (a mode switch is the only thing it's known to report).
+static int mouse_notified(const int fd, void *arg) {
+    uint64_t val;
+    t_mode m;
+
+    if (read(fd, &val, sizeof(val)) != sizeof(val)) return 0;
+
+    if ((m = remap_notified()) == mode_COUNT) m = mouse_active();
+
+    if (m == mode_COUNT) {
+        dlog(LOG_USB, "Report from the mouse, but no active mode read back\n");
+        return 0;
+    }
+
+    mouse_set_active(m);
+
     return 0;
 }
 
-static int set_mode_dpi(unsigned char *mode_data, const int idx, const int dpi) {
-    int dpi_val = dpi >= 4000 ? 0 : (dpi/250)&0xf;
-    int real_dpi = !dpi_val ? 4000 : dpi_val*250;
+// Waits for any other ratslap process using the mouse to finish, up to --wait
+// (and --deadline). A read-only plan can instead share what the other process
+// has already read (_shared).
+static t_exit mouse_lock(void) {
+    unsigned long wait = _lock_wait_us;
+    unsigned long waited = 0;
+    const t_status *page;
+    pid_t holder;
+    uid_t owner;
+    int daemon;
+    int r;
+
+    if (deadline_left(cmd_COUNT) < wait) wait = deadline_left(cmd_COUNT);
+
+    r = devlock_acquire(&_usb_dev_path[0], 0, &waited);
+    if (r != 0) return exit_none; // Locked (or can't be, so carry on as ever)
+
+    holder = devlock_holder(&_usb_dev_path[0], &daemon);
+
+    if (_share_modes && holder && (page = status_map(&owner))) {
+        int ok = status_read(page, &_shared_status);
+        t_mode m;
+
+        munmap((void *)page, sizeof(t_status));
+
+        // Anyone can create the page, only root's (or our own) is trusted
+        ok = ok && (owner == 0 || owner == geteuid())
+             && _shared_status.pid == holder
+             && strncmp(&_shared_status.device[0], &_usb_dev_path[0], sizeof(_shared_status.device)) == 0;
+        for (m = 0; ok && m < mode_COUNT; ++m) {
+            if ((_share_modes & (1 << m)) && !_shared_status.mode[m].valid) ok = 0;
+        }
+
+        if (ok) {
+            printf("Sharing %s with process %d\n", &_usb_dev_path[0], (int)holder);
+            _shared = 1;
+            return exit_none;
+        }
+    }
 
-    if (!mode_data || idx < 0 || idx > 3 || dpi < 250) return 0;
+    // A daemon keeps the mouse until it's stopped, waiting's pointless
+    if (daemon) {
+        elog("ERROR: %s is in use by the daemon (process %d), edit its --watch profile instead\n", &_usb_dev_path[0], (int)holder);
+        return exit_busy;
+    }
+
+    printf("Waiting for %s (in use by process %d)...\n", &_usb_dev_path[0], (int)holder);
+
+    r = devlock_acquire(&_usb_dev_path[0], wait, &waited);
+    metrics_observe(&_metrics.lock_wait, waited);
+
+    if (r == 0) {
+        if (wait < _lock_wait_us) deadline_miss(cmd_COUNT);
+        elog("ERROR: %s still in use after %lu.%.3lums\n", &_usb_dev_path[0], waited / 1000, waited % 1000);
+        return exit_busy;
+    }
 
-    printf("    Setting DPI #%d: %d\n", idx + 1, real_dpi);
+    printf("Waited %lu.%.3lums for %s\n", waited / 1000, waited % 1000, &_usb_dev_path[0]);
 
-    // F5040302 84060844 01000002 00000300 00040000 05000006 00000700 00080000 090000
-    //       ^^ ^^^^^^
-    (mode_data)[3+idx] = ((mode_data)[3+idx] & 0x80) | dpi_val;
-    return real_dpi;
+    return exit_none;
 }
 
-static int set_mode_defdpi(unsigned char *mode_data, const int idx) {
-    int i;
+int mouse_prime(void) {
+    t_exit ret;
+    t_devloc loc;
+    int cached = 0;
+    int m;
 
-    if (!mode_data || idx < 0 || idx > 3) return 0;
+    if (_mouse_primed) return exit_none;
 
-    printf("    Setting DPI #%d as default\n", idx + 1);
+    if (!deadline_left(cmd_COUNT)) return exit_deadline;
 
-    // F5040302 84060844 01000002 00000300 00040000 05000006 00000700 00080000 090000
-    //       ^^ ^^^^^^
-    for (i = 3; i <= 6; i++)
-        (mode_data)[i] &= 0x3f;
-    (mode_data)[3+idx] |= 0x80;
-    return 1;
+    // A recorded session stands in for the mouse
+    if (_replay_path) {
+        if (!replay_open(_replay_path, _replay_timed)) return exit_replay;
+
+        _mouse_primed = 1;
+        return exit_none;
+    }
+
+    if (_record_path && !replay_record_open(_record_path)) return exit_param;
+
+    // udev says where it is
+    if (_udev) {
+        loc    = _udev_loc;
+        cached = 1;
+    }
+
+    // If we know where the mouse is (whatever the model), skip scanning the
+    // whole bus
+    for (m = 0; m < n_models && !cached; ++m) {
+        cached = devsel_cache_lookup(&_devsel, models[m].vendor_id, models[m].product_id, &loc);
+        if (cached) _model = &models[m];
+    }
+
+    // Otherwise find it from sysfs, which (unlike libusb's discovery) opens
+    // nothing else. If it can't be opened, mouse_init() falls back to a scan.
+    for (m = 0; m < n_models && !cached; ++m) {
+        int found = devsel_sysfs_find(&_devsel, models[m].vendor_id, models[m].product_id, &loc);
+
+        if (found < 0) break;
+        if (found > 1) printf("NOTE: %d matching devices, using %s (see --device and --serial)\n", found, &loc.path[0]);
+
+        cached = (found > 0);
+        if (cached) _model = &models[m];
+    }
+
+    // Initialise USB
+    if (!usb_init(!cached)) return exit_usberr;
+
+    // Initialise mouse
+    if (!mouse_init(cached ? &loc : NULL)) {
+        // De-initialise USB
+        usb_deinit();
+
+        return exit_usberr;
+    }
+
+    // Not worth walking every descriptor just to log them when starting cold
+    if (!_udev) display_mouse_hid(_model->vendor_id, _model->product_id);
+
+    _usb_interface_index = _model->interface;
+    if (_usb_interface_index < 0) {
+        // De-initialise USB
+        usb_deinit();
+
+        return exit_usberr;
+    }
+
+    // Only one process at a time past here
+    if ((ret = mouse_lock()) != exit_none || _shared) {
+        mouse_deinit();
+        usb_deinit();
+
+        if (ret == exit_none) _mouse_primed = 1;
+        return ret;
+    }
+
+    printf("Detaching kernel driver...\n");
+    if (mouse_hid_detach_kernel(_usb_interface_index) != 0) {
+        devlock_release();
+
+        // De-initialise mouse
+        mouse_deinit();
+
+        // De-initialise USB
+        usb_deinit();
+
+        return exit_usberr;
+    }
+
+    _mouse_primed = 1;
+
+    _metrics.startup_us = metrics_now_us() - _start_us;
+    dlog(LOG_USB, "Mouse ready after %lu.%.3lums\n", _metrics.startup_us / 1000, _metrics.startup_us % 1000);
+    if (_udev) ilog("%s on %s ready after %lu.%.3lums\n", _model->name, &_usb_dev_path[0], _metrics.startup_us / 1000, _metrics.startup_us % 1000);
+
+    // Publish what we learn about the mouse (not fatal if we can't)
+    status_open(&_usb_dev_path[0]);
+
+    return exit_none;
 }
 
-static int set_mode_enabledpishift(unsigned char *mode_data) {
-    if (!mode_data) return 0;
+int mouse_unprime(void) {
+    t_exit ret = exit_none;
+
+    if (!_mouse_primed) return exit_none;
+
+    if (replay_active()) {
+        usb_xfer_stats_print();
+
+        if (replay_close() < 0) ret = exit_replay;
+
+        _mouse_primed = 0;
+
+        return ret;
+    }
+
+    // Never had it
+    if (_shared) {
+        _shared = 0;
+        _mouse_primed = 0;
+
+        return ret;
+    }
+
+    // Re-attach kernel driver
+    printf("Attaching kernel driver...\n");
+    mouse_hid_attach_kernel(_usb_interface_index);
 
-    printf("    Enabling DPI shift\n");
+    usb_xfer_stats_print();
+
+    status_close();
+
+    // De-initialise mouse
+    mouse_deinit();
+
+    // De-initialise USB
+    usb_deinit();
+
+    // Next!
+    devlock_release();
+
+    if (replay_record_close() < 0) ret = exit_param;
+
+    _mouse_primed = 0;
+
+    return ret;
+}
+
+// Saves the modes in want that differ from those on the mouse (_daemon_modes),
+// showing what's changed in each, in a single edit session. Returns a bitmask
+// of the modes saved (1 << t_mode), or -1 on error
+static int mouse_apply(const t_profile *want) {
+    unsigned char mode_data[MODE_DATA_LEN];
+    unsigned int changed = 0;
+    int ret;
+    t_mode m;
+
+    for (m = 0; m < mode_COUNT; ++m) {
+        if (!profile_get(want, m, &mode_data[0])) continue;
+
+        if (_daemon_modes.present & (1 << m)) {
+            if (memcmp(&mode_data[0], &_daemon_modes.mode_data[m][0], _model->mode_len) == 0) continue;
+
+            printf("Changing Mode: %s\n", s_mode[m]);
+            mode_diff(stdout, &_daemon_modes.mode_data[m][0], &mode_data[0], MODE_DATA_LEN);
+        }
+
+        changed |= (1 << m);
+    }
+
+    if (!changed) return 0;
+
+    if (!mouse_editmode()) {
+        elog("ERROR: Failed to enter edit mode\n");
+        return -1;
+    }
+
+    ret = changed;
+    for (m = 0; m < mode_COUNT; ++m) {
+        if (!(changed & (1 << m))) continue;
+
+        profile_get(want, m, &mode_data[0]);
+
+        printf("Saving Mode: %s\n", s_mode[m]);
+        if (!mode_save(&mode_data[0], _usb_dev_handle, m)) {
+            ret = -1;
+            continue;
+        }
+
+        profile_set(&_daemon_modes, m, &mode_data[0]);
+        probe_expect(m, &mode_data[0], _model->mode_len);
+    }
+
+    mouse_record(_daemon_modes.mode_data, changed & _daemon_modes.present);
+
+    return ret;
+}
+
+// Rereads the watched profile (--watch) into want, on top of the modes the
+// mouse had when the daemon started. Returns 1 on success, 0 if the profile
+// couldn't be read or has an invalid mode
+static int mouse_reload_load(t_profile *want) {
+    char err[256];
+    t_mode m;
+
+    *want = _watch_base;
+    if (profile_load(want, _watch_path) < 0) return 0;
+
+    for (m = 0; m < mode_COUNT; ++m) {
+        if (!(want->present & (1 << m))) continue;
+
+        if (!mode_validate(&want->mode_data[m][0], &err[0], sizeof(err))) {
+            elog("ERROR: Invalid mode %s in profile %s: %s\n", s_mode[m], _watch_path, err);
+            return 0;
+        }
+    }
 
-    // F5040302 84060844 01000002 00000300 00040000 05000006 00000700 00080000 090000
-    //                ^^
-    (mode_data)[7] &= 0xbf;
     return 1;
 }
 
-static int set_mode_dpishift(unsigned char *mode_data, const int dpi) {
-    int dpi_val = dpi >= 4000 ? 0 : (dpi/250)&0xf;
-    int real_dpi = !dpi_val ? 4000 : dpi_val*250;
+// Saves whatever modes the reloaded profile (want) changes, working out the
+// remaps again if any buttons were rebound. Returns 1 on success, 0 on error
+static int mouse_reload_apply(const t_profile *want) {
+    const unsigned long start = metrics_now_us();
+    const t_profile before = _daemon_modes;
+    int rebound = 0;
+    int saved;
+    int b;
+    t_mode m;
+
+    if ((saved = mouse_apply(want)) < 0) return 0;
+
+    // Remapped buttons are recognised by what they're bound to (only once the
+    // reader's running, before that remap_init() is still to come)
+    for (m = 0; m < mode_COUNT && _daemon_endpoint; ++m) {
+        if (!(saved & (1 << m))) continue;
 
-    if (!mode_data || dpi < 250) return 0;
+        for (b = 1; b <= _model->n_buttons; ++b) {
+            const int off = _model->off_buttons[b];
+
+            if (memcmp(&before.mode_data[m][off], &_daemon_modes.mode_data[m][off], 3) != 0) rebound = 1;
+        }
+    }
+
+    if (rebound) {
+        daemon_unwatch(remap_notify_fd());
+        remap_stop();
+        remap_init(&_remap_table, &_daemon_modes);
+
+        if (!remap_start(_usb_dev_handle, _daemon_endpoint) || !daemon_watch(remap_notify_fd(), mouse_notified, NULL)) {
+            daemon_stop(1);
+            return 0;
+        }
+    }
 
-    printf("    Setting DPI Shift: %d\n", real_dpi);
+    ilog("Reloaded %s in %.3fms (%d modes saved)\n"
+        ,_watch_path
+        ,(metrics_now_us() - start) / 1000.0
+        ,__builtin_popcount(saved));
 
-    // F5040302 84060844 01000002 00000300 00040000 05000006 00000700 00080000 090000
-    //                ^^
-    (mode_data)[7] = dpi_val;
-    return real_dpi;
+    return 1;
+}
+
+// Rereads the watched profile (--watch) and saves whatever modes it changes
+// straight away. Returns 1 on success, 0 on error (with nothing saved if the
+// profile was at fault)
+static int mouse_reload(void) {
+    t_profile want;
+
+    if (!mouse_reload_load(&want)) return 0;
+
+    return mouse_reload_apply(&want);
 }
 
-static int set_mode_nodpishift(unsigned char *mode_data) {
-    if (!mode_data) return 0;
+// Rereads the watched profile (--watch), leaving it to be saved once the
+// debounce window (--debounce) started by the first edit since the last save
+// is up. Each mode still waiting to be saved that this edit changes again is
+// a save avoided, only its final state ever gets written. Edits made while a
+// save's in progress are read once it's done, and saved together in the next
+// window. Returns 1 on success, 0 on error
+static int mouse_reload_queue(void) {
+    struct itimerspec its;
+    const size_t len = _model->mode_len;
+    t_profile want;
+    t_mode m;
+
+    if (!mouse_reload_load(&want)) return 0;
+
+    for (m = 0; m < mode_COUNT && _watch_pending_set; ++m) {
+        const unsigned char *pending = &_watch_pending.mode_data[m][0];
+
+        // Only modes that would have been saved, and now won't be as they were
+        if (!(_watch_pending.present & (1 << m))) continue;
+        if ((_daemon_modes.present & (1 << m)) && memcmp(pending, &_daemon_modes.mode_data[m][0], len) == 0) continue;
+        if ((want.present & (1 << m)) && memcmp(pending, &want.mode_data[m][0], len) == 0) continue;
+
+        METRIC_INC(_metrics.writes_coalesced);
+        dlog(LOG_USB, "Save of mode %s coalesced into a later edit\n", s_mode[m]);
+    }
+
+    _watch_pending = want;
+    if (_watch_pending_set) return 1;
+
+    _watch_pending_set = 1;
 
-    printf("    Disabling DPI shift\n");
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec  = _debounce_us / 1000000;
+    its.it_value.tv_nsec = (_debounce_us % 1000000) * 1000;
+
+    if (timerfd_settime(_debounce_fd, 0, &its, NULL) != 0) {
+        elog("ERROR: Failed to start debounce timer: %s\n", strerror(errno));
+        _watch_pending_set = 0;
+        return mouse_reload_apply(&want);
+    }
 
-    // F5040302 84060844 01000002 00000300 00040000 05000006 00000700 00080000 090000
-    //                ^^
-    (mode_data)[7] |= 0x40;
     return 1;
 }
 
-static unsigned char set_mode_colour(unsigned char *mode_data, const t_colour colour) {
-    unsigned char oldcol;
+// The debounce window's up, saves the latest edit to the watched profile
+static int mouse_debounced(const int fd, void *arg) {
+    uint64_t expirations;
 
-    if (!mode_data || colour >= colour_COUNT) return 0;
+    if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations)) return 0;
+    if (!_watch_pending_set) return 0;
 
-    printf("    Setting colour: %s\n", s_colour[colour]);
+    _watch_pending_set = 0;
+    mouse_reload_apply(&_watch_pending);
 
-    // F5040302 84060844 01000002 00000300 00040000 05000006 00000700 00080000 090000
-    //   ^^
-    oldcol = (mode_data)[1];
-    (mode_data)[1] = colour;
+    return 0;
+}
+
+// Something in the watched profile's directory was written, reloads it if it
+// was the profile (saved, or renamed into place as editors do)
+static int mouse_watch(const int fd, void *arg) {
+    char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    const char *name = strrchr(_watch_path, '/');
+    const struct inotify_event *ev;
+    int reload = 0;
+    ssize_t len;
+    char *p;
 
-    return oldcol;
+    name = name ? name + 1 : _watch_path;
+
+    while ((len = read(fd, &buf[0], sizeof(buf))) > 0) {
+        for (p = &buf[0]; p < &buf[0] + len; p += sizeof(*ev) + ev->len) {
+            ev = (const struct inotify_event *)p;
+
+            if (ev->len && strcmp(ev->name, name) == 0) reload = 1;
+        }
+    }
+
+    if (reload) {
+        if (_debounce_fd >= 0) mouse_reload_queue();
+        else                   mouse_reload();
+    }
+
+    return 0;
 }
 
-static int set_mode_button(unsigned char *mode_data, const unsigned char button, const char *keys) {
-    unsigned char newkeys[3] = {0, 0, 0};
-    unsigned char bt;
-    char modkey[32];
-    int mki = 0;
-    const char *kptrprev = keys;
-    const char *kptr     = keys;
+// Starts watching the profile (--watch). Returns the inotify fd, or -1 on
+// error
+static int mouse_watch_start(void) {
+    const char *slash = strrchr(_watch_path, '/');
+    char dir[PATH_MAX];
+    int fd;
+
+    // Editors usually save by renaming a new file into place, so it's the
+    // directory that's watched
+    if (!slash)                    snprintf(&dir[0], sizeof(dir), ".");
+    else if (slash == _watch_path) snprintf(&dir[0], sizeof(dir), "/");
+    else                           snprintf(&dir[0], sizeof(dir), "%.*s", (int)(slash - _watch_path), _watch_path);
+
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+        elog("ERROR: Failed to create inotify instance: %s\n", strerror(errno));
+        return -1;
+    }
 
-    modkey[0] = '\0';
+    if (inotify_add_watch(fd, &dir[0], IN_CLOSE_WRITE | IN_MOVED_TO) < 0 || !daemon_watch(fd, mouse_watch, NULL)) {
+        elog("ERROR: Failed to watch %s: %s\n", &dir[0], strerror(errno));
+        close(fd);
+        return -1;
+    }
 
-    if (button < 1 || button > 9) return 0;
+    if (!_debounce_us) return fd;
 
-    if (!keys) {
-        printf("    Setting button %2d: %s\n", button, s_buttons[0]);
-        (mode_data)[offsets_buttons[button]    ] = 0x00;
-        (mode_data)[offsets_buttons[button] + 1] = 0x00;
-        (mode_data)[offsets_buttons[button] + 2] = 0x00;
-        return 1;
+    _debounce_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (_debounce_fd < 0 || !daemon_watch(_debounce_fd, mouse_debounced, NULL)) {
+        elog("ERROR: Failed to create debounce timer: %s\n", strerror(errno));
+        if (_debounce_fd >= 0) close(_debounce_fd);
+        _debounce_fd = -1;
+        daemon_unwatch(fd);
+        close(fd);
+        return -1;
     }
 
-    if (*keys == '+' && *(keys+1)) {
-        // keys starts with '+' and then contains more info
-        elog("ERROR: Invalid keys specified (starting with '+'): %s\n", keys);
+    return fd;
+}
+
+// Reads back the next mode (--probe), writing it back if it's changed. Each
+// probe leaves enough of the budget for the write, so a mode found changed can
+// always be put right straight away.
+static int mouse_probe(const int fd, void *arg) {
+    const unsigned int reapply = _model->n_editmode + 2; // Save and verify
+    unsigned char mode_data[MODE_DATA_LEN];
+    const unsigned char *expected;
+    uint64_t expirations;
+    t_mode m;
+
+    if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations)) return 0;
+
+    if ((m = probe_next()) == mode_COUNT) return 0;
+
+    if (!probe_spend(1, reapply)) {
+        METRIC_INC(_metrics.probe_deferred);
+        dlog(LOG_USB, "Probe of mode %s put off, over budget\n", s_mode[m]);
         return 0;
     }
 
-    printf("    Setting button %d: %s\n", button, keys);
+    METRIC_INC(_metrics.probes);
+
+    if (mode_load(&mode_data[0], _usb_dev_handle, m) <= 0) {
+        elog("WARNING: Probe failed to read mode %s\n", s_mode[m]);
+        return 0;
+    }
 
-    do {
-        dlog(LOG_KEY, "    > %c\n", *kptr ? *kptr : ' ');
+    if (probe_check(m, &mode_data[0])) return 0;
+
+    METRIC_INC(_metrics.probe_mismatches);
+    elog("WARNING: Mode %s has changed on the mouse (reset?), reapplying\n", s_mode[m]);
+
+    // Can't fail, it was reserved above
+    probe_spend(reapply, 0);
+
+    expected = probe_expected(m);
+    memcpy(&mode_data[0], expected, MODE_DATA_LEN);
+
+    if (!mouse_editmode() || !mode_save(&mode_data[0], _usb_dev_handle, m)) {
+        elog("ERROR: Failed to reapply mode %s\n", s_mode[m]);
+        return 0;
+    }
+
+    METRIC_INC(_metrics.probe_reapplies);
+    ilog("Reapplied mode %s\n", s_mode[m]);
+
+    return 0;
+}
+
+// Starts probing (--probe), expecting the modes to stay as they are (modes, as
+// read when the daemon started). Returns the timer's fd, or -1 on error
+static int mouse_probe_start(const t_profile *modes) {
+    struct itimerspec its;
+    unsigned char mode_data[MODE_DATA_LEN];
+    t_mode m;
+    int fd;
+
+    probe_init(_probe_budget);
+
+    for (m = 0; m < mode_COUNT; ++m) {
+        if (profile_get(modes, m, &mode_data[0])) probe_expect(m, &mode_data[0], _model->mode_len);
+    }
+
+    if (_probe_budget < 1 + _model->n_editmode + 2) {
+        elog("WARNING: Probe budget (%u) too small to ever read and reapply a mode (%u)\n", _probe_budget, 1 + _model->n_editmode + 2);
+    }
+
+    fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (fd < 0) {
+        elog("ERROR: Failed to create probe timer: %s\n", strerror(errno));
+        return -1;
+    }
+
+    its.it_interval.tv_sec  = _probe_interval_us / 1000000;
+    its.it_interval.tv_nsec = (_probe_interval_us % 1000000) * 1000;
+    its.it_value            = its.it_interval;
+
+    if (timerfd_settime(fd, 0, &its, NULL) != 0 || !daemon_watch(fd, mouse_probe, NULL)) {
+        elog("ERROR: Failed to start probe timer: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
 
-        // Only accepting 31 characters for the modkey name
-        if (mki < 31) {
-            modkey[mki++] = *kptr;
-            modkey[mki  ] = '\0';
+    return fd;
+}
+
+// Time to rewrite the metrics file (--metrics), so they can be scraped while
+// the daemon runs
+static int mouse_metrics(const int fd, void *arg) {
+    uint64_t expirations;
+
+    if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations)) return 0;
+
+    metrics_write(_metrics_path, s_cmd, cmd_COUNT);
+
+    return 0;
+}
+
+// Writes the metrics file (--metrics) now, and starts the timer rewriting it.
+// Returns the timer's fd, or -1 on error
+static int mouse_metrics_start(void) {
+    struct itimerspec its;
+    int fd;
+
+    if (metrics_write(_metrics_path, s_cmd, cmd_COUNT) < 0) return -1;
+
+    fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (fd < 0) {
+        elog("ERROR: Failed to create metrics timer: %s\n", strerror(errno));
+        return -1;
+    }
+
+    its.it_interval.tv_sec  = METRICS_INTERVAL_MS / 1000;
+    its.it_interval.tv_nsec = (METRICS_INTERVAL_MS % 1000) * 1000000;
+    its.it_value            = its.it_interval;
+
+    if (timerfd_settime(fd, 0, &its, NULL) != 0 || !daemon_watch(fd, mouse_metrics, NULL)) {
+        elog("ERROR: Failed to start metrics timer: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+// Stays resident, taking over the interface we claim (the mouse's keyboard
+// half): its input reports are re-emitted through uinput, with any remapped
+// buttons translated on the way
+static t_exit mouse_daemon(void) {
+    unsigned char mode_data[MODE_DATA_LEN];
+    unsigned char endpoint;
+    t_exit ret = exit_none;
+    t_mode m;
+    int probefd = -1;
+    int watchfd = -1;
+    int metricsfd = -1;
+
+    if (_profile_path || _replay_path) {
+        elog("ERROR: Cannot run as a daemon on a %s\n", _profile_path ? "profile file" : "replayed session");
+        return exit_param;
+    }
+
+    // Before any threads are started
+    if (!daemon_init()) {
+        daemon_end();
+        return exit_daemon;
+    }
+
+    if ((ret = mouse_prime())) {
+        daemon_end();
+        return ret;
+    }
+
+    // So others give up straight away, rather than waiting on us
+    if (!devlock_set_daemon()) dlog(LOG_USB, "Failed to mark lock as the daemon's\n");
+
+    // What each button is bound to, to recognise them in input reports
+    memset(&_daemon_modes, 0, sizeof(_daemon_modes));
+    for (m = 0; m < mode_COUNT; ++m) {
+        if (mode_load(&mode_data[0], _usb_dev_handle, m) > 0) profile_set(&_daemon_modes, m, &mode_data[0]);
+    }
+
+    if (_watch_path) {
+        _watch_base = _daemon_modes;
+
+        if (!mouse_reload()) {
+            daemon_end();
+            return exit_profile;
         }
+    }
 
-        // Is the next char a '+' or the end of our string?
-        //   - We allow end of string to fall through here so that if the last
-        //   token is a modifier it gets applied as BOTH a modifier and the key
-        //   - We skip this if the '+' is the last character as it's a key, so
-        //   we can skip all this (fixes QB#125).
-        if ((*kptr == '+' && *(kptr+1) != '\0') || *kptr == '\0') {
-            // keys is:
-            //     "<something>+..."
-            // or:
-            //     "<something>\0"
-
-            unsigned char ky = 0xe0;
-            int m;
-
-            if (mki > 0) modkey[--mki] = '\0'; // Just in case - lgtm [cpp/constant-comparison]
-
-            dlog(LOG_KEY, "Checking for Modifier: %s\n", modkey);
-
-            for (m = 0x01; m <= 0x80; m *= 2) {
-                dlog(LOG_KEY, "    %s == %s?\n", s_keys[ky], modkey);
-                if (strcasecmp(s_keys[ky], modkey) == 0) {
-                    // Match!
-                    newkeys[1] |= m;
-                    dlog(LOG_KEY, "MATCH: %s (+%d == %d)\n", s_keys[ky], m, newkeys[1]);
-                    break;
-                }
+    remap_init(&_remap_table, &_daemon_modes);
 
-                ++ky;
-            }
+    endpoint = mouse_hid_endpoint(_usb_interface_index);
+    if (!endpoint) {
+        elog("ERROR: No input endpoint found on interface %d\n", _usb_interface_index);
+        daemon_end();
+        return exit_usberr;
+    }
 
-            // If it's not the last element...
-            if (*kptr) {
-                // And didn't match a modifier, BAD!
-                if (m > 0x80) {
-                    elog("ERROR: Invalid modifier (%s) specified: %s\n", modkey, keys);
-                    return 0;
-                }
+    if (!remap_uinput_open()) {
+        daemon_end();
+        return exit_daemon;
+    }
 
-                mki = 0;
-                modkey[mki] = '\0';
+    if (!remap_start(_usb_dev_handle, endpoint)) {
+        remap_uinput_close();
+        daemon_end();
+        return exit_daemon;
+    }
 
-                kptrprev = kptr+1;
-            }
+    // Kept up to date from here on, as it's switched on the mouse
+    mouse_set_active(mouse_active());
+
+    if (!daemon_watch(remap_notify_fd(), mouse_notified, NULL)) {
+        remap_stop();
+        remap_uinput_close();
+        daemon_end();
+        return exit_daemon;
+    }
+
+    if ((_probe_interval_us && (probefd = mouse_probe_start(&_daemon_modes)) < 0)
+     || (_watch_path && (watchfd = mouse_watch_start()) < 0)
+     || (_metrics_path && (metricsfd = mouse_metrics_start()) < 0)) {
+        if (probefd >= 0) close(probefd);
+        if (watchfd >= 0) close(watchfd);
+        remap_stop();
+        remap_uinput_close();
+        daemon_end();
+        return exit_daemon;
+    }
+
+    _daemon_endpoint = endpoint;
+
+    printf("Running as daemon (pid %d, endpoint 0x%.2x)...\n", getpid(), endpoint);
+
+    if (daemon_run() != 0) ret = exit_usberr;
+
+    if (probefd >= 0) close(probefd);
+    if (watchfd >= 0) close(watchfd);
+    if (metricsfd >= 0) close(metricsfd);
+
+    // Saves an edit still waiting for its debounce window (no need to work
+    // out the remaps again, they're stopping)
+    if (_debounce_fd >= 0) {
+        if (_watch_pending_set) {
+            _watch_pending_set = 0;
+            mouse_apply(&_watch_pending);
         }
 
-        if (!*kptr) break;
+        close(_debounce_fd);
+        _debounce_fd = -1;
+    }
 
-        ++kptr;
-    } while (1);
+    remap_stop();
+    remap_uinput_close();
+    daemon_end();
 
-    // kptrprev now contains remaining key or button
+    if (METRIC_GET(_metrics.remap_latency.count)) {
+        printf("Remapped %lu reports (%lu events), latency: %luus avg, %luus max\n"
+            ,METRIC_GET(_metrics.remap_reports)
+            ,METRIC_GET(_metrics.remap_events)
+            ,METRIC_GET(_metrics.remap_latency.sum_us) / METRIC_GET(_metrics.remap_latency.count)
+            ,METRIC_GET(_metrics.remap_latency.max_us));
+    }
 
-    // Special button?
-    dlog(LOG_KEY, "Checking for Specials...\n");
-    for (bt = 0x00; bt <= 0x0f; ++bt) {
-        if (strcasecmp(s_buttons[bt], kptrprev) == 0) {
-            // Button found
-            dlog(LOG_KEY, "MATCH SPECIAL: %s (%2x)\n", s_buttons[bt], bt);
-            newkeys[0] = bt;
+    if (METRIC_GET(_metrics.macro_jitter.count)) {
+        printf("Played %lu macros (%lu dropped), step jitter: %luus avg, %luus max\n"
+            ,METRIC_GET(_metrics.macros)
+            ,METRIC_GET(_metrics.macro_dropped)
+            ,METRIC_GET(_metrics.macro_jitter.sum_us) / METRIC_GET(_metrics.macro_jitter.count)
+            ,METRIC_GET(_metrics.macro_jitter.max_us));
+    }
+
+    if (METRIC_GET(_metrics.writes_coalesced)) {
+        printf("Coalesced %lu mode saves into later edits\n", METRIC_GET(_metrics.writes_coalesced));
+    }
+
+    return ret;
+}
+
+// Runs the steps first to last - 1 of the plan, all on the one target (the
+// mouse, or the current profile file). Every mode needed is read once up front,
+// all changes are made in memory (so prints and snapshots see them where they
+// are in the plan), then each mode that actually changed is saved, in a single
+// edit session, and finally the mode is selected
+static t_exit plan_exec(const t_plan *plan, const int first, const int last) {
+    unsigned char mode_data[mode_COUNT][MODE_DATA_LEN];
+    unsigned char mode_orig[mode_COUNT][MODE_DATA_LEN];
+    const t_exit err = _profile_path ? exit_profile : exit_usberr;
+    const t_plan_step *select = NULL;
+    unsigned int reads;
+    unsigned int written = 0;
+    unsigned int changed = 0;
+    t_exit ret = exit_none;
+    t_profile snap;
+    t_mode m;
+    int i;
+    int s;
+
+    if (first >= last) return exit_none;
+
+    // Initialise USB and mouse, detach kernel driver (if necessary)
+    if (!_profile_path && (ret = mouse_prime())) return ret;
+
+    // Reads
+    reads = plan_reads(plan, first, last);
+    for (m = 0; m < mode_COUNT; ++m) {
+        if (!(reads & (1 << m))) continue;
+
+        dlog(LOG_PARSE, "Loading Mode: %s\n", s_mode[m]);
+        if (mode_load(&mode_orig[m][0], _usb_dev_handle, m) <= 0) return err;
+        memcpy(&mode_data[m][0], &mode_orig[m][0], MODE_DATA_LEN);
+    }
+
+    // Changes (in memory)
+    for (i = first; i < last; ++i) {
+        const t_plan_step *step = &plan->step[i];
+
+        switch (step->op) {
+            case plan_select:
+                select = step;
+            break;
+
+            case plan_print:
+                printf("Printing Mode: %s\n", s_mode[step->mode]);
+                mode_print(stdout, &mode_data[step->mode][0], MODE_DATA_LEN);
+            break;
+
+            case plan_modify:
+                printf("Modifying Mode: %s\n", s_mode[step->mode]);
+
+                for (s = 0; s < step->nsets; ++s) {
+                    // Already validated, so can only fail if something's broken
+                    if (!plan_set_apply(&mode_data[step->mode][0], &step->set[s])) return exit_param;
+                }
+                written |= (1 << step->mode);
+            break;
+
+            case plan_snapshot:
+                if (_dry_run) {
+                    printf("Not Saving Snapshot (dry run): %s\n", step->path);
+                    break;
+                }
+
+                printf("Saving Snapshot: %s\n", step->path);
+
+                memset(&snap, 0, sizeof(snap));
+                for (m = 0; m < mode_COUNT; ++m) profile_set(&snap, m, &mode_data[m][0]);
+
+                if (profile_out(&snap, step->path) < 0) return exit_profile;
+            break;
+
+            case plan_restore:
+                printf("Restoring Profile: %s\n", step->path);
+
+                for (m = 0; m < mode_COUNT; ++m) {
+                    if (!profile_get(&step->profile, m, &mode_data[m][0])) continue;
+                    written |= (1 << m);
+                }
+            break;
+
+            default:
             break;
         }
     }
 
-    // Key
-    dlog(LOG_KEY, "Checking for Keys...\n");
-    if (!newkeys[0]) {
-        for (bt = 0; bt < 0xff; ++bt) {
-            if (strcasecmp(s_keys[bt], kptrprev) == 0) {
-                // Key found
-                dlog(LOG_KEY, "MATCH KEY: %s (%2x)\n", s_keys[bt], bt);
-                newkeys[2] = bt;
-                break;
+    // Writes
+    for (m = 0; m < mode_COUNT; ++m) {
+        if (!(written & (1 << m))) continue;
+
+        // Modes wholly restored weren't needed before, but are worth reading
+        // now to save writing them unchanged (a profile may not have them)
+        if (!(reads & (1 << m))) {
+            if (!_profile_path || profile_get(&_profile, m, &mode_orig[m][0])) {
+                if (mode_load(&mode_orig[m][0], _usb_dev_handle, m) > 0) reads |= (1 << m);
             }
         }
 
-        // Invalid key?
-        if (bt == 0xff) {
-            elog("ERROR: Invalid key (%s) specified: %s\n", kptrprev, keys);
-            return 0;
+        if ((reads & (1 << m)) && memcmp(&mode_data[m][0], &mode_orig[m][0], MODE_DATA_LEN) == 0) {
+            printf("Mode Unchanged: %s\n", s_mode[m]);
+            continue;
         }
+
+        changed |= (1 << m);
     }
 
-    dlog(LOG_KEY, "FINAL: %.2x%.2x%.2x\n", newkeys[0], newkeys[1], newkeys[2]);
+    if (_dry_run) {
+        dry_run_exec(mode_data, mode_orig, reads, changed, select);
+        return exit_none;
+    }
 
-    (mode_data)[offsets_buttons[button]    ] = newkeys[0];
-    (mode_data)[offsets_buttons[button] + 1] = newkeys[1];
-    (mode_data)[offsets_buttons[button] + 2] = newkeys[2];
+    if (changed && !mouse_editmode()) {
+        elog("ERROR: Failed to enter edit mode\n");
+        return exit_usberr;
+    }
 
-    return 1;
+    for (m = 0; m < mode_COUNT; ++m) {
+        if (!(changed & (1 << m))) continue;
+
+        printf("Saving Mode: %s\n", s_mode[m]);
+        if (!mode_save(&mode_data[m][0], _usb_dev_handle, m)) ret = err;
+    }
+
+    if (select && ret == exit_none) {
+        printf("Selecting Mode: %s\n", s_mode[select->mode]);
+
+        if (change_mode(_usb_dev_handle, select->mode) == mode_COUNT) ret = exit_modesel;
+    }
+
+    if (!_profile_path && ret == exit_none) mouse_record(mode_data, reads | changed);
+
+    return ret;
 }
 
-static int mouse_editmode(void) {
-    if (!_mouse_primed || !_usb_dev_handle) return 0;
+// Reads a profile from a file, or the store if path is "@<name>". Returns as
+// profile_read()
+static int profile_in(t_profile *prof, const char *path) {
+    if (path[0] != STORE_PREFIX) return profile_read(prof, path);
+
+    if (!_store_path) {
+        elog("ERROR: %s needs a profile store (see --store)\n", path);
+        return -1;
+    }
 
-    // LAUNCH EDITOR
-    // 2117030035 S Co:2:039:0 s 21 09 03f0 0001 0004 4 = f0423900
-    // 2117031923 S Co:2:039:0 s 21 09 03f0 0001 0004 4 = f0423900
-    // 2117033709 S Co:2:039:0 s 21 09 03f0 0001 0004 4 = f0423900
-    // (only doing one as they're dups)
-    libusb_control_transfer(_usb_dev_handle, LIBUSB_REQUEST_TYPE_CLASS|LIBUSB_RECIPIENT_INTERFACE|LIBUSB_ENDPOINT_OUT, HID_REQ_SET_REPORT, 0x03f0, 0x0001, (unsigned char *)"\xf0\x42\x39\x00", 4, 1000); usleep(50000);
+    return store_get(path + 1, prof);
+}
 
-    // 2117041527 S Co:2:039:0 s 21 09 03f2 0001 0002 2 = f24f
-    libusb_control_transfer(_usb_dev_handle, LIBUSB_REQUEST_TYPE_CLASS|LIBUSB_RECIPIENT_INTERFACE|LIBUSB_ENDPOINT_OUT, HID_REQ_SET_REPORT, 0x03f2, 0x0001, (unsigned char *)"\xf2\x4f", 2, 1000); usleep(50000);
+// Writes a profile to a file, or the store if path is "@<name>". Returns as
+// profile_write()
+static int profile_out(const t_profile *prof, const char *path) {
+    if (path[0] != STORE_PREFIX) return profile_write(prof, path);
 
-    // 2117043288 S Co:2:039:0 s 21 09 03f0 0001 0004 4 = f0000000
-    libusb_control_transfer(_usb_dev_handle, LIBUSB_REQUEST_TYPE_CLASS|LIBUSB_RECIPIENT_INTERFACE|LIBUSB_ENDPOINT_OUT, HID_REQ_SET_REPORT, 0x03f0, 0x0001, (unsigned char *)"\xf0\x00\x00\x00", 4, 1000); usleep(50000);
+    if (!_store_path) {
+        elog("ERROR: %s needs a profile store (see --store)\n", path);
+        return -1;
+    }
 
-    // 2117063607 S Co:2:039:0 s 21 09 03f1 0001 0002 2 = f100
-    // Is this reboot or something? Causes lights to turn off
-    libusb_control_transfer(_usb_dev_handle, LIBUSB_REQUEST_TYPE_CLASS|LIBUSB_RECIPIENT_INTERFACE|LIBUSB_ENDPOINT_OUT, HID_REQ_SET_REPORT, 0x03f1, 0x0001, (unsigned char *)"\xf1\x00", 2, 1000); usleep(50000);
+    return store_put(path + 1, store_profile, prof);
+}
 
-    //DUPS OF ABOVE// // 2117071455 S Co:2:039:0 s 21 09 03f2 0001 0002 2 = f24f
-    //DUPS OF ABOVE// // 2117074118 S Co:2:039:0 s 21 09 03f0 0001 0004 4 = f0000000
-    //DUPS OF ABOVE// // 2117089459 S Co:2:039:0 s 21 09 03f1 0001 0002 2 = f100
+// Notes the modes now on the mouse in the store (if any, and it can be saved
+// to), under its serial number or, lacking one, where it's plugged in
+static void mouse_record(unsigned char mode_data[][MODE_DATA_LEN], const unsigned int modes) {
+    char name[STORE_NAME_LEN];
+    t_profile prof;
+    t_mode m;
 
-    usleep(500000);
+    if (!_store_path || !modes || !store_writable()) return;
 
-    // START EDIT
-    // 2161557129 S Co:2:039:0 s 21 09 03f0 0001 0004 4 = f0420000
-    libusb_control_transfer(_usb_dev_handle, LIBUSB_REQUEST_TYPE_CLASS|LIBUSB_RECIPIENT_INTERFACE|LIBUSB_ENDPOINT_OUT, HID_REQ_SET_REPORT, 0x03f0, 0x0001, (unsigned char *)"\xf0\x42\x00\x00", 4, 1000);
+    if (_devsel.serial[0])                                             snprintf(&name[0], sizeof(name), "%s", &_devsel.serial[0]);
+    else if (!devsel_serial(&_usb_dev_path[0], &name[0], sizeof(name))) snprintf(&name[0], sizeof(name), "%s", &_usb_dev_path[0]);
 
-    // ALSO SEEN THESE... NO IDEA WHAT THEY ARE?
-    // S Co:2:039:0 s 21 09 03f0 0001 0004 4 = f0400000
-    // S Co:2:039:0 s 21 09 03f0 0001 0004 4 = f0404b03
-    // S Co:2:039:0 s 21 09 03f0 0001 0004 4 = f0420000
-    // S Co:2:039:0 s 21 09 03f0 0001 0004 4 = f0424b03
-    // S Co:2:039:0 s 21 09 03f0 0001 0004 4 = f0440000
-    // S Co:2:039:0 s 21 09 03f0 0001 0004 4 = f0460000
+    if (!name[0]) return;
 
-    return 1;
+    memset(&prof, 0, sizeof(prof));
+    for (m = 0; m < mode_COUNT; ++m) {
+        if (modes & (1 << m)) profile_set(&prof, m, &mode_data[m][0]);
+    }
+
+    if (store_put(&name[0], store_device, &prof) < 0) elog("WARNING: Failed to record %s in store\n", &name[0]);
 }
 
-int mouse_prime(void) {
-    if (_mouse_primed) return exit_none;
+// Shows what plan_exec would have written (as changes to each field, against
+// what was read), and adds what it would have had the mouse do to _dry_run_est
+static void dry_run_exec(unsigned char mode_data[][MODE_DATA_LEN], unsigned char mode_orig[][MODE_DATA_LEN], const unsigned int reads, const unsigned int changed, const t_plan_step *select) {
+    t_mode m;
+    int i;
 
-    // Initialise USB
-    usb_init();
+    for (m = 0; m < mode_COUNT; ++m) {
+        if (!(changed & (1 << m))) continue;
 
-    // Initialise mouse
-    // ID 046d:c246 == Logitech, Inc. Gaming Mouse G300
-    if (!mouse_init(LOGITECH_G300S_VENDOR_ID, LOGITECH_G300S_PRODUCT_ID, "Logitech G300s")) {
-        // De-initialise USB
-        usb_deinit();
+        printf("Would Save Mode: %s\n", s_mode[m]);
 
-        return exit_usberr;
+        // Nothing to compare against (not in the profile, or not shared)
+        if (!(reads & (1 << m))) {
+            printf("  (current settings unknown)\n");
+            mode_print(stdout, &mode_data[m][0], MODE_DATA_LEN);
+        } else {
+            mode_diff(stdout, &mode_orig[m][0], &mode_data[m][0], MODE_DATA_LEN);
+        }
+    }
+
+    if (select) printf("Would Select Mode: %s\n", s_mode[select->mode]);
+
+    // Profile files take no time to write
+    if (_profile_path) return;
+
+    if (changed) {
+        ++_dry_run_est.editmodes;
+        for (i = 0; i < _model->n_editmode; ++i) {
+            ++_dry_run_est.xfers;
+            _dry_run_est.sleep_us += _model->editmode[i].settle;
+        }
     }
 
-    display_mouse_hid(LOGITECH_G300S_VENDOR_ID, LOGITECH_G300S_PRODUCT_ID);
+    for (m = 0; m < mode_COUNT; ++m) {
+        if (!(changed & (1 << m))) continue;
 
-    // TODO: Get interface index somehow
-    _usb_interface_index = 1;
-    if (_usb_interface_index < 0) {
-        // De-initialise USB
-        usb_deinit();
-
-        return exit_usberr;
+        ++_dry_run_est.saves;
+        _dry_run_est.xfers    += 2;
+        _dry_run_est.sleep_us += _model->settle_save + _model->settle_load;
     }
 
-    printf("Detaching kernel driver...\n");
-    if (mouse_hid_detach_kernel(_usb_interface_index) != 0) {
-        // De-initialise mouse
-        mouse_deinit();
+    if (select) {
+        ++_dry_run_est.selects;
+        ++_dry_run_est.xfers;
+        _dry_run_est.sleep_us += _model->select[select->mode].settle;
+    }
+}
 
-        // De-initialise USB
-        usb_deinit();
+// Prints what the dry run found the mouse would have been asked to do, and how
+// long it'd take (transfers timed as the reads were, if there were any)
+static void dry_run_print(void) {
+    const t_metrics_hist *lat = &_metrics.cmd[cmd_mode_load].latency;
+    unsigned long xfer_us = DRY_RUN_XFER_US;
+    unsigned long total_us;
+
+    // A replayed mouse answers straight away, unless reproducing timings
+    if (METRIC_GET(lat->count) && (!replay_active() || replay_timed())) xfer_us = METRIC_GET(lat->sum_us) / METRIC_GET(lat->count);
+
+    total_us = _dry_run_est.xfers * xfer_us + _dry_run_est.sleep_us;
+
+    printf("Dry Run (nothing written):\n");
+    printf("  Mode Saves:          %u\n", _dry_run_est.saves);
+    printf("  Edit Mode Entries:   %u\n", _dry_run_est.editmodes);
+    printf("  Mode Selects:        %u\n", _dry_run_est.selects);
+    printf("  Transfers:           %u (~%luus each)\n", _dry_run_est.xfers, xfer_us);
+    printf("  Settling:            %lu.%.3lus\n", _dry_run_est.sleep_us / 1000000, (_dry_run_est.sleep_us / 1000) % 1000);
+    printf("  Device Time:         %lu.%.3lus\n", total_us / 1000000, (total_us / 1000) % 1000);
+}
 
-        return exit_usberr;
-    }
+// Runs the (optimised) plan, switching between the mouse and profile files as
+// it goes
+static t_exit plan_run(const t_plan *plan) {
+    t_exit ret = exit_none;
+    int first = 0;
+    int i;
 
-    _mouse_primed = 1;
+    for (i = 0; i <= plan->nsteps; ++i) {
+        if (i < plan->nsteps && plan->step[i].op != plan_file) continue;
 
-    return exit_none;
-}
+        if ((ret = plan_exec(plan, first, i))) return ret;
+        first = i + 1;
 
-int mouse_unprime(void) {
-    if (!_mouse_primed) return exit_none;
+        if (i == plan->nsteps) {
+            if (_dry_run) dry_run_print();
+            break;
+        }
 
-    // Re-attach kernel driver
-    printf("Attaching kernel driver...\n");
-    mouse_hid_attach_kernel(_usb_interface_index);
+        if (_profile_dirty) {
+            printf("Writing Profile: %s\n", _profile_path);
+            if (profile_out(&_profile, _profile_path) < 0) return exit_profile;
+            _profile_dirty = 0;
+        }
 
-    // De-initialise mouse
-    mouse_deinit();
+        if (profile_in(&_profile, plan->step[i].path) < 0) {
+            _profile_path = NULL;
+            return exit_profile;
+        }
 
-    // De-initialise USB
-    usb_deinit();
+        _profile_path = plan->step[i].path;
 
-    _mouse_primed = 0;
+        printf("Using Profile: %s\n", _profile_path);
+    }
 
-    return exit_none;
+    return ret;
 }
 
 int main (int argc, char *argv[]) {
+    // The deadline counts from here
+    const unsigned long start = metrics_now_us();
+
     t_exit ret = exit_none;
     int c;
 
-    t_mode mode = mode_COUNT;
+    // The modify step settings are added to, and the profile file steps apply
+    // to (NULL for the mouse)
+    t_plan_step *edit = NULL;
+    const char *file = NULL;
+
+    // Settings are checked by applying them to this (quietly)
+    unsigned char mode_data_chk[MODE_DATA_LEN];
+    int mode_verbose;
 
-    // Data structures to store loaded and ready to save mode data
-    unsigned char mode_data_l[255];
-    unsigned char mode_data_s[255];
+    int i;
+
+    _start_us = start;
 
     log_init();
 
-    help_version();
+    // Run by udev, where the banner's just noise. Any abbreviation getopt would
+    // take (--on, --on-u...) counts.
+    for (i = 1; i < argc && strcmp(argv[i], "--") != 0; ++i) {
+        const size_t len = strcspn(argv[i], "=");
+
+        if (len >= 4 && strncmp(argv[i], "--on-udev", len) == 0) _udev = 1;
+    }
+
+    if (!_udev) help_version();
+
+    plan_init(&_plan);
+
+    memset(&mode_data_chk[0], 0, sizeof(mode_data_chk));
+    mode_verbose = _mode_verbose;
+    _mode_verbose = 0;
 
     while (1) {
         int option_index = 0;
@@ -1410,6 +2488,30 @@ int main (int argc, char *argv[]) {
             {"version",     0, 0, 'V'},
             {"listkeys",    0, 0,   0}, /* DON'T REORDER THIS, MUST BE 3rd */
 
+            {"file",        1, 0, 'f'},
+            {"snapshot",    1, 0,   0},
+            {"restore",     1, 0,   0},
+            {"on-udev",     1, 0,   0},
+
+            {"device",      1, 0,   0},
+            {"serial",      1, 0,   0},
+            {"metrics",     1, 0,   0},
+            {"deadline",    1, 0,   0},
+            {"wait",        1, 0,   0},
+            {"record",      1, 0,   0},
+            {"replay",      1, 0,   0},
+            {"replay-timed",0, 0,   0},
+            {"status",      0, 0,   0},
+            {"daemon",      0, 0,   0},
+            {"watch",       1, 0,   0},
+            {"debounce",    1, 0,   0},
+            {"store",       1, 0,   0},
+            {"drift",       1, 0,   0},
+            {"dry-run",     0, 0,   0},
+            {"probe",       1, 0,   0},
+            {"probe-budget",1, 0,   0},
+            {"remap",       1, 0,   0},
+
             {"select",      1, 0, 's'},
             {"print",       1, 0, 'p'},
             {"modify",      1, 0, 'm'},
@@ -1449,7 +2551,7 @@ int main (int argc, char *argv[]) {
             {0,0,0,0}
         };
 
-        c = getopt_long(argc, argv, "hVs:p:m:r:A:B:C:D:F:S::Uc:1:2:3:4:5:6:7:8:9:",
+        c = getopt_long(argc, argv, "hVf:s:p:m:r:A:B:C:D:F:S::Uc:1:2:3:4:5:6:7:8:9:",
                 long_options, &option_index);
 
         // If we've had a previous error, or there's not more options, break
@@ -1470,6 +2572,29 @@ int main (int argc, char *argv[]) {
 
             break;
 
+            // Offline profile file
+            case 'f':
+                if (!optarg) {
+                    elog("ERROR: File required for profile file option\n");
+                    ret = exit_param;
+                    continue;
+                }
+
+                if (plan_uses_mouse(&_plan)) {
+                    elog("ERROR: Profile file must be specified before mouse options\n");
+                    ret = exit_param;
+                    continue;
+                }
+
+                if (!plan_add(&_plan, plan_file, mode_COUNT, optarg)) {
+                    ret = exit_param;
+                    continue;
+                }
+
+                file = optarg;
+                edit = NULL;
+            break;
+
             // Select Mode
             case 's':
             {
@@ -1493,32 +2618,25 @@ int main (int argc, char *argv[]) {
 
                 printf("Mode Selection Specified: %s\n", s_mode[mnew]);
 
-                // Initialise USB and mouse, detach kernel driver (if necessary)
-                // If we cannot, abort (caught at start of loop)
-                if ((ret = mouse_prime())) continue;
-
-                if (mode != mode_COUNT) {
-                    // They've been editing another mode, so save
-                    printf("Saving Mode: %s\n", s_mode[mode]);
-                    mode_save(&mode_data_s[0], _usb_dev_handle, mode);
-                    mode = mode_COUNT;
+                if (file) {
+                    elog("ERROR: Cannot select a mode in a profile file\n");
+                    ret = exit_modesel;
+                    continue;
                 }
 
-                printf("Selecting Mode: %s\n", s_mode[mnew]);
-
-                if (change_mode(_usb_dev_handle, mnew) == mode_COUNT) ret = exit_modesel;
+                if (!plan_add(&_plan, plan_select, mnew, NULL)) ret = exit_param;
+                edit = NULL;
             }
             break;
 
             // Print mode
             case 'p':
             {
-                unsigned char mode_data_p[255];
-                int len = 0;
                 t_mode mnew = mode_COUNT;
 
                 if (!optarg) {
                     elog("ERROR: Mode required for print option\n");
+                    ret = exit_param;
                     continue;
                 }
 
@@ -1528,25 +2646,12 @@ int main (int argc, char *argv[]) {
 
                 if (mnew == mode_COUNT) {
                     elog("ERROR: Invalid mode for print option: %s\n", optarg);
+                    ret = exit_param;
                     continue;
                 }
 
-                // Initialise USB and mouse, detach kernel driver (if necessary)
-                // If we cannot, abort (caught at start of loop)
-                if ((ret = mouse_prime())) continue;
-
-                if (mode != mode_COUNT) {
-                    // They've been editing another mode, so save
-                    printf("Saving Mode: %s\n", s_mode[mode]);
-                    mode_save(&mode_data_s[0], _usb_dev_handle, mode);
-                    mode = mode_COUNT;
-                }
-
-                printf("Printing Mode: %s\n", s_mode[mnew]);
-
-                if ((len = mode_load(&mode_data_p[0], _usb_dev_handle, mnew)) > 0) {
-                    mode_print(&mode_data_p[0], len);
-                }
+                if (!plan_add(&_plan, plan_print, mnew, NULL)) ret = exit_param;
+                edit = NULL;
             }
             break;
 
@@ -1555,20 +2660,11 @@ int main (int argc, char *argv[]) {
             {
                 t_mode mnew = mode_COUNT;
 
-                // Initialise USB and mouse, detach kernel driver (if necessary)
-                // If we cannot, abort (caught at start of loop)
-                if ((ret = mouse_prime())) continue;
+                edit = NULL;
 
                 if (!optarg) {
                     elog("ERROR: Mode required for modify option\n");
-
-                    // For safety we reset mode now
-                    if (mode != mode_COUNT) {
-                        printf("Saving Mode: %s\n", s_mode[mode]);
-                        mode_save(&mode_data_s[0], _usb_dev_handle, mode);
-                        mode = mode_COUNT;
-                    }
-
+                    ret = exit_param;
                     continue;
                 }
 
@@ -1578,33 +2674,11 @@ int main (int argc, char *argv[]) {
 
                 if (mnew == mode_COUNT) {
                     elog("ERROR: Invalid mode for modify option: %s\n", optarg);
-
-                    // For safety we reset mode now
-                    if (mode != mode_COUNT) {
-                        printf("Saving Mode: %s\n", s_mode[mode]);
-                        mode_save(&mode_data_s[0], _usb_dev_handle, mode);
-                    }
-
-                    mode = mode_COUNT;
-
+                    ret = exit_param;
                     continue;
                 }
 
-                if (mode != mode_COUNT) {
-                    // They've been editing another mode, so save
-                    printf("Saving Mode: %s\n", s_mode[mode]);
-                    mode_save(&mode_data_s[0], _usb_dev_handle, mode);
-                }
-
-                mode = mnew;
-
-                printf("Modifying Mode: %s\n", s_mode[mnew]);
-
-                mouse_editmode();
-
-                if (mode_load(&mode_data_l[0], _usb_dev_handle, mode) > 0) {
-                    memcpy(&mode_data_s, &mode_data_l, 255);
-                }
+                if (!(edit = plan_add(&_plan, plan_modify, mnew, NULL))) ret = exit_param;
             }
             break;
 
@@ -1612,17 +2686,20 @@ int main (int argc, char *argv[]) {
             case 'r':
                 if (!optarg) {
                     elog("ERROR: Report Rate (per s) required for rate setting\n");
+                    ret = exit_param;
                     continue;
                 }
 
-                if (mode == mode_COUNT) {
+                if (!edit) {
                     elog("ERROR: Mode not specified before rate setting\n");
+                    ret = exit_param;
                     continue;
                 }
 
-                if (!set_mode_rate(&mode_data_s[0], atoi(optarg))) {
+                if (!set_mode_rate(&mode_data_chk[0], atoi(optarg))) {
                     // Failed
                     elog("ERROR: Invalid rate: %s\n", optarg);
+                    ret = exit_param;
                     continue;
                 }
             break;
@@ -1634,17 +2711,20 @@ int main (int argc, char *argv[]) {
             case 'D':
                 if (!optarg) {
                     elog("ERROR: DPI value required for DPI setting\n");
+                    ret = exit_param;
                     continue;
                 }
 
-                if (mode == mode_COUNT) {
+                if (!edit) {
                     elog("ERROR: Mode not specified before DPI setting\n");
+                    ret = exit_param;
                     continue;
                 }
 
-                if (!set_mode_dpi(&mode_data_s[0], c-'A', atoi(optarg))) {
+                if (!set_mode_dpi(&mode_data_chk[0], c-'A', atoi(optarg))) {
                     // Failed
                     elog("ERROR: Invalid DPI: %s\n", optarg);
+                    ret = exit_param;
                     continue;
                 }
                 break;
@@ -1653,38 +2733,44 @@ int main (int argc, char *argv[]) {
             case 'F':
                 if (!optarg) {
                     elog("ERROR: DPI number required for selecting default DPI\n");
+                    ret = exit_param;
                     continue;
                 }
 
-                if (mode == mode_COUNT) {
+                if (!edit) {
                     elog("ERROR: Mode not specified before DPI setting\n");
+                    ret = exit_param;
                     continue;
                 }
 
-                if (!set_mode_defdpi(&mode_data_s[0], atoi(optarg) - 1)) {
+                if (!set_mode_defdpi(&mode_data_chk[0], atoi(optarg) - 1)) {
                     // Failed
                     elog("ERROR: Invalid DPI number: %s\n", optarg);
+                    ret = exit_param;
                     continue;
                 }
                 break;
 
             // DPI shift setting
             case 'S':
-                if (mode == mode_COUNT) {
+                if (!edit) {
                     elog("ERROR: Mode not specified before DPI setting\n");
+                    ret = exit_param;
                     continue;
                 }
 
                 if (!optarg) {
-                    if (!set_mode_enabledpishift(&mode_data_s[0])) {
+                    if (!set_mode_enabledpishift(&mode_data_chk[0])) {
                         // Failed
                         elog("ERROR: Enable DPI shift failed\n");
+                        ret = exit_param;
                         continue;
                     }
                 } else {
-                    if (!set_mode_dpishift(&mode_data_s[0], atoi(optarg))) {
+                    if (!set_mode_dpishift(&mode_data_chk[0], atoi(optarg))) {
                         // Failed
                         elog("ERROR: Invalid DPI: %s\n", optarg);
+                        ret = exit_param;
                         continue;
                     }
                 }
@@ -1692,14 +2778,16 @@ int main (int argc, char *argv[]) {
 
             // Disable DPI shift
             case 'U':
-                if (mode == mode_COUNT) {
+                if (!edit) {
                     elog("ERROR: Mode not specified before disable DPI shift option\n");
+                    ret = exit_param;
                     continue;
                 }
 
-                if (!set_mode_nodpishift(&mode_data_s[0])) {
+                if (!set_mode_nodpishift(&mode_data_chk[0])) {
                     // Failed
                     elog("ERROR: Disable DPI shift failed\n");
+                    ret = exit_param;
                     continue;
                 }
                 break;
@@ -1711,24 +2799,27 @@ int main (int argc, char *argv[]) {
 
                 if (!optarg) {
                     elog("ERROR: Colour required for colour setting\n");
+                    ret = exit_param;
                     continue;
                 }
 
-                if (mode == mode_COUNT) {
+                if (!edit) {
                     elog("ERROR: Mode not specified before colour setting\n");
+                    ret = exit_param;
                     continue;
                 }
 
                 for (col = 0; col < colour_COUNT; ++col) {
                     if (strcasecmp(s_colour[col], optarg) == 0) {
                         // Found valid colour
-                        set_mode_colour(&mode_data_s[0], col);
+                        set_mode_colour(&mode_data_chk[0], col);
                         break;
                     }
                 }
 
                 if (col == colour_COUNT) {
                     elog("ERROR: Invalid colour: %s\n", optarg);
+                    ret = exit_param;
                     continue;
                 }
             }
@@ -1746,15 +2837,20 @@ int main (int argc, char *argv[]) {
             {
                 if (!optarg) {
                     elog("ERROR: Key(s) required for assignment setting\n");
+                    ret = exit_param;
                     continue;
                 }
 
-                if (mode == mode_COUNT) {
+                if (!edit) {
                     elog("ERROR: Mode not specified before button assignment\n");
+                    ret = exit_param;
                     continue;
                 }
 
-                set_mode_button(&mode_data_s[0], c - '0', optarg);
+                if (!set_mode_button(&mode_data_chk[0], c - '0', optarg)) {
+                    ret = exit_param;
+                    continue;
+                }
             }
             break;
 
@@ -1765,6 +2861,282 @@ int main (int argc, char *argv[]) {
                     keylist_print();
                     continue;
                 }
+
+                if (strcmp(long_options[option_index].name, "device") == 0
+                 || strcmp(long_options[option_index].name, "serial") == 0) {
+                    if (plan_uses_mouse(&_plan)) {
+                        elog("ERROR: Device must be specified before mouse options\n");
+                        ret = exit_param;
+                        continue;
+                    }
+
+                    if (long_options[option_index].name[0] == 'd') {
+                        if (!devsel_parse_path(&_devsel, optarg)) {
+                            elog("ERROR: Invalid device (expected bus:port[.port...]): %s\n", optarg);
+                            ret = exit_param;
+                            continue;
+                        }
+
+                        printf("Device Selection Specified: %s\n", &_devsel.path[0]);
+                    } else {
+                        if (!optarg[0] || strlen(optarg) >= sizeof(_devsel.serial)) {
+                            elog("ERROR: Invalid serial: %s\n", optarg);
+                            ret = exit_param;
+                            continue;
+                        }
+
+                        strcpy(&_devsel.serial[0], optarg);
+
+                        printf("Serial Selection Specified: %s\n", &_devsel.serial[0]);
+                    }
+                    continue;
+                }
+
+                if (strcmp(long_options[option_index].name, "status") == 0) {
+                    status_print();
+                    continue;
+                }
+
+                if (strcmp(long_options[option_index].name, "daemon") == 0) {
+                    _daemon = 1;
+                    continue;
+                }
+
+                if (strcmp(long_options[option_index].name, "watch") == 0) {
+                    if (optarg[0] == STORE_PREFIX) {
+                        elog("ERROR: --watch needs a profile file, not %s\n", optarg);
+                        ret = exit_param;
+                        continue;
+                    }
+
+                    _watch_path = optarg;
+                    continue;
+                }
+
+                if (strcmp(long_options[option_index].name, "store") == 0) {
+                    if (!store_open(optarg)) {
+                        ret = exit_profile;
+                        continue;
+                    }
+
+                    _store_path = optarg;
+                    continue;
+                }
+
+                if (strcmp(long_options[option_index].name, "drift") == 0) {
+                    const char *name = optarg[0] == STORE_PREFIX ? optarg + 1 : optarg;
+
+                    if (!_store_path) {
+                        elog("ERROR: --drift needs a profile store (see --store)\n");
+                        ret = exit_param;
+                        continue;
+                    }
+
+                    if (store_drift(stdout, name) < 0) ret = exit_profile;
+                    continue;
+                }
+
+                if (strcmp(long_options[option_index].name, "debounce") == 0) {
+                    char *end = NULL;
+                    unsigned long ms;
+
+                    errno = 0;
+                    ms = strtoul(optarg, &end, 10);
+                    if (errno || !*optarg || *end || ms > ULONG_MAX / 1000) {
+                        elog("ERROR: Invalid debounce window (ms): %s\n", optarg);
+                        ret = exit_param;
+                        continue;
+                    }
+
+                    _debounce_us = ms * 1000;
+                    continue;
+                }
+
+                if (strcmp(long_options[option_index].name, "probe") == 0) {
+                    char *end = NULL;
+                    unsigned long ms;
+
+                    errno = 0;
+                    ms = strtoul(optarg, &end, 10);
+                    if (errno || !*optarg || *end || !ms || ms > ULONG_MAX / 1000) {
+                        elog("ERROR: Invalid probe interval (ms): %s\n", optarg);
+                        ret = exit_param;
+                        continue;
+                    }
+
+                    _probe_interval_us = ms * 1000;
+                    continue;
+                }
+
+                if (strcmp(long_options[option_index].name, "probe-budget") == 0) {
+                    char *end = NULL;
+                    unsigned long n;
+
+                    errno = 0;
+                    n = strtoul(optarg, &end, 10);
+                    if (errno || !*optarg || *end || !n || n > UINT_MAX) {
+                        elog("ERROR: Invalid probe budget (transfers a minute): %s\n", optarg);
+                        ret = exit_param;
+                        continue;
+                    }
+
+                    _probe_budget = n;
+                    continue;
+                }
+
+                if (strcmp(long_options[option_index].name, "dry-run") == 0) {
+                    _dry_run = 1;
+                    continue;
+                }
+
+                if (strcmp(long_options[option_index].name, "remap") == 0) {
+                    char err[256];
+                    FILE *fp;
+                    int line;
+
+                    fp = fopen(optarg, "r");
+                    if (!fp) {
+                        elog("ERROR: Failed to open remap file %s: %s\n", optarg, strerror(errno));
+                        ret = exit_param;
+                        continue;
+                    }
+
+                    line = remap_parse(&_remap_table, fp, &err[0], sizeof(err));
+                    fclose(fp);
+
+                    if (line) {
+                        elog("ERROR: %s:%d: %s\n", optarg, line, err);
+                        ret = exit_param;
+                    }
+                    continue;
+                }
+
+                if (strcmp(long_options[option_index].name, "record") == 0
+                 || strcmp(long_options[option_index].name, "replay") == 0) {
+                    if (plan_uses_mouse(&_plan)) {
+                        elog("ERROR: Session %s must be specified before mouse options\n", long_options[option_index].name);
+                        ret = exit_param;
+                        continue;
+                    }
+
+                    if (long_options[option_index].name[2] == 'c') _record_path = optarg;
+                    else                                           _replay_path = optarg;
+
+                    if (_record_path && _replay_path) {
+                        elog("ERROR: Cannot record a replayed session\n");
+                        ret = exit_param;
+                    }
+                    continue;
+                }
+
+                if (strcmp(long_options[option_index].name, "replay-timed") == 0) {
+                    _replay_timed = 1;
+                    continue;
+                }
+
+                if (strcmp(long_options[option_index].name, "wait") == 0) {
+                    char *end = NULL;
+                    unsigned long ms;
+
+                    errno = 0;
+                    ms = strtoul(optarg, &end, 10);
+                    if (errno || !*optarg || *end || ms > ULONG_MAX / 1000) {
+                        elog("ERROR: Invalid wait (ms): %s\n", optarg);
+                        ret = exit_param;
+                        continue;
+                    }
+
+                    _lock_wait_us = ms * 1000;
+                    continue;
+                }
+
+                if (strcmp(long_options[option_index].name, "deadline") == 0) {
+                    char *end = NULL;
+                    unsigned long ms;
+
+                    errno = 0;
+                    ms = strtoul(optarg, &end, 10);
+                    if (errno || !*optarg || *end || !ms || ms > ULONG_MAX / 1000 - start / 1000) {
+                        elog("ERROR: Invalid deadline (ms): %s\n", optarg);
+                        ret = exit_param;
+                        continue;
+                    }
+
+                    _deadline = start + ms * 1000;
+                    continue;
+                }
+
+                if (strcmp(long_options[option_index].name, "metrics") == 0) {
+                    _metrics_path = optarg;
+                    continue;
+                }
+
+                if (strcmp(long_options[option_index].name, "snapshot") == 0) {
+                    if (!plan_add(&_plan, plan_snapshot, mode_COUNT, optarg)) ret = exit_param;
+                    edit = NULL;
+                    continue;
+                }
+
+                if (strcmp(long_options[option_index].name, "on-udev") == 0) {
+                    int r;
+
+                    if (file || _replay_path || plan_uses_mouse(&_plan)) {
+                        elog("ERROR: --on-udev can't be combined with other mouse or profile options\n");
+                        ret = exit_param;
+                        continue;
+                    }
+
+                    r = udev_device(&_udev_loc);
+                    if (r < 0) {
+                        elog("ERROR: --on-udev needs to be run by udev (DEVPATH/PRODUCT not set)\n");
+                        ret = exit_param;
+                        continue;
+                    }
+
+                    // Not a mouse we know, or not being plugged in: nothing to
+                    // do (and nothing wrong)
+                    if (r == 0) {
+                        log_end();
+                        return exit_none;
+                    }
+
+                    _udev = 1;
+                }
+
+                if (strcmp(long_options[option_index].name, "restore") == 0
+                 || strcmp(long_options[option_index].name, "on-udev") == 0) {
+                    char err[256];
+                    t_plan_step *step;
+                    t_profile rest;
+                    t_mode mnew;
+
+                    edit = NULL;
+
+                    // Check the whole profile before touching the mouse
+                    if (profile_in(&rest, optarg) < 0) {
+                        ret = exit_profile;
+                        continue;
+                    }
+
+                    for (mnew = 0; mnew < mode_COUNT; ++mnew) {
+                        if (!(rest.present & (1 << mnew))) continue;
+
+                        if (!mode_validate(&rest.mode_data[mnew][0], &err[0], sizeof(err))) {
+                            elog("ERROR: Invalid mode %s in profile %s: %s\n", s_mode[mnew], optarg, err);
+                            ret = exit_profile;
+                            break;
+                        }
+                    }
+                    if (ret) continue;
+
+                    if (!(step = plan_add(&_plan, plan_restore, mode_COUNT, optarg))) {
+                        ret = exit_param;
+                        continue;
+                    }
+
+                    step->profile = rest;
+                    continue;
+                }
             }
 
             break;
@@ -1779,8 +3151,13 @@ int main (int argc, char *argv[]) {
                 printf("?? getopt returned character code 0%o ??\n", c);
                 ret = exit_param;
         } // switch (c)
+
+        // A setting (checked above), for the mode being modified
+        if (c && edit && strchr("rABCDFSUc123456789", c) && !plan_add_set(edit, c, optarg)) ret = exit_param;
     } // while (1)
 
+    _mode_verbose = mode_verbose;
+
     if (ret == exit_none && optind < argc) {
         char optout[255]
              ,*po = &optout[0];
@@ -1793,15 +3170,58 @@ int main (int argc, char *argv[]) {
         ret = exit_param;
     }
 
-    if (mode != mode_COUNT) {
-        // They've been editing another mode, so save
-        printf("Saving Mode: %s\n", s_mode[mode]);
-        mode_save(&mode_data_s[0], _usb_dev_handle, mode);
-        mode = mode_COUNT;
+    // Options after --on-udev, as well as before
+    if (ret == exit_none && _udev && (file || _replay_path || _daemon || _plan.nsteps != 1)) {
+        elog("ERROR: --on-udev can't be combined with other mouse or profile options\n");
+        ret = exit_param;
+    }
+
+    if (ret == exit_none && _watch_path && !_daemon) {
+        elog("ERROR: --watch needs --daemon\n");
+        ret = exit_param;
+    }
+
+    if (ret == exit_none && _dry_run && _daemon) {
+        elog("ERROR: --dry-run can't be combined with --daemon\n");
+        ret = exit_param;
+    }
+
+    if (ret == exit_none) {
+        int dropped = plan_optimise(&_plan);
+
+        if (dropped) dlog(LOG_PARSE, "Plan optimised: %d steps dropped, %d left\n", dropped, _plan.nsteps);
+
+        // Read-only (as is any dry run), so fine to share another process's
+        // session
+        if ((plan_read_only(&_plan) || _dry_run) && !_daemon && !_record_path) _share_modes = plan_reads(&_plan, 0, _plan.nsteps);
+
+        ret = plan_run(&_plan);
+    }
+
+    if (_profile_dirty) {
+        printf("Writing Profile: %s\n", _profile_path);
+        if (profile_out(&_profile, _profile_path) < 0 && ret == exit_none) ret = exit_profile;
+        _profile_dirty = 0;
     }
 
+    if (_daemon && ret == exit_none) ret = mouse_daemon();
+
     // Re-attach kernel driver, de-initialise mouse and USB (if necessary)
-    mouse_unprime();
+    {
+        t_exit uret = mouse_unprime();
+
+        // A replay going differently explains whatever else went wrong
+        if (ret == exit_none || uret == exit_replay) ret = uret;
+    }
+
+    // Whatever failed, it's because we ran out of time
+    if (_deadline_missed >= 0) {
+        ret = _deadline_missed < cmd_COUNT ? exit_deadline_change_mode + _deadline_missed : exit_deadline;
+    }
+
+    if (_metrics_path && metrics_write(_metrics_path, s_cmd, cmd_COUNT) < 0 && ret == exit_none) ret = exit_param;
+
+    store_close();
 
     log_end();
 
@@ -0,0 +1,238 @@
+/* vim:set ts=4 sw=4 tw=80 et cindent ai si cino=(0,ml,\:0:
+ * ( settings from: http://datapax.com.au/code_conventions/ )
+ */
+
+/**********************************************************************
+    RatSlap
+    Copyright (C) 2016-2020 Todd Harbour
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    version 2 ONLY, as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program, in the file COPYING or COPYING.txt; if
+    not, see http://www.gnu.org/licenses/ , or write to:
+      The Free Software Foundation, Inc.,
+      51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "log.h"
+#include "metrics.h"
+
+t_metrics _metrics;
+
+// Upper bounds of the latency buckets (microseconds). Control transfers take
+// anywhere from ~1ms (reads) to several hundred (writes, retries), remapping
+// input should take well under the 1ms between reports
+const unsigned long metrics_bucket_us[METRICS_BUCKETS] = {
+        10,     25,     50,    100,    250,    500,   1000,   2500
+    ,  5000,  10000,  25000,  50000, 100000, 250000, 500000, 1000000
+};
+
+
+
+unsigned long metrics_now_us(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (unsigned long)ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+void metrics_observe(t_metrics_hist *hist, const unsigned long us) {
+    unsigned long max = METRIC_GET(hist->max_us);
+    int b;
+
+    for (b = 0; b < METRICS_BUCKETS && us > metrics_bucket_us[b]; ++b);
+
+    METRIC_INC(hist->bucket[b]);
+    METRIC_ADD(hist->sum_us, us);
+    METRIC_INC(hist->count);
+
+    while (us > max && !__atomic_compare_exchange_n(&hist->max_us, &max, us, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+static void format_counter(FILE *strm, const char *name, const char *help, const unsigned long val) {
+    fprintf(strm, "# HELP %s %s\n", name, help);
+    fprintf(strm, "# TYPE %s counter\n", name);
+    fprintf(strm, "%s %lu\n", name, val);
+}
+
+// Per command counter, 'off' is the offset of the counter in t_metrics_cmd
+static void format_cmd_counter(FILE *strm, const char *name, const char *help, const size_t off, const char **cmd_names, const int ncmds) {
+    int c;
+
+    fprintf(strm, "# HELP %s %s\n", name, help);
+    fprintf(strm, "# TYPE %s counter\n", name);
+
+    for (c = 0; c < ncmds; ++c) {
+        unsigned long *cnt = (unsigned long *)((char *)&_metrics.cmd[c] + off);
+
+        fprintf(strm, "%s{command=\"%s\"} %lu\n", name, cmd_names[c], METRIC_GET(*cnt));
+    }
+}
+
+// Histogram samples, 'label' is either empty or a label (eg. command="x")
+static void format_hist(FILE *strm, const char *name, const char *label, const t_metrics_hist *hist) {
+    const char *sep = label[0] ? "," : "";
+    unsigned long cum = 0;
+    int b;
+
+    for (b = 0; b < METRICS_BUCKETS; ++b) {
+        cum += METRIC_GET(hist->bucket[b]);
+        fprintf(strm, "%s_bucket{%s%sle=\"%g\"} %lu\n", name, label, sep, metrics_bucket_us[b] / 1e6, cum);
+    }
+    cum += METRIC_GET(hist->bucket[METRICS_BUCKETS]);
+
+    fprintf(strm, "%s_bucket{%s%sle=\"+Inf\"} %lu\n", name, label, sep, cum);
+
+    if (label[0]) {
+        fprintf(strm, "%s_sum{%s} %.6f\n", name, label, METRIC_GET(hist->sum_us) / 1e6);
+        fprintf(strm, "%s_count{%s} %lu\n", name, label, METRIC_GET(hist->count));
+    } else {
+        fprintf(strm, "%s_sum %.6f\n", name, METRIC_GET(hist->sum_us) / 1e6);
+        fprintf(strm, "%s_count %lu\n", name, METRIC_GET(hist->count));
+    }
+}
+
+// Writes all metrics in the Prometheus text exposition format. Returns 0 on
+// success, -1 on error
+int metrics_format(FILE *strm, const char **cmd_names, const int ncmds) {
+    const char *hname = "ratslap_transfer_duration_seconds";
+    int c;
+
+    if (!strm || !cmd_names || ncmds > METRICS_CMD_MAX) return -1;
+
+    format_cmd_counter(strm, "ratslap_transfers_total"
+        ,"USB control transfers attempted, including retries."
+        ,offsetof(t_metrics_cmd, transfers), cmd_names, ncmds);
+    format_cmd_counter(strm, "ratslap_transfer_retries_total"
+        ,"USB control transfers retried after a transient error."
+        ,offsetof(t_metrics_cmd, retries), cmd_names, ncmds);
+    format_cmd_counter(strm, "ratslap_transfer_failures_total"
+        ,"USB control transfers that failed after all retries."
+        ,offsetof(t_metrics_cmd, failures), cmd_names, ncmds);
+    format_cmd_counter(strm, "ratslap_device_resets_total"
+        ,"Device resets issued to recover a failing transfer."
+        ,offsetof(t_metrics_cmd, resets), cmd_names, ncmds);
+
+    fprintf(strm, "# HELP %s Time taken by USB control transfers, including retries.\n", hname);
+    fprintf(strm, "# TYPE %s histogram\n", hname);
+
+    for (c = 0; c < ncmds; ++c) {
+        char label[64];
+
+        snprintf(&label[0], sizeof(label), "command=\"%s\"", cmd_names[c]);
+        format_hist(strm, hname, &label[0], &_metrics.cmd[c].latency);
+    }
+
+    format_counter(strm, "ratslap_kernel_detach_total"
+        ,"Kernel driver detach (and interface claim) cycles."
+        ,METRIC_GET(_metrics.detach));
+    format_counter(strm, "ratslap_kernel_attach_total"
+        ,"Kernel driver (interface release and) attach cycles."
+        ,METRIC_GET(_metrics.attach));
+    format_counter(strm, "ratslap_verify_mismatches_total"
+        ,"Saved modes that read back differently to what was written."
+        ,METRIC_GET(_metrics.verify_mismatches));
+
+    fprintf(strm, "# HELP ratslap_startup_seconds Time from starting to having the mouse open and claimed.\n");
+    fprintf(strm, "# TYPE ratslap_startup_seconds gauge\n");
+    fprintf(strm, "ratslap_startup_seconds %.6f\n", METRIC_GET(_metrics.startup_us) / 1e6);
+
+    fprintf(strm, "# HELP ratslap_lock_wait_seconds Time spent waiting for other processes using the mouse.\n");
+    fprintf(strm, "# TYPE ratslap_lock_wait_seconds histogram\n");
+    format_hist(strm, "ratslap_lock_wait_seconds", "", &_metrics.lock_wait);
+
+    format_counter(strm, "ratslap_remap_reports_total"
+        ,"Input reports read by the remap layer."
+        ,METRIC_GET(_metrics.remap_reports));
+    format_counter(strm, "ratslap_remap_events_total"
+        ,"Input events emitted by the remap layer."
+        ,METRIC_GET(_metrics.remap_events));
+
+    fprintf(strm, "# HELP ratslap_remap_latency_seconds Time from reading an input report to emitting its events.\n");
+    fprintf(strm, "# TYPE ratslap_remap_latency_seconds histogram\n");
+    format_hist(strm, "ratslap_remap_latency_seconds", "", &_metrics.remap_latency);
+
+    format_counter(strm, "ratslap_mode_switches_total"
+        ,"Mode switches made on the mouse, seen by the daemon."
+        ,METRIC_GET(_metrics.mode_switches));
+    format_counter(strm, "ratslap_probes_total"
+        ,"Modes read back by the health probe."
+        ,METRIC_GET(_metrics.probes));
+    format_counter(strm, "ratslap_probe_mismatches_total"
+        ,"Modes the health probe found changed on the mouse."
+        ,METRIC_GET(_metrics.probe_mismatches));
+    format_counter(strm, "ratslap_probe_reapplies_total"
+        ,"Changed modes the health probe wrote back."
+        ,METRIC_GET(_metrics.probe_reapplies));
+    format_counter(strm, "ratslap_probe_deferred_total"
+        ,"Health probes put off for being over budget."
+        ,METRIC_GET(_metrics.probe_deferred));
+    format_counter(strm, "ratslap_macros_total"
+        ,"Remap macros played in full."
+        ,METRIC_GET(_metrics.macros));
+    format_counter(strm, "ratslap_macro_dropped_total"
+        ,"Remap macros not played, with too many already playing."
+        ,METRIC_GET(_metrics.macro_dropped));
+
+    fprintf(strm, "# HELP ratslap_macro_jitter_seconds How late each macro step was sent, compared with when it was due.\n");
+    fprintf(strm, "# TYPE ratslap_macro_jitter_seconds histogram\n");
+    format_hist(strm, "ratslap_macro_jitter_seconds", "", &_metrics.macro_jitter);
+
+    format_counter(strm, "ratslap_writes_coalesced_total"
+        ,"Mode saves avoided by gathering edits to the watched profile."
+        ,METRIC_GET(_metrics.writes_coalesced));
+
+    return ferror(strm) ? -1 : 0;
+}
+
+// Writes via a temporary file so a scraper (eg. node_exporter's textfile
+// collector) never sees a partial file. Returns 0 on success, -1 on error
+int metrics_write(const char *path, const char **cmd_names, const int ncmds) {
+    char tmppath[4096];
+    FILE *fp;
+    int ret;
+
+    if (!path) return -1;
+
+    if (snprintf(&tmppath[0], sizeof(tmppath), "%s.tmp", path) >= sizeof(tmppath)) {
+        elog("ERROR: Metrics path too long: %s\n", path);
+        return -1;
+    }
+
+    fp = fopen(&tmppath[0], "w");
+    if (!fp) {
+        elog("ERROR: Failed to create metrics file %s: %s\n", &tmppath[0], strerror(errno));
+        return -1;
+    }
+
+    ret = metrics_format(fp, cmd_names, ncmds);
+
+    if (fclose(fp) != 0 || ret != 0) {
+        elog("ERROR: Failed to write metrics file %s\n", &tmppath[0]);
+        remove(&tmppath[0]);
+        return -1;
+    }
+
+    if (rename(&tmppath[0], path) != 0) {
+        elog("ERROR: Failed to replace metrics file %s: %s\n", path, strerror(errno));
+        remove(&tmppath[0]);
+        return -1;
+    }
+
+    return 0;
+}
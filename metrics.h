@@ -0,0 +1,82 @@
+/* vim:set ts=4 sw=4 tw=80 et cindent ai si cino=(0,ml,\:0:
+ * ( settings from: http://datapax.com.au/code_conventions/ )
+ */
+
+/**********************************************************************
+    RatSlap
+    Copyright (C) 2016-2020 Todd Harbour
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    version 2 ONLY, as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program, in the file COPYING or COPYING.txt; if
+    not, see http://www.gnu.org/licenses/ , or write to:
+      The Free Software Foundation, Inc.,
+      51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ **********************************************************************/
+
+#ifndef   METRICS_H
+#define   METRICS_H
+
+#include <stdio.h>
+
+// Counters are only ever touched with relaxed atomics, so recording costs the
+// same as a plain increment and is safe from any thread (or signal handler).
+#define METRIC_INC(CNT)      __atomic_fetch_add(&(CNT), 1, __ATOMIC_RELAXED)
+#define METRIC_ADD(CNT, VAL) __atomic_fetch_add(&(CNT), (VAL), __ATOMIC_RELAXED)
+#define METRIC_GET(CNT)      __atomic_load_n(&(CNT), __ATOMIC_RELAXED)
+
+#define METRICS_CMD_MAX  8  // Command types that can be tracked
+#define METRICS_BUCKETS 16  // Latency histogram buckets (excluding +Inf)
+
+typedef struct s_metrics_hist {
+    unsigned long count;
+    unsigned long sum_us;
+    unsigned long max_us;
+    unsigned long bucket[METRICS_BUCKETS + 1]; // NOT cumulative, last is +Inf
+} t_metrics_hist;
+
+typedef struct s_metrics_cmd {
+    unsigned long  transfers; // Attempts, including retries
+    unsigned long  retries;
+    unsigned long  failures;
+    unsigned long  resets;
+    t_metrics_hist latency;   // Per call, including any retries
+} t_metrics_cmd;
+
+typedef struct s_metrics {
+    t_metrics_cmd cmd[METRICS_CMD_MAX];
+    unsigned long detach;            // Kernel driver detach/claim cycles
+    unsigned long attach;            // Kernel driver release/attach cycles
+    unsigned long verify_mismatches; // Saved mode read back differently
+    unsigned long startup_us;        // Start to mouse open and claimed
+    t_metrics_hist lock_wait;        // Waiting for other processes' sessions
+    unsigned long  remap_reports;    // Input reports read (--daemon)
+    unsigned long  remap_events;     // Input events emitted
+    t_metrics_hist remap_latency;    // Report read to events emitted
+    unsigned long  mode_switches;    // Made on the mouse (--daemon)
+    unsigned long  probes;           // Modes read back by --probe
+    unsigned long  probe_mismatches; // ... that weren't as expected
+    unsigned long  probe_reapplies;  // ... and were written back
+    unsigned long  probe_deferred;   // Probes put off, over --probe-budget
+    unsigned long  macros;           // Remap macros played in full
+    unsigned long  macro_dropped;    // ... not played, too many at once
+    t_metrics_hist macro_jitter;     // Macro steps sent later than due
+    unsigned long  writes_coalesced; // Mode saves made unnecessary by a later edit (--debounce)
+} t_metrics;
+
+extern t_metrics _metrics;
+
+unsigned long metrics_now_us(void);
+void metrics_observe(t_metrics_hist *hist, const unsigned long us);
+int metrics_format(FILE *strm, const char **cmd_names, const int ncmds);
+int metrics_write(const char *path, const char **cmd_names, const int ncmds);
+
+#endif /* METRICS_H */
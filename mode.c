@@ -0,0 +1,826 @@
+/* vim:set ts=4 sw=4 tw=80 et cindent ai si cino=(0,ml,\:0:
+ * ( settings from: http://datapax.com.au/code_conventions/ )
+ */
+
+/**********************************************************************
+    RatSlap
+    Copyright (C) 2016-2020 Todd Harbour
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    version 2 ONLY, as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program, in the file COPYING or COPYING.txt; if
+    not, see http://www.gnu.org/licenses/ , or write to:
+      The Free Software Foundation, Inc.,
+      51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ **********************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#include "log.h"
+#include "mode.h"
+#include "model.h"
+
+#define mprintf(args...) do { if (_mode_verbose) printf(args); } while (0)
+
+const char *s_mode[] = {
+     "F3"
+    ,"F4"
+    ,"F5"
+    ,"INVALID"
+};
+
+const char *s_colour[] = {
+     "black"
+    ,"red"
+    ,"green"
+    ,"yellow"
+    ,"blue"
+    ,"magenta"
+    ,"cyan"
+    ,"white"
+    ,"INVALID"
+};
+
+const char *s_buttons[] = {
+     "NONE"
+    ,"Button1"
+    ,"Button2"
+    ,"Button3"
+    ,"Button6"
+    ,"Button7"
+    ,"Button8"
+    ,"Button9"
+    ,"Button10"
+    ,"Button11"
+    ,"DPIUp"
+    ,"DPIDown"
+    ,"DPICycle"
+    ,"ModeSwitch"
+    ,"DPIShift"
+    ,"DPIDefault"
+};
+
+// Turns out these are likely HID standard codes!
+// ( https://www.usb.org/sites/default/files/documents/hut1_12v2.pdf )
+const char *s_keys[] = {
+     "NONE"
+    ,"UNKNOWN:01" // 01 ==   1 // "HID: Keyboard Err: Rollover - not a key
+    ,"UNKNOWN:02" // 02 ==   2 // "HID: Keyboard Err: POST Fail - not a key
+    ,"UNKNOWN:03" // 03 ==   3 // "HID: Keyboard Err: Undefined - not a key
+    ,"A"          // 04 ==   4
+    ,"B"
+    ,"C"
+    ,"D"
+    ,"E"
+    ,"F"
+    ,"G"
+    ,"H"
+    ,"I"
+    ,"J"
+    ,"K"
+    ,"L"
+    ,"M"
+    ,"N"
+    ,"O"
+    ,"P"
+    ,"Q"
+    ,"R"
+    ,"S"
+    ,"T"
+    ,"U"
+    ,"V"
+    ,"W"
+    ,"X"
+    ,"Y"
+    ,"Z"          // 1D ==  29
+    ,"1"          // 1E ==  30
+    ,"2"
+    ,"3"
+    ,"4"
+    ,"5"
+    ,"6"
+    ,"7"
+    ,"8"
+    ,"9"
+    ,"0"           // 27 ==  39
+    ,"Enter"       // 28 ==  40
+    ,"Escape"      // 29 ==  41
+    ,"Backspace"   // 2a ==  42
+    ,"Tab"         // 2b ==  43
+    ,"Space"       // 2c ==  44
+    ,"-"           // 2d ==  45
+    ,"="           // 2e ==  46
+    ,"["           // 2f ==  47
+    ,"]"           // 30 ==  48
+    ,"\\"          // 31 ==  49
+    ,"NonUS#"      // 32 ==  50
+    ,";"           // 33 ==  51
+    ,"'"           // 34 ==  52
+    ,"`"           // 35 ==  53
+    ,","           // 36 ==  54
+    ,"."           // 37 ==  55
+    ,"/"           // 38 ==  56
+    ,"CapsLock"    // 39 ==  57
+    ,"F1"          // 3a ==  58
+    ,"F2"          // 3b ==  59
+    ,"F3"          // 3c ==  60
+    ,"F4"          // 3d ==  61
+    ,"F5"          // 3e ==  62
+    ,"F6"          // 3f ==  63
+    ,"F7"          // 40 ==  64
+    ,"F8"          // 41 ==  65
+    ,"F9"          // 42 ==  66
+    ,"F10"         // 43 ==  67
+    ,"F11"         // 44 ==  68
+    ,"F12"         // 45 ==  69
+    ,"PrintScreen" // 46 ==  70
+    ,"ScrollLock"  // 47 ==  71
+    ,"Pause"       // 48 ==  72
+    ,"Insert"      // 49 ==  73
+    ,"Home"        // 4a ==  74
+    ,"PageUp"      // 4b ==  75
+    ,"Delete"      // 4c ==  76
+    ,"End"         // 4d ==  77
+    ,"PageDown"    // 4e ==  78
+    ,"Right"       // 4f ==  79
+    ,"Left"        // 50 ==  80
+    ,"Down"        // 51 ==  81
+    ,"Up"          // 52 ==  82
+    ,"NumLock"     // 53 ==  83
+    ,"Num/"        // 54 ==  84
+    ,"Num*"        // 55 ==  85
+    ,"Num-"        // 56 ==  86
+    ,"Num+"        // 57 ==  87
+    ,"NumEnter"    // 58 ==  88
+    ,"Num1"        // 59 ==  89
+    ,"Num2"        // 5a ==  90
+    ,"Num3"        // 5b ==  91
+    ,"Num4"        // 5c ==  92
+    ,"Num5"        // 5d ==  93
+    ,"Num6"        // 5e ==  94
+    ,"Num7"        // 5f ==  95
+    ,"Num8"        // 60 ==  96
+    ,"Num9"        // 61 ==  97
+    ,"Num0"        // 62 ==  98
+    ,"Num."        // 63 ==  99
+    ,"NonUS\\"     // 64 == 100
+    ,"Application" // 65 == 101
+    ,"Power"       // 66 == 102
+    ,"Num="        // 67 == 103
+    ,"F13"         // 68 == 104
+    ,"F14"         // 69 == 105
+    ,"F15"         // 6a == 106
+    ,"F16"         // 6b == 107
+    ,"F17"         // 6c == 108
+    ,"F18"         // 6d == 109
+    ,"F19"         // 6e == 110
+    ,"F20"         // 6f == 111
+    ,"F21"         // 70 == 112
+    ,"F22"         // 71 == 113
+    ,"F23"         // 72 == 114
+    ,"F24"         // 73 == 115
+    ,"Execute"     // 74 == 116
+    ,"Help"        // 75 == 117
+    ,"Menu"        // 76 == 118
+    ,"Select"      // 77 == 119
+    ,"Stop"        // 78 == 120
+    ,"Again"       // 79 == 121
+    ,"Undo"        // 7a == 122
+    ,"Cut"         // 7b == 123
+    ,"Copy"        // 7c == 124
+    ,"Paste"       // 7d == 125
+    ,"Find"        // 7e == 126
+    ,"Mute"        // 7f == 127
+    ,"VolumeUp"    // 80 == 128
+    ,"VolumeDown"  // 81 == 129
+    ,"UNKNOWN:82"  // 82 == 130 // Locking CapsLock but legacy so not defining
+    ,"UNKNOWN:83"  // 83 == 131 // Locking CapsLock but legacy so not defining
+    ,"UNKNOWN:84"  // 84 == 132 // Locking CapsLock but legacy so not defining
+    ,"Num,"        // 85 == 133 // Brazillian keypad period (.)?
+    ,"AS400Num="   // 86 == 134 // Keypad Equal Sign on AS/400 keyboards
+    ,"UNKNOWN:87"  // 87 == 135 // International 1?
+    ,"UNKNOWN:88"  // 88 == 136 // International 2?
+    ,"UNKNOWN:89"  // 89 == 137 // International 3?
+    ,"UNKNOWN:8a"  // 8a == 138 // International 4?
+    ,"UNKNOWN:8b"  // 8b == 139 // International 5?
+    ,"UNKNOWN:8c"  // 8c == 140 // International 6?
+    ,"UNKNOWN:8d"  // 8d == 141 // International 7?
+    ,"UNKNOWN:8e"  // 8e == 142 // International 8?
+    ,"UNKNOWN:8f"  // 8f == 143 // International 9?
+    ,"UNKNOWN:90"  // 90 == 144 // LANG1 - Hangul/English toggle - Korean?
+    ,"UNKNOWN:91"  // 91 == 145 // LANG2 - Hanja conversion key - Korean?
+    ,"UNKNOWN:92"  // 92 == 146 // LANG3 - Katakana key - Japanese?
+    ,"UNKNOWN:93"  // 93 == 147 // LANG4 - Hiragana key - Japanese?
+    ,"UNKNOWN:94"  // 94 == 148 // LANG5 - Zenkaku/Hankaku key - Japanese?
+    ,"UNKNOWN:95"  // 95 == 149 // LANG6 - Reserved?
+    ,"UNKNOWN:96"  // 96 == 150 // LANG7 - Reserved?
+    ,"UNKNOWN:97"  // 97 == 151 // LANG8 - Reserved?
+    ,"UNKNOWN:98"  // 98 == 152 // LANG9 - Reserved?
+    ,"UNKNOWN:99"  // 99 == 153 // Alternate Erase (Erase-Eaze(tm))?
+    ,"SysReq"      // 9a == 154 // SysReq/Attention
+    ,"Cancel"      // 9b == 155
+    ,"Clear"       // 9c == 156
+    ,"Prior"       // 9d == 157
+    ,"Return"      // 9e == 158
+    ,"Separator"   // 9f == 159
+    ,"Out"         // a0 == 160
+    ,"Oper"        // a1 == 161
+    ,"ClearAgain"  // a2 == 162
+    ,"CrSelProps"  // a3 == 163
+    ,"ExSel"       // a4 == 164
+    ,"UNKNOWN:a5"  // a5 == 165 // Reserved
+    ,"UNKNOWN:a6"  // a6 == 166 // Reserved
+    ,"UNKNOWN:a7"  // a7 == 167 // Reserved
+    ,"UNKNOWN:a8"  // a8 == 168 // Reserved
+    ,"UNKNOWN:a9"  // a9 == 169 // Reserved
+    ,"UNKNOWN:aa"  // aa == 170 // Reserved
+    ,"UNKNOWN:ab"  // ab == 171 // Reserved
+    ,"UNKNOWN:ac"  // ac == 172 // Reserved
+    ,"UNKNOWN:ad"  // ad == 173 // Reserved
+    ,"UNKNOWN:ae"  // ae == 174 // Reserved
+    ,"UNKNOWN:af"  // af == 175 // Reserved
+    ,"Num00"       // b0 == 176
+    ,"Num000"      // b1 == 177
+    ,"Sep1000s"    // b2 == 178 // Thousands separator - locale specific?
+    ,"SepDec"      // b3 == 179 // Decimal   separator - locale specific?
+    ,"CurrUnit"    // b4 == 180 // Currency Unit       - locale specific?
+    ,"CurrSubUnit" // b5 == 181 // Currency Sub-Unit   - locale specific?
+    ,"Num("        // b6 == 182
+    ,"Num)"        // b7 == 183
+    ,"Num{"        // b8 == 184
+    ,"Num}"        // b9 == 185
+    ,"NumTab"      // ba == 186
+    ,"NumBackspace"// bb == 187
+    ,"NumA"        // bc == 188
+    ,"NumB"        // bd == 189
+    ,"NumC"        // be == 190
+    ,"NumD"        // bf == 191
+    ,"NumE"        // c0 == 192
+    ,"NumF"        // c1 == 193
+    ,"NumXOR"      // c2 == 194
+    ,"Num^"        // c3 == 195
+    ,"Num%"        // c4 == 196
+    ,"Num<"        // c5 == 197
+    ,"Num>"        // c6 == 198
+    ,"Num&"        // c7 == 199
+    ,"Num&&"       // c8 == 200
+    ,"Num|"        // c9 == 201
+    ,"Num||"       // ca == 202
+    ,"Num:"        // cb == 203
+    ,"Num#"        // cc == 204
+    ,"NumSpace"    // cd == 205
+    ,"Num@"        // ce == 206
+    ,"Num!"        // cf == 207
+    ,"NumMemStore" // d0 == 208
+    ,"NumMemRecall"// d1 == 209
+    ,"NumMemClear" // d2 == 210
+    ,"NumMemAdd"   // d3 == 211
+    ,"NumMemSub"   // d4 == 212
+    ,"NumMemMul"   // d5 == 213
+    ,"NumMemDiv"   // d6 == 214
+    ,"NumPlusMinus"// d7 == 215
+    ,"NumClear"    // d8 == 216
+    ,"NumClearEntry"// d9 == 217
+    ,"NumBinary"   // da == 218
+    ,"NumOctal"    // db == 219
+    ,"NumDecimal"  // dc == 220
+    ,"NumHex"      // dd == 221
+    ,"UNKNOWN:de"  // de == 222 // Reserved
+    ,"UNKNOWN:df"  // df == 223 // Reserved
+    ,"LeftCtrl"    // e0 == 224
+    ,"LeftShift"   // e1 == 225
+    ,"LeftAlt"     // e2 == 226
+    ,"Super_L"     // e3 == 227 // Left GUI
+    ,"RightCtrl"   // e4 == 228
+    ,"RightShift"  // e5 == 229
+    ,"RightAlt"    // e6 == 230
+    ,"Super_R"     // e7 == 231 // Right GUI
+    ,"UNKNOWN:e8"  // e8 == 232 // Reserved
+    ,"UNKNOWN:e9"  // e9 == 233 // Reserved
+    ,"UNKNOWN:ea"  // ea == 234 // Reserved
+    ,"UNKNOWN:eb"  // eb == 235 // Reserved
+    ,"UNKNOWN:ec"  // ec == 236 // Reserved
+    ,"UNKNOWN:ed"  // ed == 237 // Reserved
+    ,"UNKNOWN:ee"  // ee == 238 // Reserved
+    ,"UNKNOWN:ef"  // ef == 239 // Reserved
+    ,"UNKNOWN:f0"  // f0 == 240 // Reserved
+    ,"UNKNOWN:f1"  // f1 == 241 // Reserved
+    ,"UNKNOWN:f2"  // f2 == 242 // Reserved
+    ,"UNKNOWN:f3"  // f3 == 243 // Reserved
+    ,"UNKNOWN:f4"  // f4 == 244 // Reserved
+    ,"UNKNOWN:f5"  // f5 == 245 // Reserved
+    ,"UNKNOWN:f6"  // f6 == 246 // Reserved
+    ,"UNKNOWN:f7"  // f7 == 247 // Reserved
+    ,"UNKNOWN:f8"  // f8 == 248 // Reserved
+    ,"UNKNOWN:f9"  // f9 == 249 // Reserved
+    ,"UNKNOWN:fa"  // fa == 250 // Reserved
+    ,"UNKNOWN:fb"  // fb == 251 // Reserved
+    ,"UNKNOWN:fc"  // fc == 252 // Reserved
+    ,"UNKNOWN:fd"  // fd == 253 // Reserved
+    ,"UNKNOWN:fe"  // fe == 254 // Reserved
+                   // ff = 255  // Reserved (and even if it weren't, it's not
+                   //              used in the loops :P)
+};
+
+int _mode_verbose = 1;
+
+
+
+int dpi_point(int dpip) {
+    return (!dpip) ? _model->dpi_max : dpip * _model->dpi_step;
+}
+
+// The DPI value closest to (but not over) dpi
+static int dpi_value(const int dpi) {
+    return dpi >= _model->dpi_max ? 0 : (dpi / _model->dpi_step) & _model->dpi_mask;
+}
+
+// Renders a button's assignment (3 bytes: button, modifiers, key) the way
+// mode_print displays it, eg. "LeftCtrl + LeftShift + Tab"
+int mode_button_str(char *out, const size_t outlen, const unsigned char *but) {
+    size_t o = 0;
+
+    if (!out || !outlen || !but) return 0;
+
+    out[0] = '\0';
+
+    // Modifiers (but[1])
+    // 0xe0 - 0xe7 match modifiers 0x01, 0x02, 0x04 ... 0x80
+    {
+        unsigned char ky = 0xe0;
+        int m = 0x00;
+        for (m = 0x01; m <= 0x80; m *= 2) {
+            if (but[1] & m && o < outlen) o += snprintf(&out[o], outlen - o, "%s + ", s_keys[ky]);
+            ++ky;
+        }
+    }
+
+    // Buttons   (but[0])
+    if (but[0] & 0x0f && o < outlen) {
+        o += snprintf(&out[o], outlen - o, "%s", s_buttons[but[0] & 0x0f]);
+
+        if (but[2] > 0 && o < outlen) o += snprintf(&out[o], outlen - o, " + ");
+    }
+
+    // Keys      (but[2])
+    if (but[2] > 0 && o < outlen) o += snprintf(&out[o], outlen - o, "%s", but[2] < 0xff ? s_keys[but[2]] : "UNKNOWN:ff");
+
+    return o < outlen ? o : outlen - 1;
+}
+
+int mode_print(FILE *strm, const unsigned char *mode_data, int len) {
+    const t_model *m = _model;
+    unsigned char bit = 0;
+    char butout[128];
+    char label[32];
+    int i = 0;
+    int x = 0;
+
+    char rawout[255]
+         ,*po = &rawout[0];
+
+    if (!strm || !mode_data || len < m->mode_len) return 0;
+
+    for (i = 0; i < m->mode_len; ++i) {
+        sprintf(po, "%.2x", (mode_data)[i]);
+        po += strlen(po);
+        if ((i+1) % 4 == 0) sprintf(po, " ");
+        po += strlen(po);
+    }
+    dlog(LOG_PARSE, "RAW: %s\n", rawout);
+
+    // F5040302 84060844 01000002 00000300 00040000 05000006 00000700 00080000 090000
+    //   ^^
+    bit = (mode_data)[m->off_colour];
+    fprintf(strm, "  Colour:              %s\n", s_colour[bit < colour_COUNT ? bit : colour_COUNT]);
+
+    // F5040302 84060844 01000002 00000300 00040000 05000006 00000700 00080000 090000
+    //     ^^
+    bit = (mode_data)[m->off_rate];
+    fprintf(strm, "  Report Rate:         %4d\n",
+        bit < m->n_rates
+        ? m->rates[bit]
+        : -1
+    );
+
+    // F5040302 84060844 01000002 00000300 00040000 05000006 00000700 00080000 090000
+    //       ^^ ^^^^^^
+
+    for (x = 1; x <= m->n_dpi; ++x) {
+        bit = (mode_data)[m->off_dpi + x - 1];
+        fprintf(strm, "  DPI #%d:        %s %4d\n",
+             x
+            ,bit & m->dpi_default ? "(DEF)" : "     "
+            ,dpi_point(bit & m->dpi_mask)
+            );
+    }
+
+    // F5040302 84060844 01000002 00000300 00040000 05000006 00000700 00080000 090000
+    //                ^^
+
+    bit = (mode_data)[m->off_dpishift];
+    fprintf(strm, "  DPI Shift:           ");
+    fprintf(strm, "%d", dpi_point(bit & m->dpi_mask));
+    if (bit & m->dpishift_disabled) fprintf(strm, " [DISABLED]");
+    fprintf(strm, "\n");
+
+    // F5040302 84060844 01000002 00000300 00040000 05000006 00000700 00080000 090000
+    //                   ^^
+
+    for (x = 1; x <= m->n_buttons; ++x) {
+        mode_button_str(&butout[0], sizeof(butout), &(mode_data)[m->off_buttons[x]]);
+
+        snprintf(&label[0], sizeof(label), "%s:", m->button_names[x]);
+        fprintf(strm, "  %-21s%s\n", &label[0], butout);
+    }
+
+    return 1;
+}
+
+// Renders field f of mode_data (0: colour, 1: report rate, then the DPI
+// levels, DPI shift and buttons, in the order mode_print displays them) as its
+// label and value. Returns 0 if there's no such field.
+static int mode_field(char *label, char *value, const size_t len, const unsigned char *mode_data, int f) {
+    const t_model *m = _model;
+    unsigned char bit;
+
+    if (f == 0) {
+        bit = mode_data[m->off_colour];
+        snprintf(label, len, "Colour:");
+        snprintf(value, len, "%s", s_colour[bit < colour_COUNT ? bit : colour_COUNT]);
+        return 1;
+    }
+
+    if (f == 1) {
+        bit = mode_data[m->off_rate];
+        snprintf(label, len, "Report Rate:");
+        snprintf(value, len, "%d", bit < m->n_rates ? m->rates[bit] : -1);
+        return 1;
+    }
+    f -= 2;
+
+    if (f < m->n_dpi) {
+        bit = mode_data[m->off_dpi + f];
+        snprintf(label, len, "DPI #%d:", f + 1);
+        snprintf(value, len, "%d%s", dpi_point(bit & m->dpi_mask), bit & m->dpi_default ? " (DEF)" : "");
+        return 1;
+    }
+    f -= m->n_dpi;
+
+    if (f == 0) {
+        bit = mode_data[m->off_dpishift];
+        snprintf(label, len, "DPI Shift:");
+        snprintf(value, len, "%d%s", dpi_point(bit & m->dpi_mask), bit & m->dpishift_disabled ? " [DISABLED]" : "");
+        return 1;
+    }
+    f -= 1;
+
+    if (f < m->n_buttons) {
+        snprintf(label, len, "%s:", m->button_names[f + 1]);
+        mode_button_str(value, len, &mode_data[m->off_buttons[f + 1]]);
+        if (!value[0]) snprintf(value, len, "(none)");
+        return 1;
+    }
+
+    return 0;
+}
+
+// Prints each field that differs between mode_old and mode_new, as
+// "<label> <old> -> <new>". Returns the number of fields (or, if the
+// difference isn't in any field mode_print shows, bytes) that differ.
+int mode_diff(FILE *strm, const unsigned char *mode_old, const unsigned char *mode_new, int len) {
+    char label[32];
+    char vold[128];
+    char vnew[128];
+    int diffs = 0;
+    int f;
+    int i;
+
+    if (!strm || !mode_old || !mode_new || len < _model->mode_len) return 0;
+
+    for (f = 0; mode_field(&label[0], &vold[0], sizeof(vold), mode_old, f); ++f) {
+        mode_field(&label[0], &vnew[0], sizeof(vnew), mode_new, f);
+        if (strcmp(vold, vnew) == 0) continue;
+
+        fprintf(strm, "  %-21s%s -> %s\n", &label[0], &vold[0], &vnew[0]);
+        ++diffs;
+    }
+    if (diffs) return diffs;
+
+    // Bits no field shows (eg. a DPI level's unused bits)
+    for (i = 0; i < _model->mode_len; ++i) {
+        if (mode_old[i] == mode_new[i]) continue;
+
+        fprintf(strm, "  Byte %-16d0x%.2x -> 0x%.2x\n", i, mode_old[i], mode_new[i]);
+        ++diffs;
+    }
+
+    return diffs;
+}
+
+int set_mode_rate(unsigned char *mode_data, const int rate) {
+    int i;
+
+    if (!mode_data || rate == 0) return 0;
+
+    for (i = 0; i < _model->n_rates; ++i) {
+        if (rate == _model->rates[i]) {
+            // Valid rate
+
+            mprintf("    Setting report rate: %d\n", _model->rates[i]);
+
+            // F5040302 84060844 01000002 00000300 00040000 05000006 00000700 00080000 090000
+            //     ^^
+            (mode_data)[_model->off_rate] = i;
+            return rate;
+        }
+    }
+
+    return 0;
+}
+
+int set_mode_dpi(unsigned char *mode_data, const int idx, const int dpi) {
+    int dpi_val = dpi_value(dpi);
+    int real_dpi = dpi_point(dpi_val);
+    unsigned char *lvl;
+
+    if (!mode_data || idx < 0 || idx >= _model->n_dpi || dpi < _model->dpi_step) return 0;
+
+    mprintf("    Setting DPI #%d: %d\n", idx + 1, real_dpi);
+
+    // F5040302 84060844 01000002 00000300 00040000 05000006 00000700 00080000 090000
+    //       ^^ ^^^^^^
+    lvl = &(mode_data)[_model->off_dpi + idx];
+    *lvl = (*lvl & _model->dpi_default) | dpi_val;
+    return real_dpi;
+}
+
+int set_mode_defdpi(unsigned char *mode_data, const int idx) {
+    int i;
+
+    if (!mode_data || idx < 0 || idx >= _model->n_dpi) return 0;
+
+    mprintf("    Setting DPI #%d as default\n", idx + 1);
+
+    // F5040302 84060844 01000002 00000300 00040000 05000006 00000700 00080000 090000
+    //       ^^ ^^^^^^
+    for (i = 0; i < _model->n_dpi; i++)
+        (mode_data)[_model->off_dpi + i] &= ~_model->dpi_flags;
+    (mode_data)[_model->off_dpi + idx] |= _model->dpi_default;
+    return 1;
+}
+
+int set_mode_enabledpishift(unsigned char *mode_data) {
+    if (!mode_data) return 0;
+
+    mprintf("    Enabling DPI shift\n");
+
+    // F5040302 84060844 01000002 00000300 00040000 05000006 00000700 00080000 090000
+    //                ^^
+    (mode_data)[_model->off_dpishift] &= ~_model->dpishift_disabled;
+    return 1;
+}
+
+int set_mode_dpishift(unsigned char *mode_data, const int dpi) {
+    int dpi_val = dpi_value(dpi);
+    int real_dpi = dpi_point(dpi_val);
+
+    if (!mode_data || dpi < _model->dpi_step) return 0;
+
+    mprintf("    Setting DPI Shift: %d\n", real_dpi);
+
+    // F5040302 84060844 01000002 00000300 00040000 05000006 00000700 00080000 090000
+    //                ^^
+    (mode_data)[_model->off_dpishift] = dpi_val;
+    return real_dpi;
+}
+
+int set_mode_nodpishift(unsigned char *mode_data) {
+    if (!mode_data) return 0;
+
+    mprintf("    Disabling DPI shift\n");
+
+    // F5040302 84060844 01000002 00000300 00040000 05000006 00000700 00080000 090000
+    //                ^^
+    (mode_data)[_model->off_dpishift] |= _model->dpishift_disabled;
+    return 1;
+}
+
+unsigned char set_mode_colour(unsigned char *mode_data, const t_colour colour) {
+    unsigned char oldcol;
+
+    if (!mode_data || colour >= colour_COUNT) return 0;
+
+    mprintf("    Setting colour: %s\n", s_colour[colour]);
+
+    // F5040302 84060844 01000002 00000300 00040000 05000006 00000700 00080000 090000
+    //   ^^
+    oldcol = (mode_data)[_model->off_colour];
+    (mode_data)[_model->off_colour] = colour;
+
+    return oldcol;
+}
+
+int set_mode_button(unsigned char *mode_data, const unsigned char button, const char *keys) {
+    unsigned char newkeys[3] = {0, 0, 0};
+    unsigned char bt;
+    char modkey[32];
+    int mki = 0;
+    const char *kptrprev = keys;
+    const char *kptr     = keys;
+
+    modkey[0] = '\0';
+
+    if (button < 1 || button > _model->n_buttons) return 0;
+
+    if (!keys) {
+        mprintf("    Setting button %2d: %s\n", button, s_buttons[0]);
+        (mode_data)[_model->off_buttons[button]    ] = 0x00;
+        (mode_data)[_model->off_buttons[button] + 1] = 0x00;
+        (mode_data)[_model->off_buttons[button] + 2] = 0x00;
+        return 1;
+    }
+
+    if (*keys == '+' && *(keys+1)) {
+        // keys starts with '+' and then contains more info
+        elog("ERROR: Invalid keys specified (starting with '+'): %s\n", keys);
+        return 0;
+    }
+
+    mprintf("    Setting button %d: %s\n", button, keys);
+
+    do {
+        dlog(LOG_KEY, "    > %c\n", *kptr ? *kptr : ' ');
+
+        // Only accepting 31 characters for the modkey name
+        if (mki < 31) {
+            modkey[mki++] = *kptr;
+            modkey[mki  ] = '\0';
+        }
+
+        // Is the next char a '+' or the end of our string?
+        //   - We allow end of string to fall through here so that if the last
+        //   token is a modifier it gets applied as BOTH a modifier and the key
+        //   - We skip this if the '+' is the last character as it's a key, so
+        //   we can skip all this (fixes QB#125).
+        if ((*kptr == '+' && *(kptr+1) != '\0') || *kptr == '\0') {
+            // keys is:
+            //     "<something>+..."
+            // or:
+            //     "<something>\0"
+
+            unsigned char ky = 0xe0;
+            int m;
+
+            if (mki > 0) modkey[--mki] = '\0'; // Just in case - lgtm [cpp/constant-comparison]
+
+            dlog(LOG_KEY, "Checking for Modifier: %s\n", modkey);
+
+            for (m = 0x01; m <= 0x80; m *= 2) {
+                dlog(LOG_KEY, "    %s == %s?\n", s_keys[ky], modkey);
+                if (strcasecmp(s_keys[ky], modkey) == 0) {
+                    // Match!
+                    newkeys[1] |= m;
+                    dlog(LOG_KEY, "MATCH: %s (+%d == %d)\n", s_keys[ky], m, newkeys[1]);
+                    break;
+                }
+
+                ++ky;
+            }
+
+            // If it's not the last element...
+            if (*kptr) {
+                // And didn't match a modifier, BAD!
+                if (m > 0x80) {
+                    elog("ERROR: Invalid modifier (%s) specified: %s\n", modkey, keys);
+                    return 0;
+                }
+
+                mki = 0;
+                modkey[mki] = '\0';
+
+                kptrprev = kptr+1;
+            }
+        }
+
+        if (!*kptr) break;
+
+        ++kptr;
+    } while (1);
+
+    // kptrprev now contains remaining key or button
+
+    // Special button?
+    dlog(LOG_KEY, "Checking for Specials...\n");
+    for (bt = 0x00; bt <= 0x0f; ++bt) {
+        if (strcasecmp(s_buttons[bt], kptrprev) == 0) {
+            // Button found
+            dlog(LOG_KEY, "MATCH SPECIAL: %s (%2x)\n", s_buttons[bt], bt);
+            newkeys[0] = bt;
+            break;
+        }
+    }
+
+    // Key
+    dlog(LOG_KEY, "Checking for Keys...\n");
+    if (!newkeys[0]) {
+        for (bt = 0; bt < 0xff; ++bt) {
+            if (strcasecmp(s_keys[bt], kptrprev) == 0) {
+                // Key found
+                dlog(LOG_KEY, "MATCH KEY: %s (%2x)\n", s_keys[bt], bt);
+                newkeys[2] = bt;
+                break;
+            }
+        }
+
+        // Modifier(s) only? A trailing '+' after a modifier (eg.
+        // "LeftCtrl+LeftAlt+") assigns just the modifiers, the same way the
+        // device's defaults do, and mode_print displays (eg. "LeftCtrl + ")
+        if (bt == 0xff && *kptrprev && kptrprev[strlen(kptrprev) - 1] == '+') {
+            const size_t kl = strlen(kptrprev) - 1;
+            unsigned char ky = 0xe0;
+            int m;
+
+            for (m = 0x01; m <= 0x80; m *= 2) {
+                if (strlen(s_keys[ky]) == kl && strncasecmp(s_keys[ky], kptrprev, kl) == 0) {
+                    dlog(LOG_KEY, "MATCH MODIFIER ONLY: %s (+%d)\n", s_keys[ky], m);
+                    newkeys[1] |= m;
+                    bt = 0x00;
+                    break;
+                }
+
+                ++ky;
+            }
+        }
+
+        // Invalid key?
+        if (bt == 0xff) {
+            elog("ERROR: Invalid key (%s) specified: %s\n", kptrprev, keys);
+            return 0;
+        }
+    }
+
+    dlog(LOG_KEY, "FINAL: %.2x%.2x%.2x\n", newkeys[0], newkeys[1], newkeys[2]);
+
+    (mode_data)[_model->off_buttons[button]    ] = newkeys[0];
+    (mode_data)[_model->off_buttons[button] + 1] = newkeys[1];
+    (mode_data)[_model->off_buttons[button] + 2] = newkeys[2];
+
+    return 1;
+}
+
+// Checks every field of mode_data holds a value the mouse understands.
+// Returns 1 if valid, otherwise 0 with the reason in err (if provided)
+int mode_validate(const unsigned char *mode_data, char *err, const size_t errlen) {
+    int defs = 0;
+    int i;
+
+    if (!mode_data) return 0;
+
+#define invalid(args...) do { if (err && errlen) snprintf(err, errlen, args); return 0; } while (0)
+
+    // F5040302 84060844 01000002 00000300 00040000 05000006 00000700 00080000 090000
+    // ^^^^^^^^
+    if (model_mode(_model, mode_data[0]) == mode_COUNT)
+        invalid("invalid mode ID 0x%.2x", mode_data[0]);
+
+    if (mode_data[_model->off_colour] >= colour_COUNT)
+        invalid("invalid colour 0x%.2x", mode_data[_model->off_colour]);
+
+    if (mode_data[_model->off_rate] >= _model->n_rates)
+        invalid("invalid report rate 0x%.2x", mode_data[_model->off_rate]);
+
+    // F5040302 84060844 01000002 00000300 00040000 05000006 00000700 00080000 090000
+    //       ^^ ^^^^^^
+    for (i = 0; i < _model->n_dpi; ++i) {
+        if (mode_data[_model->off_dpi + i] & _model->dpi_default) ++defs;
+    }
+    if (defs != 1) invalid("%d default DPI levels (expected 1)", defs);
+
+    // F5040302 84060844 01000002 00000300 00040000 05000006 00000700 00080000 090000
+    //                   ^^^^^^ ...
+    for (i = 1; i <= _model->n_buttons; ++i) {
+        const unsigned char *but = &mode_data[_model->off_buttons[i]];
+
+        // s_keys stops at 0xfe
+        if (but[2] == 0xff) invalid("invalid button %d key 0x%.2x", i, but[2]);
+    }
+
+    // Restored, the mouse would be left without a way to click
+    if (!mode_data[_model->off_buttons[1]] && !mode_data[_model->off_buttons[1] + 1] && !mode_data[_model->off_buttons[1] + 2])
+        invalid("%s not bound", _model->button_names[1]);
+
+#undef invalid
+
+    return 1;
+}
@@ -0,0 +1,75 @@
+/* vim:set ts=4 sw=4 tw=80 et cindent ai si cino=(0,ml,\:0:
+ * ( settings from: http://datapax.com.au/code_conventions/ )
+ */
+
+/**********************************************************************
+    RatSlap
+    Copyright (C) 2016-2020 Todd Harbour
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    version 2 ONLY, as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program, in the file COPYING or COPYING.txt; if
+    not, see http://www.gnu.org/licenses/ , or write to:
+      The Free Software Foundation, Inc.,
+      51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ **********************************************************************/
+
+#ifndef   MODE_H
+#define   MODE_H
+
+#include <stdio.h>
+
+// Space for a mode's data (as sent/received in a SET/GET_REPORT), the most any
+// model (see model.h) uses
+#define MODE_DATA_LEN               35
+
+typedef enum e_mode {
+     mode_f3 = 0
+    ,mode_f4
+    ,mode_f5
+    ,mode_COUNT
+} t_mode;
+
+typedef enum e_colour {
+     colour_black = 0
+    ,colour_red
+    ,colour_green
+    ,colour_yellow
+    ,colour_blue
+    ,colour_magenta
+    ,colour_cyan
+    ,colour_white
+    ,colour_COUNT
+} t_colour;
+
+extern const char *s_mode[];
+extern const char *s_colour[];
+extern const char *s_buttons[];
+extern const char *s_keys[];
+
+// Whether setters report what they're setting (to stdout)
+extern int _mode_verbose;
+
+int dpi_point(int dpip);
+int mode_button_str(char *out, const size_t outlen, const unsigned char *but);
+int mode_print(FILE *strm, const unsigned char *mode_data, int len);
+int mode_diff(FILE *strm, const unsigned char *mode_old, const unsigned char *mode_new, int len);
+int set_mode_rate(unsigned char *mode_data, const int rate);
+int set_mode_dpi(unsigned char *mode_data, const int idx, const int dpi);
+int set_mode_defdpi(unsigned char *mode_data, const int idx);
+int set_mode_enabledpishift(unsigned char *mode_data);
+int set_mode_dpishift(unsigned char *mode_data, const int dpi);
+int set_mode_nodpishift(unsigned char *mode_data);
+unsigned char set_mode_colour(unsigned char *mode_data, const t_colour colour);
+int set_mode_button(unsigned char *mode_data, const unsigned char button, const char *keys);
+int mode_validate(const unsigned char *mode_data, char *err, const size_t errlen);
+
+#endif /* MODE_H */
@@ -0,0 +1,165 @@
+/* vim:set ts=4 sw=4 tw=80 et cindent ai si cino=(0,ml,\:0:
+ * ( settings from: http://datapax.com.au/code_conventions/ )
+ */
+
+/**********************************************************************
+    RatSlap
+    Copyright (C) 2016-2020 Todd Harbour
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    version 2 ONLY, as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program, in the file COPYING or COPYING.txt; if
+    not, see http://www.gnu.org/licenses/ , or write to:
+      The Free Software Foundation, Inc.,
+      51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ **********************************************************************/
+
+#include <stdio.h>
+
+#include "mode.h"
+#include "model.h"
+
+const t_model models[] = {
+    {
+        // ID 046d:c246 == Logitech, Inc. Gaming Mouse G300
+         .name         = "Logitech G300s"
+        ,.vendor_id    = 0x046d
+        ,.product_id   = 0xc246
+        ,.interface    = 1
+
+        // S Co:2:039:0 s 21 09 03f5 0001 0023 35 = f5000384 04040440 ...
+        ,.mode_len     = 35
+        ,.mode_value   = { 0x03f3, 0x03f4, 0x03f5 }
+        ,.mode_id      = { 0xf3, 0xf4, 0xf5 }
+        ,.settle_load  = 10000
+        ,.settle_save  = 500000 // Writes are SLOW
+
+        // As per G300s_Default_Configuration.txt (DPI shift, "NOT SET" there,
+        // disabled)
+        ,.factory      = {
+             { 0xf3, 0x06, 0x03, 0x02, 0x84, 0x06, 0x0a, 0x40, 0x01, 0x00, 0x00, 0x02
+              ,0x00, 0x00, 0x03, 0x00, 0x00, 0x04, 0x00, 0x00, 0x05, 0x00, 0x00, 0x00
+              ,0x01, 0x00, 0x00, 0x04, 0x00, 0x0d, 0x00, 0x00, 0x0c, 0x00, 0x00 }
+            ,{ 0xf4, 0x07, 0x00, 0x02, 0x84, 0x06, 0x0a, 0x02, 0x01, 0x00, 0x00, 0x02
+              ,0x00, 0x00, 0x03, 0x00, 0x00, 0x04, 0x00, 0x00, 0x05, 0x00, 0x00, 0x0b
+              ,0x00, 0x00, 0x0a, 0x00, 0x00, 0x0d, 0x00, 0x00, 0x0e, 0x00, 0x00 }
+            ,{ 0xf5, 0x04, 0x03, 0x84, 0x04, 0x04, 0x04, 0x40, 0x01, 0x00, 0x00, 0x02
+              ,0x00, 0x00, 0x03, 0x00, 0x00, 0x04, 0x00, 0x00, 0x05, 0x00, 0x00, 0x00
+              ,0x01, 0x06, 0x00, 0x01, 0x19, 0x0d, 0x00, 0x00, 0x00, 0x01, 0x1b }
+        }
+
+        // F5040302 84060844 01000002 00000300 00040000 05000006 00000700 00080000 090000
+        //   ^^^^^^ ^^^^^^^^ ^^     ^      ^      ^      ^      ^      ^      ^      ^
+        // 0 1 2 3          8      11     14     17     20     23     26     29     32
+        ,.off_colour   = 1
+        ,.off_rate     = 2
+        ,.off_dpi      = 3
+        ,.n_dpi        = 4
+        ,.off_dpishift = 7
+        ,.n_buttons    = 9
+        ,.off_buttons  = { 0, 8, 11, 14, 17, 20, 23, 26, 29, 32 }
+        ,.button_names = {
+             NULL
+            ,"Left Click (But1)"
+            ,"Right Click (But2)"
+            ,"Middle Click (But3)"
+            ,"G4"
+            ,"G5"
+            ,"G6"
+            ,"G7"
+            ,"G8"
+            ,"G9"
+        }
+
+        ,.rates        = { 1000, 125, 250, 500 }
+        ,.n_rates      = 4
+        ,.dpi_step     = 250
+        ,.dpi_max      = 4000
+        ,.dpi_mask     = 0x0f
+        ,.dpi_default  = 0x80
+        ,.dpi_flags    = 0xc0
+        ,.dpishift_disabled = 0x40
+
+        // NOTE: Each also works with other high nibbles (f3: b0, c0, f0; f4:
+        // d0; f5: e0)
+        ,.select       = {
+             { "Select Mode: F3", 0x03f0, 4, { 0xf0, 0x80, 0x00, 0x00 }, 10000 }
+            ,{ "Select Mode: F4", 0x03f0, 4, { 0xf0, 0x90, 0x00, 0x00 }, 10000 }
+            ,{ "Select Mode: F5", 0x03f0, 4, { 0xf0, 0xa0, 0x00, 0x00 }, 10000 }
+        }
+
+        // A GET_REPORT of 03f0 reads back the active mode (the high nibble as
+        // selected; the low nibble is the DPI level). The mouse also sends it
+        // on its input endpoint when the mode's switched on the mouse.
+        // NOTE: Extrapolated, not seen in captures. So only a report the
+        // select's length, with exactly a select's high nibble, counts: f0 00
+        // (as Launch Editor (end) writes) and the other nibbles select takes
+        // are left alone rather than guessed at.
+        ,.off_active   = 1
+        ,.active_mask  = 0xf0
+
+        // LAUNCH EDITOR (the Logitech software sends f0423900 3 times, and
+        // the whole launch twice, once is enough), then START EDIT. f100
+        // turns the lights off, the mouse needs a while after it.
+        // ALSO SEEN (NO IDEA WHAT THEY ARE): f0400000, f0404b03, f0424b03,
+        // f0440000, f0460000
+        ,.editmode     = {
+             { "Launch Editor",       0x03f0, 4, { 0xf0, 0x42, 0x39, 0x00 },  50000 }
+            ,{ "Launch Editor (f2)",  0x03f2, 2, { 0xf2, 0x4f },              50000 }
+            ,{ "Launch Editor (end)", 0x03f0, 4, { 0xf0, 0x00, 0x00, 0x00 },  50000 }
+            ,{ "Reset (lights off)",  0x03f1, 2, { 0xf1, 0x00 },             550000 }
+            ,{ "Start Edit",          0x03f0, 4, { 0xf0, 0x42, 0x00, 0x00 },      0 }
+        }
+        ,.n_editmode   = 5
+    }
+};
+const int n_models = sizeof(models) / sizeof(models[0]);
+
+const t_model *_model = &models[0];
+
+
+
+const t_model *model_find(const uint16_t vendor_id, const uint16_t product_id) {
+    int i;
+
+    for (i = 0; i < n_models; ++i) {
+        if (models[i].vendor_id == vendor_id && models[i].product_id == product_id) return &models[i];
+    }
+
+    return NULL;
+}
+
+// The mode whose data starts with mode_id, mode_COUNT if none
+t_mode model_mode(const t_model *model, const unsigned char mode_id) {
+    t_mode mode;
+
+    for (mode = mode_f3; mode < mode_COUNT; ++mode) {
+        if (model->mode_id[mode] == mode_id) break;
+    }
+
+    return mode;
+}
+
+// The mode a read back select report (data, len bytes) says is active,
+// mode_COUNT if it doesn't say unambiguously
+t_mode model_active(const t_model *model, const unsigned char *data, const int len) {
+    t_mode mode;
+
+    if (!data || len != model->select[0].len || data[0] != model->select[0].data[0]) return mode_COUNT;
+
+    for (mode = mode_f3; mode < mode_COUNT; ++mode) {
+        const unsigned char sel = model->select[mode].data[model->off_active];
+
+        if ((data[model->off_active] & model->active_mask) == (sel & model->active_mask)) break;
+    }
+
+    return mode;
+}
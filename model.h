@@ -0,0 +1,103 @@
+/* vim:set ts=4 sw=4 tw=80 et cindent ai si cino=(0,ml,\:0:
+ * ( settings from: http://datapax.com.au/code_conventions/ )
+ */
+
+/**********************************************************************
+    RatSlap
+    Copyright (C) 2016-2020 Todd Harbour
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    version 2 ONLY, as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program, in the file COPYING or COPYING.txt; if
+    not, see http://www.gnu.org/licenses/ , or write to:
+      The Free Software Foundation, Inc.,
+      51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ **********************************************************************/
+
+#ifndef   MODEL_H
+#define   MODEL_H
+
+#include <stdint.h>
+
+#include "mode.h"
+
+// Each supported mouse is described by a model: how it's identified, how its
+// reports are laid out and encoded, and the command sequences (and timings) it
+// needs. Everything that talks to or decodes a mouse goes through the model,
+// so supporting another one is a matter of adding a table entry.
+
+#define MODEL_BUTTONS_MAX  16
+#define MODEL_RATES_MAX     8
+#define MODEL_SEQ_MAX       8
+
+// A single SET_REPORT of a command
+typedef struct s_model_xfer {
+    const char    *name;    // As seen in captures (see ratslap-decode)
+    uint16_t       value;   // wValue (report type << 8 | report ID)
+    uint8_t        len;
+    unsigned char  data[4];
+    unsigned int   settle;  // Time to leave the mouse afterwards (us)
+} t_model_xfer;
+
+typedef struct s_model {
+    const char    *name;
+    uint16_t       vendor_id;
+    uint16_t       product_id;
+    int            interface;
+
+    // Mode reports (GET_REPORT/SET_REPORT of mode_len bytes)
+    uint8_t        mode_len;                 // At most MODE_DATA_LEN
+    uint16_t       mode_value[mode_COUNT];   // wValue of each mode's report
+    uint8_t        mode_id[mode_COUNT];      // First byte of each mode's data
+    unsigned int   settle_load;              // us
+    unsigned int   settle_save;              // us
+    unsigned char  factory[mode_COUNT][MODE_DATA_LEN]; // Each mode as shipped
+
+    // Field layout (offsets into a mode's data)
+    uint8_t        off_colour;
+    uint8_t        off_rate;
+    uint8_t        off_dpi;                  // n_dpi levels, one byte each
+    uint8_t        n_dpi;
+    uint8_t        off_dpishift;
+    uint8_t        n_buttons;
+    uint8_t        off_buttons[MODEL_BUTTONS_MAX + 1]; // By button (from 1), 3
+                                                       // bytes each
+    const char    *button_names[MODEL_BUTTONS_MAX + 1];
+
+    // Encodings
+    int            rates[MODEL_RATES_MAX];   // Report rate (Hz) by value
+    uint8_t        n_rates;
+    int            dpi_step;                 // DPI per unit of a DPI value
+    int            dpi_max;                  // DPI of a DPI value of 0
+    uint8_t        dpi_mask;                 // DPI value bits of a DPI byte
+    uint8_t        dpi_default;              // Bit marking the default level
+    uint8_t        dpi_flags;                // Bits cleared with the default
+    uint8_t        dpishift_disabled;        // Bit disabling DPI shift
+
+    // Commands
+    t_model_xfer   select[mode_COUNT];
+    uint8_t        off_active;               // Which select[] byte (and bits)
+    uint8_t        active_mask;              // say which mode, as read back
+    t_model_xfer   editmode[MODEL_SEQ_MAX];
+    uint8_t        n_editmode;
+} t_model;
+
+extern const t_model models[];
+extern const int n_models;
+
+// The model being configured (the first until a mouse is found)
+extern const t_model *_model;
+
+const t_model *model_find(const uint16_t vendor_id, const uint16_t product_id);
+t_mode model_mode(const t_model *model, const unsigned char mode_id);
+t_mode model_active(const t_model *model, const unsigned char *data, const int len);
+
+#endif /* MODEL_H */
@@ -0,0 +1,300 @@
+/* vim:set ts=4 sw=4 tw=80 et cindent ai si cino=(0,ml,\:0:
+ * ( settings from: http://datapax.com.au/code_conventions/ )
+ */
+
+/**********************************************************************
+    RatSlap
+    Copyright (C) 2016-2020 Todd Harbour
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    version 2 ONLY, as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program, in the file COPYING or COPYING.txt; if
+    not, see http://www.gnu.org/licenses/ , or write to:
+      The Free Software Foundation, Inc.,
+      51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ **********************************************************************/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "log.h"
+#include "mode.h"
+#include "profile.h"
+#include "plan.h"
+#include "probes.h"
+
+#define MODES_ALL ((1 << mode_COUNT) - 1)
+
+// Marks a step to be removed (by compact())
+#define drop(step) do { (step)->op = plan_COUNT; } while (0)
+
+void plan_init(t_plan *plan) {
+    memset(plan, 0, sizeof(*plan));
+}
+
+t_plan_step *plan_add(t_plan *plan, const t_plan_op op, const t_mode mode, const char *path) {
+    t_plan_step *step;
+
+    if (plan->nsteps >= PLAN_STEPS_MAX) {
+        elog("ERROR: Too many operations (max %d)\n", PLAN_STEPS_MAX);
+        return NULL;
+    }
+
+    step = &plan->step[plan->nsteps++];
+    memset(step, 0, sizeof(*step));
+    step->op   = op;
+    step->mode = mode;
+    step->path = path;
+
+    return step;
+}
+
+// Whether applying setting later leaves nothing of setting earlier
+static int set_overwrites(const t_plan_set *later, const t_plan_set *earlier) {
+    // Setting the DPI shift value also enables it, but enabling/disabling it
+    // leaves the value alone
+    if (later->opt == 'S' && later->arg) return earlier->opt == 'S' || earlier->opt == 'U';
+    if (later->opt == 'S' || later->opt == 'U') return (earlier->opt == 'S' && !earlier->arg) || earlier->opt == 'U';
+
+    return later->opt == earlier->opt;
+}
+
+// Adds a setting to a modify step, dropping any earlier setting it overwrites
+// (different settings don't overlap, so order doesn't matter between them)
+int plan_add_set(t_plan_step *step, const int opt, const char *arg) {
+    const t_plan_set set = { opt, arg };
+    int i;
+    int j;
+
+    if (!step || step->op != plan_modify) return 0;
+
+    for (i = j = 0; i < step->nsets; ++i) {
+        if (set_overwrites(&set, &step->set[i])) continue;
+        step->set[j++] = step->set[i];
+    }
+    step->nsets = j;
+
+    if (step->nsets >= PLAN_SETS_MAX) {
+        elog("ERROR: Too many settings (max %d)\n", PLAN_SETS_MAX);
+        return 0;
+    }
+
+    step->set[step->nsets++] = set;
+
+    return 1;
+}
+
+// Applies a setting to mode data, returns 0 if it's invalid
+static int set_apply(unsigned char *mode_data, const t_plan_set *set) {
+    t_colour col;
+
+    switch (set->opt) {
+        case 'r':
+            return set->arg && set_mode_rate(mode_data, atoi(set->arg)) != 0;
+
+        case 'A':
+        case 'B':
+        case 'C':
+        case 'D':
+            return set->arg && set_mode_dpi(mode_data, set->opt - 'A', atoi(set->arg)) != 0;
+
+        case 'F':
+            return set->arg && set_mode_defdpi(mode_data, atoi(set->arg) - 1);
+
+        case 'S':
+            if (!set->arg) return set_mode_enabledpishift(mode_data);
+            return set_mode_dpishift(mode_data, atoi(set->arg)) != 0;
+
+        case 'U':
+            return set_mode_nodpishift(mode_data);
+
+        case 'c':
+            if (!set->arg) return 0;
+
+            for (col = 0; col < colour_COUNT; ++col) {
+                if (strcasecmp(s_colour[col], set->arg) == 0) break;
+            }
+            if (col == colour_COUNT) return 0;
+
+            set_mode_colour(mode_data, col);
+            return 1;
+
+        case '1':
+        case '2':
+        case '3':
+        case '4':
+        case '5':
+        case '6':
+        case '7':
+        case '8':
+        case '9':
+            return set->arg && set_mode_button(mode_data, set->opt - '0', set->arg);
+    }
+
+    return 0;
+}
+
+// As set_apply(), traced (see probes.h)
+int plan_set_apply(unsigned char *mode_data, const t_plan_set *set) {
+    int ret;
+
+    PROBE2(set__entry, set->opt, mode_data);
+    ret = set_apply(mode_data, set);
+    PROBE2(set__return, set->opt, ret);
+
+    return ret;
+}
+
+// Whether any steps apply to the mouse (rather than a profile file)
+int plan_uses_mouse(const t_plan *plan) {
+    return plan->nsteps > 0 && plan->step[0].op != plan_file;
+}
+
+// Whether the plan only reads (prints and snapshots), changing nothing
+int plan_read_only(const t_plan *plan) {
+    int i;
+
+    for (i = 0; i < plan->nsteps; ++i) {
+        switch (plan->step[i].op) {
+            case plan_print:
+            case plan_snapshot:
+            break;
+
+            default:
+                return 0;
+        }
+    }
+
+    return 1;
+}
+
+static int compact(t_plan *plan) {
+    int dropped;
+    int i;
+    int j;
+
+    for (i = j = 0; i < plan->nsteps; ++i) {
+        if (plan->step[i].op == plan_COUNT) continue;
+        if (i != j) plan->step[j] = plan->step[i];
+        ++j;
+    }
+
+    dropped = plan->nsteps - j;
+    plan->nsteps = j;
+
+    return dropped;
+}
+
+// Reduces the plan to as few steps as will have the same result:
+//   - Modifications of a mode are merged into the previous modification of the
+//     same mode, unless something in between shows or replaces that mode
+//   - Settings overwritten by later ones are dropped
+//   - Modifications wholly replaced by a restore are dropped
+//   - Only the last mode selection is kept
+// Returns the number of steps dropped
+int plan_optimise(t_plan *plan) {
+    int last_modify[mode_COUNT];
+    int last_select = -1;
+    t_mode m;
+    int i;
+    int s;
+
+    for (m = 0; m < mode_COUNT; ++m) last_modify[m] = -1;
+
+    for (i = 0; i < plan->nsteps; ++i) {
+        t_plan_step *step = &plan->step[i];
+
+        switch (step->op) {
+            case plan_file:
+                // Nothing carries over to another target
+                for (m = 0; m < mode_COUNT; ++m) last_modify[m] = -1;
+                last_select = -1;
+            break;
+
+            case plan_select:
+                if (last_select >= 0) drop(&plan->step[last_select]);
+                last_select = i;
+            break;
+
+            case plan_print:
+                // Must show the changes up to here
+                last_modify[step->mode] = -1;
+            break;
+
+            case plan_snapshot:
+                for (m = 0; m < mode_COUNT; ++m) last_modify[m] = -1;
+            break;
+
+            case plan_restore:
+                for (m = 0; m < mode_COUNT; ++m) {
+                    if (!(step->profile.present & (1 << m))) continue;
+
+                    if (last_modify[m] >= 0) drop(&plan->step[last_modify[m]]);
+                    last_modify[m] = -1;
+                }
+            break;
+
+            case plan_modify:
+                if (last_modify[step->mode] < 0) {
+                    last_modify[step->mode] = i;
+                    break;
+                }
+
+                // Can't run out of room, there's only PLAN_SETS_MAX distinct
+                // settings
+                for (s = 0; s < step->nsets; ++s) {
+                    plan_add_set(&plan->step[last_modify[step->mode]], step->set[s].opt, step->set[s].arg);
+                }
+                drop(step);
+            break;
+
+            case plan_COUNT:
+            break;
+        }
+    }
+
+    return compact(plan);
+}
+
+// Returns the modes (bit per mode, 1 << t_mode) whose current contents are
+// needed by steps first to last - 1, ie. those not wholly replaced (by a
+// restore) before they're printed, modified or saved in a snapshot
+unsigned int plan_reads(const t_plan *plan, const int first, const int last) {
+    unsigned int reads = 0;
+    unsigned int known = 0;
+    int i;
+
+    for (i = first; i < last && i < plan->nsteps; ++i) {
+        const t_plan_step *step = &plan->step[i];
+
+        switch (step->op) {
+            case plan_print:
+            case plan_modify:
+                if (!(known & (1 << step->mode))) reads |= (1 << step->mode);
+            break;
+
+            case plan_snapshot:
+                reads |= MODES_ALL & ~known;
+            break;
+
+            case plan_restore:
+                known |= step->profile.present;
+            break;
+
+            default:
+            break;
+        }
+    }
+
+    return reads;
+}
@@ -0,0 +1,83 @@
+/* vim:set ts=4 sw=4 tw=80 et cindent ai si cino=(0,ml,\:0:
+ * ( settings from: http://datapax.com.au/code_conventions/ )
+ */
+
+/**********************************************************************
+    RatSlap
+    Copyright (C) 2016-2020 Todd Harbour
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    version 2 ONLY, as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program, in the file COPYING or COPYING.txt; if
+    not, see http://www.gnu.org/licenses/ , or write to:
+      The Free Software Foundation, Inc.,
+      51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ **********************************************************************/
+
+
+#ifndef   PLAN_H
+#define   PLAN_H
+
+#include "mode.h"
+#include "profile.h"
+
+// The command line is parsed into a plan of steps, in order, which is fully
+// validated before anything is done. The plan is then optimised (see
+// plan_optimise()) and run (see plan_run() in main.c), which reads each mode
+// needed once, applies all changes in memory, then writes each changed mode
+// once, in a single edit session.
+//
+// Steps after a plan_file step apply to that profile file rather than the
+// mouse.
+
+#define PLAN_STEPS_MAX 64
+#define PLAN_SETS_MAX  24 // Enough for every setting of a mode, once each
+
+typedef enum e_plan_op {
+     plan_file     // Use a profile file (path)
+    ,plan_select   // Select a mode (mode)
+    ,plan_print    // Print a mode (mode)
+    ,plan_modify   // Change settings of a mode (mode, set)
+    ,plan_snapshot // Save all modes to a profile file (path)
+    ,plan_restore  // Write the modes in a profile file (path, profile)
+    ,plan_COUNT
+} t_plan_op;
+
+// A setting, as given on the command line
+typedef struct s_plan_set {
+    int         opt; // Short option, eg. 'c' for colour, '1' for left button
+    const char *arg; // Its argument (NULL if none)
+} t_plan_set;
+
+typedef struct s_plan_step {
+    t_plan_op   op;
+    t_mode      mode;
+    const char *path;
+    t_profile   profile;
+    int         nsets;
+    t_plan_set  set[PLAN_SETS_MAX];
+} t_plan_step;
+
+typedef struct s_plan {
+    int         nsteps;
+    t_plan_step step[PLAN_STEPS_MAX];
+} t_plan;
+
+void plan_init(t_plan *plan);
+t_plan_step *plan_add(t_plan *plan, const t_plan_op op, const t_mode mode, const char *path);
+int plan_add_set(t_plan_step *step, const int opt, const char *arg);
+int plan_set_apply(unsigned char *mode_data, const t_plan_set *set);
+int plan_uses_mouse(const t_plan *plan);
+int plan_read_only(const t_plan *plan);
+int plan_optimise(t_plan *plan);
+unsigned int plan_reads(const t_plan *plan, const int first, const int last);
+
+#endif /* PLAN_H */
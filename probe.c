@@ -0,0 +1,119 @@
+/* vim:set ts=4 sw=4 tw=80 et cindent ai si cino=(0,ml,\:0:
+ * ( settings from: http://datapax.com.au/code_conventions/ )
+ */
+
+/**********************************************************************
+    RatSlap
+    Copyright (C) 2016-2020 Todd Harbour
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    version 2 ONLY, as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program, in the file COPYING or COPYING.txt; if
+    not, see http://www.gnu.org/licenses/ , or write to:
+      The Free Software Foundation, Inc.,
+      51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ **********************************************************************/
+
+#include <stdint.h>
+#include <string.h>
+
+#include "log.h"
+#include "metrics.h"
+#include "mode.h"
+#include "profile.h"
+#include "probe.h"
+
+#define PROBE_MINUTE_US 60000000UL
+
+typedef struct s_probe {
+    unsigned int  present; // Modes expected (bitmask of 1 << t_mode)
+    int           len;
+    uint64_t      hash[mode_COUNT];
+    unsigned char mode_data[mode_COUNT][MODE_DATA_LEN];
+    t_mode        next;
+
+    // Token bucket, in transfers * PROBE_MINUTE_US (so refilling is just the
+    // time passed * budget)
+    unsigned int  budget;
+    unsigned long tokens;
+    unsigned long refilled; // When, as per metrics_now_us()
+} t_probe;
+
+t_probe _probe;
+
+
+
+// Starts with a full budget of 'budget' transfers a minute, and nothing
+// expected
+void probe_init(const unsigned int budget) {
+    memset(&_probe, 0, sizeof(_probe));
+
+    _probe.budget   = budget;
+    _probe.tokens   = budget * PROBE_MINUTE_US;
+    _probe.refilled = metrics_now_us();
+}
+
+// Notes what mode should hold (len bytes, as read or saved)
+void probe_expect(const t_mode mode, const unsigned char *mode_data, const int len) {
+    if (mode >= mode_COUNT || !mode_data || len > MODE_DATA_LEN) return;
+
+    _probe.len = len;
+    _probe.hash[mode] = profile_hash(mode_data, len);
+    memcpy(&_probe.mode_data[mode][0], mode_data, len);
+    _probe.present |= (1 << mode);
+}
+
+// What mode should hold, NULL if nothing's expected
+const unsigned char *probe_expected(const t_mode mode) {
+    if (mode >= mode_COUNT || !(_probe.present & (1 << mode))) return NULL;
+
+    return &_probe.mode_data[mode][0];
+}
+
+// Returns 1 if mode_data (as read from the mouse) is as expected for mode (or
+// nothing's expected), 0 if it's changed
+int probe_check(const t_mode mode, const unsigned char *mode_data) {
+    if (mode >= mode_COUNT || !(_probe.present & (1 << mode))) return 1;
+
+    return profile_hash(mode_data, _probe.len) == _probe.hash[mode];
+}
+
+// The next mode to read, in turn, mode_COUNT if none are expected
+t_mode probe_next(void) {
+    t_mode m;
+    int i;
+
+    for (i = 0; i < mode_COUNT; ++i) {
+        m = _probe.next;
+        _probe.next = (_probe.next + 1) % mode_COUNT;
+
+        if (_probe.present & (1 << m)) return m;
+    }
+
+    return mode_COUNT;
+}
+
+// Takes cost transfers from the budget, as long as there's reserve more left
+// after. Returns 1 if taken, 0 if the budget doesn't stretch to it (yet)
+int probe_spend(const unsigned int cost, const unsigned int reserve) {
+    const unsigned long now = metrics_now_us();
+    const unsigned long full = _probe.budget * PROBE_MINUTE_US;
+
+    _probe.tokens += (now - _probe.refilled) * _probe.budget;
+    if (_probe.tokens > full) _probe.tokens = full;
+    _probe.refilled = now;
+
+    if (_probe.tokens < (cost + reserve) * PROBE_MINUTE_US) return 0;
+
+    _probe.tokens -= cost * PROBE_MINUTE_US;
+
+    return 1;
+}
@@ -0,0 +1,48 @@
+/* vim:set ts=4 sw=4 tw=80 et cindent ai si cino=(0,ml,\:0:
+ * ( settings from: http://datapax.com.au/code_conventions/ )
+ */
+
+/**********************************************************************
+    RatSlap
+    Copyright (C) 2016-2020 Todd Harbour
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    version 2 ONLY, as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program, in the file COPYING or COPYING.txt; if
+    not, see http://www.gnu.org/licenses/ , or write to:
+      The Free Software Foundation, Inc.,
+      51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ **********************************************************************/
+
+#ifndef   PROBE_H
+#define   PROBE_H
+
+#include <stdint.h>
+
+#include "mode.h"
+
+// Health probe for the daemon (--probe). Every interval, one mode is read back
+// from the mouse (in turn, so each is read every mode_COUNT intervals), hashed
+// and compared with what's expected; a mode that's changed (eg. the mouse reset
+// to factory settings after a power glitch) is written back. All the transfers
+// this makes come out of a budget (--probe-budget), refilled steadily each
+// minute, so a misbehaving mouse is never hammered.
+
+#define PROBE_BUDGET_DEFAULT 12 // Transfers per minute
+
+void probe_init(const unsigned int budget);
+void probe_expect(const t_mode mode, const unsigned char *mode_data, const int len);
+const unsigned char *probe_expected(const t_mode mode);
+int probe_check(const t_mode mode, const unsigned char *mode_data);
+t_mode probe_next(void);
+int probe_spend(const unsigned int cost, const unsigned int reserve);
+
+#endif /* PROBE_H */
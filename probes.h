@@ -0,0 +1,72 @@
+/* vim:set ts=4 sw=4 tw=80 et cindent ai si cino=(0,ml,\:0:
+ * ( settings from: http://datapax.com.au/code_conventions/ )
+ */
+
+/**********************************************************************
+    RatSlap
+    Copyright (C) 2016-2020 Todd Harbour
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    version 2 ONLY, as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program, in the file COPYING or COPYING.txt; if
+    not, see http://www.gnu.org/licenses/ , or write to:
+      The Free Software Foundation, Inc.,
+      51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ **********************************************************************/
+
+#ifndef   PROBES_H
+#define   PROBES_H
+
+// USDT (static tracepoint) probes, for SystemTap, bpftrace, perf etc. Built in
+// whenever <sys/sdt.h> is there (eg. from systemtap-sdt-dev), unless
+// OPTIONS += NO_USDT (see make.options.conf). Each probe is a single nop until
+// something attaches to it; without them they're not there at all.
+//
+// Provider "ratslap", probes (arguments in order):
+//     xfer__entry    cmd, wValue, length, attempt  Each control transfer
+//     xfer__return   cmd, wValue, length, ret      (ret: bytes or -errno)
+//     settle__entry  cmd, us                       Each sleep for the mouse
+//     settle__return cmd, us                       to settle (or back off)
+//     detach__entry  iface                         Kernel driver detach
+//     detach__return iface, ret
+//     attach__entry  iface                         Kernel driver reattach
+//     attach__return iface, ret
+//     set__entry     option, mode_data             Each setting given on the
+//     set__return    option, ret                   command line (option as
+//                                                  per --modify, eg. 'c'),
+//                                                  not those from profiles
+//
+// cmd is a t_cmd (0 change_mode, 1 mode_load, 2 mode_save, 3 editmode), eg.
+//     bpftrace -e 'usdt:./ratslap:ratslap:xfer__return { @[arg0] = hist(arg3); }'
+
+#if !defined(USDT) && !defined(NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define USDT
+#endif
+#endif
+
+#ifdef USDT
+
+#include <sys/sdt.h>
+
+#define PROBE1(name, a)             DTRACE_PROBE1(ratslap, name, a)
+#define PROBE2(name, a, b)          DTRACE_PROBE2(ratslap, name, a, b)
+#define PROBE4(name, a, b, c, d)    DTRACE_PROBE4(ratslap, name, a, b, c, d)
+
+#else  /* USDT */
+
+#define PROBE1(name, a)             do {} while (0)
+#define PROBE2(name, a, b)          do {} while (0)
+#define PROBE4(name, a, b, c, d)    do {} while (0)
+
+#endif /* USDT */
+
+#endif /* PROBES_H */
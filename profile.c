@@ -0,0 +1,380 @@
+/* vim:set ts=4 sw=4 tw=80 et cindent ai si cino=(0,ml,\:0:
+ * ( settings from: http://datapax.com.au/code_conventions/ )
+ */
+
+/**********************************************************************
+    RatSlap
+    Copyright (C) 2016-2020 Todd Harbour
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    version 2 ONLY, as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program, in the file COPYING or COPYING.txt; if
+    not, see http://www.gnu.org/licenses/ , or write to:
+      The Free Software Foundation, Inc.,
+      51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "log.h"
+#include "mode.h"
+#include "model.h"
+#include "profile.h"
+
+// Text profile settings, named after the equivalent command line options
+typedef enum e_setting {
+     setting_rate = 0
+    ,setting_dpi
+    ,setting_defdpi
+    ,setting_dpishift
+    ,setting_nodpishift
+    ,setting_colour
+    ,setting_button
+} t_setting;
+
+const struct {
+    const char *name;
+    t_setting   setting;
+    int         arg;     // DPI level index, or button number
+} settings[] = {
+     { "rate",        setting_rate,       0 }
+    ,{ "d1",          setting_dpi,        0 }
+    ,{ "d2",          setting_dpi,        1 }
+    ,{ "d3",          setting_dpi,        2 }
+    ,{ "d4",          setting_dpi,        3 }
+    ,{ "default-dpi", setting_defdpi,     0 }
+    ,{ "dpishift",    setting_dpishift,   0 }
+    ,{ "no-dpishift", setting_nodpishift, 0 }
+    ,{ "colour",      setting_colour,     0 }
+    ,{ "color",       setting_colour,     0 }
+    ,{ "left",        setting_button,     1 }
+    ,{ "right",       setting_button,     2 }
+    ,{ "middle",      setting_button,     3 }
+    ,{ "g4",          setting_button,     4 }
+    ,{ "g5",          setting_button,     5 }
+    ,{ "g6",          setting_button,     6 }
+    ,{ "g7",          setting_button,     7 }
+    ,{ "g8",          setting_button,     8 }
+    ,{ "g9",          setting_button,     9 }
+};
+
+// Returns number of modes read, or -1 on error
+int profile_read(t_profile *prof, const char *path) {
+    unsigned char mode_data[MODE_DATA_LEN];
+    FILE *fp;
+    size_t rd;
+    t_mode mode;
+    int n = 0;
+
+    if (!prof || !path) return -1;
+
+    memset(prof, 0, sizeof(*prof));
+
+    fp = fopen(path, "rb");
+    if (!fp) {
+        elog("ERROR: Failed to open profile %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    while ((rd = fread(&mode_data[0], 1, MODE_DATA_LEN, fp)) == MODE_DATA_LEN) {
+        // F5040302 84060844 01000002 00000300 00040000 05000006 00000700 00080000 090000
+        // ^^
+        mode = model_mode(_model, mode_data[0]);
+        if (mode >= mode_COUNT) {
+            elog("ERROR: Invalid mode (0x%.2x) in profile %s\n", mode_data[0], path);
+            fclose(fp);
+            return -1;
+        }
+
+        memcpy(&prof->mode_data[mode][0], &mode_data[0], MODE_DATA_LEN);
+        prof->present |= 1 << mode;
+        ++n;
+    }
+
+    if (rd != 0 || ferror(fp)) {
+        elog("ERROR: Truncated profile %s\n", path);
+        fclose(fp);
+        return -1;
+    }
+
+    fclose(fp);
+
+    return n;
+}
+
+// Reads a binary profile (as profile_read()) or a text one (as
+// profile_parse(), applied on top of what prof already holds, eg. the modes
+// on the mouse), going by whether it starts with a mode ID. Returns the number
+// of modes prof then holds, or -1 on error
+int profile_load(t_profile *prof, const char *path) {
+    const int verbose = _mode_verbose;
+    char err[256];
+    FILE *fp;
+    t_mode mode;
+    int line;
+    int n = 0;
+    int c;
+
+    if (!prof || !path) return -1;
+
+    fp = fopen(path, "r");
+    if (!fp) {
+        elog("ERROR: Failed to open profile %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    c = fgetc(fp);
+    if (c != EOF && model_mode(_model, c) < mode_COUNT) {
+        fclose(fp);
+        return profile_read(prof, path);
+    }
+    rewind(fp);
+
+    // Settings are applied as when compiling, without narrating
+    _mode_verbose = 0;
+    line = profile_parse(prof, fp, &err[0], sizeof(err));
+    _mode_verbose = verbose;
+
+    fclose(fp);
+
+    if (line) {
+        elog("ERROR: %s:%d: %s\n", path, line, err);
+        return -1;
+    }
+
+    for (mode = 0; mode < mode_COUNT; ++mode) {
+        if (prof->present & (1 << mode)) ++n;
+    }
+
+    return n;
+}
+
+// 64-bit FNV-1a of a mode's data (or anything else), as modes are compared and
+// stored by
+uint64_t profile_hash(const unsigned char *data, const size_t len) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    size_t i;
+
+    for (i = 0; i < len; ++i) {
+        hash ^= data[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+// Writes via a temporary file so an interrupted write can't leave a truncated
+// profile behind. Returns number of modes written, or -1 on error
+int profile_write(const t_profile *prof, const char *path) {
+    char tmppath[4096];
+    FILE *fp;
+    t_mode mode;
+    int n = 0;
+
+    if (!prof || !path) return -1;
+
+    if (snprintf(&tmppath[0], sizeof(tmppath), "%s.tmp", path) >= sizeof(tmppath)) {
+        elog("ERROR: Profile path too long: %s\n", path);
+        return -1;
+    }
+
+    fp = fopen(&tmppath[0], "wb");
+    if (!fp) {
+        elog("ERROR: Failed to create profile %s: %s\n", &tmppath[0], strerror(errno));
+        return -1;
+    }
+
+    for (mode = 0; mode < mode_COUNT; ++mode) {
+        if (!(prof->present & (1 << mode))) continue;
+
+        if (fwrite(&prof->mode_data[mode][0], 1, MODE_DATA_LEN, fp) != MODE_DATA_LEN) break;
+        ++n;
+    }
+
+    if (fclose(fp) != 0 || mode != mode_COUNT) {
+        elog("ERROR: Failed to write profile %s\n", &tmppath[0]);
+        remove(&tmppath[0]);
+        return -1;
+    }
+
+    if (rename(&tmppath[0], path) != 0) {
+        elog("ERROR: Failed to replace profile %s: %s\n", path, strerror(errno));
+        remove(&tmppath[0]);
+        return -1;
+    }
+
+    return n;
+}
+
+int profile_get(const t_profile *prof, const t_mode mode, unsigned char *mode_data) {
+    if (!prof || !mode_data || mode >= mode_COUNT) return 0;
+
+    if (!(prof->present & (1 << mode))) return 0;
+
+    memcpy(mode_data, &prof->mode_data[mode][0], MODE_DATA_LEN);
+
+    return MODE_DATA_LEN;
+}
+
+int profile_set(t_profile *prof, const t_mode mode, const unsigned char *mode_data) {
+    if (!prof || !mode_data || mode >= mode_COUNT) return 0;
+
+    memcpy(&prof->mode_data[mode][0], mode_data, MODE_DATA_LEN);
+    prof->mode_data[mode][0] = _model->mode_id[mode];
+    prof->present |= 1 << mode;
+
+    return MODE_DATA_LEN;
+}
+
+// Parses a text profile, applying it on top of prof (which may already hold
+// modes, eg. from a base profile). A text profile looks like:
+//
+//     # Comment
+//     [F3]
+//     colour      cyan
+//     rate        500
+//     d2          1000
+//     default-dpi 2
+//     g6          LeftCtrl+C
+//
+// Settings are named after the equivalent long command line options.
+// Returns 0 on success, or the line number of the first error (with the
+// reason in err)
+int profile_parse(t_profile *prof, FILE *fp, char *err, const size_t errlen) {
+    unsigned char *mode_data = NULL;
+    char line[1024];
+    int lineno = 0;
+
+    if (!prof || !fp) return -1;
+
+#define failed(args...) do { if (err && errlen) snprintf(err, errlen, args); return lineno; } while (0)
+
+    while (fgets(&line[0], sizeof(line), fp)) {
+        char *key = &line[0];
+        char *val;
+        char *end;
+        size_t i;
+
+        ++lineno;
+
+        if (!strchr(&line[0], '\n') && !feof(fp)) failed("line too long");
+
+        // Trim
+        while (isspace((unsigned char)*key)) ++key;
+        end = key + strlen(key);
+        while (end > key && isspace((unsigned char)end[-1])) *--end = '\0';
+
+        // Blank or comment ('#' only at the start, "Num#" is a valid key)
+        if (!*key || *key == '#') continue;
+
+        // [F3]
+        if (*key == '[') {
+            t_mode mode;
+
+            if (end[-1] != ']') failed("invalid mode heading: %s", key);
+
+            *--end = '\0';
+            ++key;
+
+            for (mode = 0; mode < mode_COUNT; ++mode) {
+                if (strcasecmp(key, s_mode[mode]) == 0) break;
+            }
+            if (mode == mode_COUNT) failed("invalid mode: %s", key);
+
+            // A mode not in the base starts out as shipped, so anything not
+            // set (clicks, DPI levels) is still usable
+            if (!(prof->present & (1 << mode))) {
+                memcpy(&prof->mode_data[mode][0], &_model->factory[mode][0], MODE_DATA_LEN);
+                prof->present |= 1 << mode;
+            }
+
+            mode_data = &prof->mode_data[mode][0];
+            continue;
+        }
+
+        // key [value]
+        for (val = key; *val && !isspace((unsigned char)*val); ++val);
+        if (*val) {
+            *val++ = '\0';
+            while (isspace((unsigned char)*val)) ++val;
+        }
+
+        for (i = 0; i < sizeof(settings) / sizeof(settings[0]); ++i) {
+            if (strcasecmp(key, settings[i].name) == 0) break;
+        }
+        if (i == sizeof(settings) / sizeof(settings[0])) failed("unknown setting: %s", key);
+
+        if (!mode_data) failed("%s before any mode heading (eg. [F3])", key);
+
+        if (!*val
+        && settings[i].setting != setting_dpishift
+        && settings[i].setting != setting_nodpishift) {
+            failed("%s requires a value", key);
+        }
+
+        switch (settings[i].setting) {
+            case setting_rate:
+                if (!set_mode_rate(mode_data, atoi(val))) failed("invalid rate: %s", val);
+            break;
+
+            case setting_dpi:
+                if (!set_mode_dpi(mode_data, settings[i].arg, atoi(val))) failed("invalid DPI: %s", val);
+            break;
+
+            case setting_defdpi:
+                if (!set_mode_defdpi(mode_data, atoi(val) - 1)) failed("invalid DPI number: %s", val);
+            break;
+
+            case setting_dpishift:
+                if (!*val) {
+                    set_mode_enabledpishift(mode_data);
+                } else if (!set_mode_dpishift(mode_data, atoi(val))) {
+                    failed("invalid DPI: %s", val);
+                }
+            break;
+
+            case setting_nodpishift:
+                set_mode_nodpishift(mode_data);
+            break;
+
+            case setting_colour:
+            {
+                t_colour col;
+
+                for (col = 0; col < colour_COUNT; ++col) {
+                    if (strcasecmp(s_colour[col], val) == 0) break;
+                }
+                if (col == colour_COUNT) failed("invalid colour: %s", val);
+
+                set_mode_colour(mode_data, col);
+            }
+            break;
+
+            case setting_button:
+                if (!set_mode_button(mode_data, settings[i].arg, val)) failed("invalid keys for %s: %s", key, val);
+            break;
+        }
+    }
+
+    if (ferror(fp)) {
+        if (!lineno) lineno = 1;
+        failed("read error");
+    }
+
+#undef failed
+
+    return 0;
+}
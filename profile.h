@@ -0,0 +1,50 @@
+/* vim:set ts=4 sw=4 tw=80 et cindent ai si cino=(0,ml,\:0:
+ * ( settings from: http://datapax.com.au/code_conventions/ )
+ */
+
+/**********************************************************************
+    RatSlap
+    Copyright (C) 2016-2020 Todd Harbour
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    version 2 ONLY, as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program, in the file COPYING or COPYING.txt; if
+    not, see http://www.gnu.org/licenses/ , or write to:
+      The Free Software Foundation, Inc.,
+      51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ **********************************************************************/
+
+#ifndef   PROFILE_H
+#define   PROFILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "mode.h"
+
+// A profile file is simply the mode data for one or more modes, exactly as
+// the mouse reports it (MODE_DATA_LEN bytes each), back to back. Each mode's
+// data starts with its ID (0xf3, 0xf4 or 0xf5) so the order doesn't matter.
+
+typedef struct s_profile {
+    unsigned char mode_data[mode_COUNT][MODE_DATA_LEN];
+    unsigned int  present; // Bit per mode (1 << t_mode) with data
+} t_profile;
+
+int profile_read(t_profile *prof, const char *path);
+int profile_write(const t_profile *prof, const char *path);
+int profile_get(const t_profile *prof, const t_mode mode, unsigned char *mode_data);
+int profile_set(t_profile *prof, const t_mode mode, const unsigned char *mode_data);
+int profile_parse(t_profile *prof, FILE *fp, char *err, const size_t errlen);
+int profile_load(t_profile *prof, const char *path);
+uint64_t profile_hash(const unsigned char *data, const size_t len);
+
+#endif /* PROFILE_H */
@@ -0,0 +1,880 @@
+/* vim:set ts=4 sw=4 tw=80 et cindent ai si cino=(0,ml,\:0:
+ * ( settings from: http://datapax.com.au/code_conventions/ )
+ */
+
+/**********************************************************************
+    RatSlap
+    Copyright (C) 2016-2020 Todd Harbour
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    version 2 ONLY, as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program, in the file COPYING or COPYING.txt; if
+    not, see http://www.gnu.org/licenses/ , or write to:
+      The Free Software Foundation, Inc.,
+      51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/prctl.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <linux/uinput.h>
+
+#include "log.h"
+#include "mode.h"
+#include "model.h"
+#include "profile.h"
+#include "metrics.h"
+#include "daemon.h"
+#include "remap.h"
+
+// QB#111 - Older version (eg 1.0.14) didn't support libusb_strerror
+#ifndef libusb_strerror
+#define libusb_strerror libusb_error_name
+#endif
+
+// Input reports from the keyboard interface use the boot keyboard layout:
+//     modifiers, reserved, up to 6 key usages (0 for none)
+// Anything else is from the mouse itself (eg. the mode being switched)
+#define REMAP_REPORT_MAX   64
+#define REMAP_REPORT_LEN    8
+#define REMAP_REPORT_KEYS   2 // Offset of first key usage
+
+// Worst case events from one report: every chord of a remap (each modifier and
+// key pressed and released, plus two syncs) and every key/modifier changing
+#define REMAP_EVENTS_MAX  (REMAP_CHORDS_MAX * (2 * 9 + 2) + 2 * (8 + 6) + 1)
+
+// Macros waiting for the player to start them (a power of 2)
+#define REMAP_QUEUE_LEN    16
+
+// How long the reader waits for a report before checking if it's been stopped
+#define REMAP_READ_TIMEOUT 100 // ms
+
+#define HID_KEY_DOWN(bits, k)  ((bits)[(k) >> 3] &   (1 << ((k) & 7)))
+#define KEY_SET(bits, k)   ((bits)[(k) >> 3] |=  (1 << ((k) & 7)))
+
+// HID keyboard usage to Linux input key code (as per the kernel's hid-input)
+const unsigned char hid_keycode[256] = {
+      0,  0,  0,  0, 30, 48, 46, 32, 18, 33, 34, 35, 23, 36, 37, 38
+    , 50, 49, 24, 25, 16, 19, 31, 20, 22, 47, 17, 45, 21, 44,  2,  3
+    ,  4,  5,  6,  7,  8,  9, 10, 11, 28,  1, 14, 15, 57, 12, 13, 26
+    , 27, 43, 43, 39, 40, 41, 51, 52, 53, 58, 59, 60, 61, 62, 63, 64
+    , 65, 66, 67, 68, 87, 88, 99, 70,119,110,102,104,111,107,109,106
+    ,105,108,103, 69, 98, 55, 74, 78, 96, 79, 80, 81, 75, 76, 77, 71
+    , 72, 73, 82, 83, 86,127,116,117,183,184,185,186,187,188,189,190
+    ,191,192,193,194,134,138,130,132,128,129,131,137,133,135,136,113
+    ,115,114,  0,  0,  0,121,  0, 89, 93,124, 92, 94, 95,  0,  0,  0
+    ,122,123, 90, 91, 85,  0,  0,  0,  0,  0,  0,  0,111,  0,  0,  0
+    ,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0
+    ,  0,  0,  0,  0,  0,  0,179,180,  0,  0,  0,  0,  0,  0,  0,  0
+    ,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0
+    ,  0,  0,  0,  0,  0,  0,  0,  0,111,  0,  0,  0,  0,  0,  0,  0
+    , 29, 42, 56,125, 97, 54,100,126,164,166,165,163,161,115,114,113
+    ,150,158,159,128,136,177,178,176,142,152,173,140,  0,  0,  0,  0
+};
+
+// Text characters (US layout) by HID usage, from 0x04 (A) to 0x38 (/), plain
+// and with shift. 0x7f marks usages with no (such) character.
+const char remap_text_plain[] = "abcdefghijklmnopqrstuvwxyz1234567890\n\x1b\b\t -=[]\\\x7f;'`,./";
+const char remap_text_shift[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ!@#$%^&*()\x7f\x7f\x7f\x7f\x7f_+{}|\x7f:\"~<>?";
+
+// Button names, as per text profiles
+const char *s_remap_buttons[REMAP_BUTTONS] = {
+     NULL
+    ,"left"
+    ,"right"
+    ,"middle"
+    ,"g4"
+    ,"g5"
+    ,"g6"
+    ,"g7"
+    ,"g8"
+    ,"g9"
+};
+
+// Per mode lookup of the remaps by the key that triggers them
+typedef struct s_remap_trigger {
+    uint8_t        button[256]; // By key usage, 0 if none
+    uint8_t        mods[REMAP_BUTTONS];
+    const t_remap *remap[REMAP_BUTTONS];
+} t_remap_trigger;
+
+t_remap_table   _remap;
+t_remap_trigger _remap_trigger[mode_COUNT];
+int             _remap_mode = mode_COUNT;
+
+// Input state, only ever touched by the reader thread
+uint8_t  _remap_keys[32];     // Keys down (bitmap), as of the last report
+uint16_t _remap_held[256];    // Keys down that triggered a remap (0x100|mods)
+uint8_t  _remap_out_mods = 0; // Modifiers down, as emitted
+
+// Events being built, by the reader and the macro player
+typedef struct s_remap_events {
+    struct input_event ev[REMAP_EVENTS_MAX];
+    int n;
+} t_remap_events;
+
+t_remap_events _remap_out;
+t_remap_events _remap_play_out;
+
+int _remap_uinput = -1;
+
+pthread_t             _remap_thread;
+int                   _remap_running = 0;
+int                   _remap_stop    = 0;
+libusb_device_handle *_remap_usb     = NULL;
+unsigned char         _remap_ep      = 0;
+
+// Reports that aren't key presses are passed to the main thread, with the
+// mode they say is active (mode_COUNT if they don't)
+int    _remap_notifyfd = -1;
+t_mode _remap_notified = mode_COUNT;
+
+// A macro being played: the step it's up to, and when that's due
+// (CLOCK_MONOTONIC, as metrics_now_us())
+typedef struct s_remap_play {
+    const t_remap *remap; // NULL for a free slot
+    int            step;
+    unsigned long  due_us;
+} t_remap_play;
+
+// Macros are queued by the reader (only), started by the player (only)
+const t_remap *_remap_queue[REMAP_QUEUE_LEN];
+unsigned long  _remap_queue_at[REMAP_QUEUE_LEN]; // When pressed
+unsigned int   _remap_queue_head = 0;
+unsigned int   _remap_queue_tail = 0;
+
+// Player state, only ever touched by the player thread (once started)
+t_remap_play _remap_play[REMAP_PLAYS_MAX];
+pthread_t    _remap_player;
+int          _remap_playfd  = -1; // eventfd, macros queued (or stopping)
+int          _remap_timerfd = -1; // Next step due
+
+
+
+// Parses a delay ("250ms", "1500us") into delay_us. Returns 1 if tok is one
+static int delay_parse(const char *tok, uint32_t *delay_us) {
+    unsigned long val = 0;
+    const char *p;
+
+    for (p = tok; isdigit((unsigned char)*p); ++p) {
+        if (val > REMAP_DELAY_MAX) return 0;
+        val = val * 10 + (*p - '0');
+    }
+
+    if (p == tok) return 0;
+
+    if      (strcmp(p, "ms") == 0) val *= 1000;
+    else if (strcmp(p, "us") != 0) return 0;
+
+    if (val > REMAP_DELAY_MAX) return 0;
+
+    *delay_us = val;
+
+    return 1;
+}
+
+// The chord that types c. Returns 1 on success, 0 if there's no key for it
+static int text_chord(const char c, t_remap_chord *ch) {
+    const char *p;
+
+    if (!c || c == 0x7f) return 0;
+
+    if ((p = memchr(&remap_text_plain[0], c, sizeof(remap_text_plain) - 1))) {
+        ch->mods = 0;
+        ch->key  = 0x04 + (p - &remap_text_plain[0]);
+        return 1;
+    }
+
+    if ((p = memchr(&remap_text_shift[0], c, sizeof(remap_text_shift) - 1))) {
+        ch->mods = 0x02; // LeftShift
+        ch->key  = 0x04 + (p - &remap_text_shift[0]);
+        return 1;
+    }
+
+    return 0;
+}
+
+// Parses a remap file. Returns 0 on success, or the line number of the first
+// error (with 'err' describing it)
+int remap_parse(t_remap_table *tbl, FILE *fp, char *err, const size_t errlen) {
+    unsigned char scratch[MODE_DATA_LEN];
+    int mode = mode_COUNT;
+    char line[1024];
+    int lineno = 0;
+    int verbose = _mode_verbose;
+    uint32_t delay;
+
+    if (!tbl || !fp) return -1;
+
+    memset(tbl, 0, sizeof(*tbl));
+
+#define failed(args...) do { if (err && errlen) snprintf(err, errlen, args); _mode_verbose = verbose; return lineno; } while (0)
+
+    // Chords are parsed as button bindings, don't narrate
+    _mode_verbose = 0;
+
+    while (fgets(&line[0], sizeof(line), fp)) {
+        char *key = &line[0];
+        char *val;
+        char *end;
+        t_remap *rm;
+        int b;
+
+        ++lineno;
+
+        if (!strchr(&line[0], '\n') && !feof(fp)) failed("line too long");
+
+        // Trim
+        while (isspace((unsigned char)*key)) ++key;
+        end = key + strlen(key);
+        while (end > key && isspace((unsigned char)end[-1])) *--end = '\0';
+
+        // Blank or comment ('#' only at the start, "Num#" is a valid key)
+        if (!*key || *key == '#') continue;
+
+        // [F3]
+        if (*key == '[') {
+            if (end[-1] != ']') failed("invalid mode heading: %s", key);
+
+            *--end = '\0';
+            ++key;
+
+            for (mode = 0; mode < mode_COUNT; ++mode) {
+                if (strcasecmp(key, s_mode[mode]) == 0) break;
+            }
+            if (mode == mode_COUNT) failed("invalid mode: %s", key);
+
+            continue;
+        }
+
+        // button chord [chord...]
+        for (val = key; *val && !isspace((unsigned char)*val); ++val);
+        if (*val) {
+            *val++ = '\0';
+            while (isspace((unsigned char)*val)) ++val;
+        }
+
+        for (b = 1; b < REMAP_BUTTONS; ++b) {
+            if (strcasecmp(key, s_remap_buttons[b]) == 0) break;
+        }
+        if (b == REMAP_BUTTONS) failed("unknown button: %s", key);
+
+        if (mode == mode_COUNT) failed("%s before any mode heading (eg. [F3])", key);
+        if (!*val) failed("%s requires at least one key combo", key);
+
+        rm = &tbl->remap[mode][b];
+        memset(rm, 0, sizeof(*rm));
+        delay = 0;
+
+        while (*val) {
+            char *chord = val;
+            const unsigned char *but = &scratch[_model->off_buttons[b]];
+            uint32_t d;
+
+            // "text", typed a character at a time
+            if (*val == '"') {
+                for (++val; *val && *val != '"'; ++val) {
+                    char c = *val;
+
+                    if (c == '\\' && val[1]) {
+                        c = *++val;
+                        if      (c == 'n') c = '\n';
+                        else if (c == 't') c = '\t';
+                    }
+
+                    if (rm->nchords == REMAP_CHORDS_MAX) failed("too many steps for %s (max %d)", key, REMAP_CHORDS_MAX);
+                    if (!text_chord(c, &rm->chord[rm->nchords])) failed("no key for '%c' in text for %s", c, key);
+
+                    rm->chord[rm->nchords++].delay_us = delay;
+                    delay = 0;
+                }
+                if (*val != '"') failed("unterminated text for %s", key);
+
+                for (++val; isspace((unsigned char)*val); ++val);
+                continue;
+            }
+
+            for (; *val && !isspace((unsigned char)*val); ++val);
+            if (*val) {
+                *val++ = '\0';
+                while (isspace((unsigned char)*val)) ++val;
+            }
+
+            if (delay_parse(chord, &d)) {
+                if (delay + d > REMAP_DELAY_MAX) failed("delay too long for %s: %s", key, chord);
+
+                delay += d;
+                rm->macro = 1;
+                continue;
+            }
+
+            if (rm->nchords == REMAP_CHORDS_MAX) failed("too many steps for %s (max %d)", key, REMAP_CHORDS_MAX);
+
+            if (!set_mode_button(&scratch[0], b, chord)) failed("invalid key combo for %s: %s", key, chord);
+            if (but[0]) failed("mouse buttons can't be remapped to: %s", chord);
+
+            rm->chord[rm->nchords].delay_us = delay;
+            rm->chord[rm->nchords].mods     = but[1];
+            rm->chord[rm->nchords].key      = but[2];
+            ++rm->nchords;
+            delay = 0;
+        }
+
+        // Trailing delay, holds the macro (and so its slot) until it's over
+        if (delay) {
+            if (rm->nchords == REMAP_CHORDS_MAX) failed("too many steps for %s (max %d)", key, REMAP_CHORDS_MAX);
+
+            rm->chord[rm->nchords++].delay_us = delay;
+        }
+
+        if (!rm->nchords) failed("%s requires at least one key combo", key);
+    }
+
+    if (ferror(fp)) {
+        if (!lineno) lineno = 1;
+        failed("read error");
+    }
+
+#undef failed
+
+    _mode_verbose = verbose;
+
+    return 0;
+}
+
+// Works out which key identifies each remapped button, from what they're bound
+// to on the mouse. Returns the number of remaps that can be used
+int remap_init(const t_remap_table *tbl, const t_profile *modes) {
+    char butout[128];
+    t_mode mode;
+    int n = 0;
+    int b;
+
+    memset(&_remap_trigger[0], 0, sizeof(_remap_trigger));
+    memset(&_remap_keys[0], 0, sizeof(_remap_keys));
+    memset(&_remap_held[0], 0, sizeof(_remap_held));
+    _remap_out_mods = 0;
+
+    if (tbl) memcpy(&_remap, tbl, sizeof(_remap));
+    else     memset(&_remap, 0, sizeof(_remap));
+
+    for (mode = 0; mode < mode_COUNT; ++mode) {
+        t_remap_trigger *trig = &_remap_trigger[mode];
+
+        for (b = 1; b < REMAP_BUTTONS; ++b) {
+            const unsigned char *but;
+
+            if (!_remap.remap[mode][b].nchords) continue;
+
+            if (!modes || !(modes->present & (1 << mode))) {
+                elog("WARNING: %s not loaded, can't remap %s\n", s_mode[mode], s_remap_buttons[b]);
+                continue;
+            }
+
+            but = &modes->mode_data[mode][_model->off_buttons[b]];
+            mode_button_str(&butout[0], sizeof(butout), but);
+
+            // Must be a (non modifier) key to be recognisable
+            if (but[0] || !but[2] || but[2] >= 0xe0) {
+                elog("WARNING: %s %s is bound to \"%s\", bind it to an (unused) key to remap it\n"
+                    ,s_mode[mode], s_remap_buttons[b], butout);
+                continue;
+            }
+
+            if (trig->button[but[2]]) {
+                elog("WARNING: %s %s is bound to the same key as %s, not remapping\n"
+                    ,s_mode[mode], s_remap_buttons[b], s_remap_buttons[trig->button[but[2]]]);
+                continue;
+            }
+
+            trig->button[but[2]] = b;
+            trig->mods[b]        = but[1];
+            trig->remap[b]       = &_remap.remap[mode][b];
+            ++n;
+
+            ilog("Remapping %s %s (%s)\n", s_mode[mode], s_remap_buttons[b], butout);
+        }
+    }
+
+    return n;
+}
+
+// The mode the mouse is in (mode_COUNT if unknown, in which case all modes are
+// searched)
+void remap_set_mode(const t_mode mode) {
+    __atomic_store_n(&_remap_mode, mode, __ATOMIC_RELAXED);
+}
+
+static const t_remap *remap_find(const uint8_t key, const uint8_t mods, uint8_t *trig_mods) {
+    int mode = __atomic_load_n(&_remap_mode, __ATOMIC_RELAXED);
+    int m;
+
+    for (m = (mode < mode_COUNT ? mode : 0); m < mode_COUNT; ++m) {
+        const t_remap_trigger *trig = &_remap_trigger[m];
+        const uint8_t b = trig->button[key];
+
+        if (b && (mods & trig->mods[b]) == trig->mods[b]) {
+            *trig_mods = trig->mods[b];
+            return trig->remap[b];
+        }
+
+        if (mode < mode_COUNT) break;
+    }
+
+    return NULL;
+}
+
+static inline void ev_add(t_remap_events *out, const uint16_t type, const uint16_t code, const int32_t value) {
+    if (out->n == REMAP_EVENTS_MAX) return;
+
+    out->ev[out->n].type  = type;
+    out->ev[out->n].code  = code;
+    out->ev[out->n].value = value;
+    ++out->n;
+}
+
+static inline void ev_key(t_remap_events *out, const uint8_t usage, const int32_t value) {
+    if (hid_keycode[usage]) ev_add(out, EV_KEY, hid_keycode[usage], value);
+}
+
+// Presses/releases modifiers so that exactly 'mods' are down
+static void ev_mods(t_remap_events *out, const uint8_t from, const uint8_t to) {
+    int m;
+
+    for (m = 0; m < 8; ++m) {
+        if ((from ^ to) & (1 << m)) ev_key(out, 0xe0 + m, !!(to & (1 << m)));
+    }
+}
+
+// Presses and releases a chord, on top of the modifiers already down
+static void ev_chord(t_remap_events *out, const t_remap_chord *ch, const uint8_t mods) {
+    const uint8_t cmods = mods | ch->mods;
+
+    // Just a delay
+    if (!ch->mods && !ch->key) return;
+
+    ev_mods(out, mods, cmods);
+    if (ch->key) ev_key(out, ch->key, 1);
+    ev_add(out, EV_SYN, SYN_REPORT, 0);
+
+    if (ch->key) ev_key(out, ch->key, 0);
+    ev_mods(out, cmods, mods);
+    ev_add(out, EV_SYN, SYN_REPORT, 0);
+}
+
+// Writes the events built (if any) to uinput. Returns the number of events
+// written, or -1 on error
+static int ev_write(t_remap_events *out) {
+    if (!out->n) return 0;
+
+    METRIC_ADD(_metrics.remap_events, out->n);
+
+    if (_remap_uinput < 0) return out->n;
+
+    if (write(_remap_uinput, &out->ev[0], out->n * sizeof(out->ev[0])) < 0) {
+        elog("ERROR: Failed to write events: %s\n", strerror(errno));
+        return -1;
+    }
+
+    return out->n;
+}
+
+// Hands a macro to the player, pressed at at_us. Never blocks: if the queue's
+// full, the macro's dropped
+static void macro_queue(const t_remap *rm, const unsigned long at_us) {
+    const unsigned int head = _remap_queue_head;
+    const uint64_t val = 1;
+
+    if (head - __atomic_load_n(&_remap_queue_tail, __ATOMIC_ACQUIRE) == REMAP_QUEUE_LEN) {
+        METRIC_INC(_metrics.macro_dropped);
+        return;
+    }
+
+    _remap_queue[head & (REMAP_QUEUE_LEN - 1)]    = rm;
+    _remap_queue_at[head & (REMAP_QUEUE_LEN - 1)] = at_us;
+    __atomic_store_n(&_remap_queue_head, head + 1, __ATOMIC_RELEASE);
+
+    if (write(_remap_playfd, &val, sizeof(val)) < 0) {
+        dlog(LOG, "Failed to wake macro player: %s\n", strerror(errno));
+    }
+}
+
+// Translates an input report into events (written to uinput). Nothing is
+// allocated; events are built in a static buffer and written in one go, with
+// macros queued for the player. Returns the number of events written, or -1
+// on error
+int remap_report(const unsigned char *rep, const int len) {
+    const t_remap *pressed[6];
+    uint8_t keys[32];
+    uint8_t mods;
+    uint8_t consumed = 0;
+    uint8_t trig_mods;
+    int npressed = 0;
+    int i, k, c;
+
+    if (!rep || len < REMAP_REPORT_KEYS) return 0;
+
+    mods = rep[0];
+    _remap_out.n = 0;
+
+    memset(&keys[0], 0, sizeof(keys));
+    for (i = REMAP_REPORT_KEYS; i < len; ++i) {
+        // 0 is none, 1 - 3 are error codes (eg. rollover)
+        if (rep[i] > 3) KEY_SET(keys, rep[i]);
+    }
+
+    for (k = 4; k < 256; ++k) {
+        const int was = !!HID_KEY_DOWN(_remap_keys, k);
+        const int now = !!HID_KEY_DOWN(keys, k);
+
+        if (was && !now) {
+            // Released, remaps were sent in full when pressed
+            if (_remap_held[k]) _remap_held[k] = 0;
+            else                ev_key(&_remap_out, k, 0);
+        } else if (!was && now) {
+            const t_remap *rm = remap_find(k, mods, &trig_mods);
+
+            if (rm && (rm->macro || npressed < 6)) {
+                _remap_held[k] = 0x100 | trig_mods;
+
+                if (rm->macro) macro_queue(rm, metrics_now_us());
+                else           pressed[npressed++] = rm;
+            }
+        }
+
+        // Modifiers that are part of a held remap's trigger aren't passed on
+        if (_remap_held[k]) consumed |= _remap_held[k] & 0xff;
+    }
+
+    // Modifiers, before any keys pressed with them (the player reads them too)
+    ev_mods(&_remap_out, _remap_out_mods, mods & ~consumed);
+    __atomic_store_n(&_remap_out_mods, mods & ~consumed, __ATOMIC_RELAXED);
+
+    // Keys passed straight through
+    for (k = 4; k < 256; ++k) {
+        if (HID_KEY_DOWN(keys, k) && !HID_KEY_DOWN(_remap_keys, k) && !_remap_held[k]) ev_key(&_remap_out, k, 1);
+    }
+
+    if (_remap_out.n) ev_add(&_remap_out, EV_SYN, SYN_REPORT, 0);
+
+    // Remaps: each chord pressed and released in turn, on top of whatever
+    // modifiers are already down
+    for (i = 0; i < npressed; ++i) {
+        for (c = 0; c < pressed[i]->nchords; ++c) ev_chord(&_remap_out, &pressed[i]->chord[c], _remap_out_mods);
+    }
+
+    memcpy(&_remap_keys[0], &keys[0], sizeof(_remap_keys));
+
+    return ev_write(&_remap_out);
+}
+
+// Creates the virtual keyboard events are sent from. Returns 1 on success, 0
+// on error
+int remap_uinput_open(void) {
+    struct uinput_setup us;
+    int k;
+
+    if (_remap_uinput >= 0) return 1;
+
+    _remap_uinput = open("/dev/uinput", O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+    if (_remap_uinput < 0) {
+        elog("ERROR: Failed to open /dev/uinput: %s\n", strerror(errno));
+        return 0;
+    }
+
+    ioctl(_remap_uinput, UI_SET_EVBIT, EV_KEY);
+    ioctl(_remap_uinput, UI_SET_EVBIT, EV_SYN);
+    for (k = 0; k < 256; ++k) {
+        if (hid_keycode[k]) ioctl(_remap_uinput, UI_SET_KEYBIT, hid_keycode[k]);
+    }
+
+    memset(&us, 0, sizeof(us));
+    us.id.bustype = BUS_VIRTUAL;
+    snprintf(&us.name[0], sizeof(us.name), "RatSlap Remap");
+
+    if (ioctl(_remap_uinput, UI_DEV_SETUP, &us) != 0 || ioctl(_remap_uinput, UI_DEV_CREATE) != 0) {
+        elog("ERROR: Failed to create uinput device: %s\n", strerror(errno));
+        close(_remap_uinput);
+        _remap_uinput = -1;
+        return 0;
+    }
+
+    return 1;
+}
+
+void remap_uinput_close(void) {
+    if (_remap_uinput < 0) return;
+
+    ioctl(_remap_uinput, UI_DEV_DESTROY);
+    close(_remap_uinput);
+    _remap_uinput = -1;
+}
+
+// Passes a report that isn't key presses on to the main thread (see
+// remap_notify_fd()). A mode switch the report gives is used straight away.
+static void remap_notify(const unsigned char *rep, const int len) {
+    const t_mode mode = model_active(_model, rep, len);
+    const uint64_t val = 1;
+
+    if (mode < mode_COUNT) remap_set_mode(mode);
+
+    __atomic_store_n(&_remap_notified, mode, __ATOMIC_RELAXED);
+
+    if (write(_remap_notifyfd, &val, sizeof(val)) < 0) {
+        dlog(LOG, "Failed to notify of report: %s\n", strerror(errno));
+    }
+}
+
+// Readable when the mouse has sent a report that isn't key presses
+int remap_notify_fd(void) {
+    return _remap_notifyfd;
+}
+
+// The mode the last report that wasn't key presses said was active, mode_COUNT
+// if it didn't (so the mouse needs to be asked)
+t_mode remap_notified(void) {
+    return __atomic_load_n(&_remap_notified, __ATOMIC_RELAXED);
+}
+
+// Reads input reports for as long as we're running. Report to event latency is
+// recorded in the metrics.
+static void *remap_reader(void *arg) {
+    unsigned char rep[REMAP_REPORT_MAX];
+    unsigned long start;
+    int len = 0;
+    int ret;
+
+    while (!__atomic_load_n(&_remap_stop, __ATOMIC_RELAXED)) {
+        ret = libusb_interrupt_transfer(_remap_usb, _remap_ep, &rep[0], sizeof(rep), &len, REMAP_READ_TIMEOUT);
+        if (ret == LIBUSB_ERROR_TIMEOUT) continue;
+
+        if (ret != 0) {
+            elog("ERROR: Failed to read input report: %s\n", libusb_strerror(ret));
+            daemon_stop(1);
+            break;
+        }
+
+        if (len != REMAP_REPORT_LEN) {
+            remap_notify(&rep[0], len);
+            continue;
+        }
+
+        start = metrics_now_us();
+
+        METRIC_INC(_metrics.remap_reports);
+        if (remap_report(&rep[0], len) < 0) {
+            daemon_stop(1);
+            break;
+        }
+
+        metrics_observe(&_metrics.remap_latency, metrics_now_us() - start);
+    }
+
+    return NULL;
+}
+
+// Sends a macro's next step, and any following it without a delay, noting how
+// late it was. Frees the slot when the macro's done
+static void play_step(t_remap_play *p, const unsigned long now) {
+    const t_remap *rm = p->remap;
+    const uint8_t mods = __atomic_load_n(&_remap_out_mods, __ATOMIC_RELAXED);
+
+    metrics_observe(&_metrics.macro_jitter, now > p->due_us ? now - p->due_us : 0);
+
+    _remap_play_out.n = 0;
+    do {
+        ev_chord(&_remap_play_out, &rm->chord[p->step++], mods);
+    } while (p->step < rm->nchords && !rm->chord[p->step].delay_us);
+
+    if (ev_write(&_remap_play_out) < 0) daemon_stop(1);
+
+    // Due relative to when it should have been, so lateness doesn't add up
+    if (p->step < rm->nchords) {
+        p->due_us += rm->chord[p->step].delay_us;
+        return;
+    }
+
+    p->remap = NULL;
+    METRIC_INC(_metrics.macros);
+}
+
+// Plays queued macros, each step sent when it's due (to the microsecond, as
+// far as the timer allows). Nothing is allocated; macros play in a fixed
+// number of slots, side by side.
+static void *remap_macro_player(void *arg) {
+    struct pollfd pfd[2];
+    struct itimerspec its;
+    unsigned long now;
+    unsigned long next;
+    uint64_t val;
+    int p;
+
+    // The default slack (50us) would be most of the jitter
+    prctl(PR_SET_TIMERSLACK, 1UL, 0, 0, 0);
+
+    pfd[0].fd     = _remap_playfd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd     = _remap_timerfd;
+    pfd[1].events = POLLIN;
+
+    while (!__atomic_load_n(&_remap_stop, __ATOMIC_RELAXED)) {
+        if (poll(&pfd[0], 2, -1) < 0) {
+            if (errno == EINTR) continue;
+
+            elog("ERROR: Macro player failed to poll: %s\n", strerror(errno));
+            break;
+        }
+
+        if (pfd[0].revents & POLLIN) (void)!read(_remap_playfd,  &val, sizeof(val));
+        if (pfd[1].revents & POLLIN) (void)!read(_remap_timerfd, &val, sizeof(val));
+
+        // Start whatever's been queued
+        while (_remap_queue_tail != __atomic_load_n(&_remap_queue_head, __ATOMIC_ACQUIRE)) {
+            const unsigned int q = _remap_queue_tail & (REMAP_QUEUE_LEN - 1);
+
+            for (p = 0; p < REMAP_PLAYS_MAX && _remap_play[p].remap; ++p);
+
+            if (p == REMAP_PLAYS_MAX) {
+                METRIC_INC(_metrics.macro_dropped);
+            } else {
+                _remap_play[p].remap  = _remap_queue[q];
+                _remap_play[p].step   = 0;
+                _remap_play[p].due_us = _remap_queue_at[q] + _remap_queue[q]->chord[0].delay_us;
+            }
+
+            __atomic_store_n(&_remap_queue_tail, _remap_queue_tail + 1, __ATOMIC_RELEASE);
+        }
+
+        // Send what's due, and find when the next step is
+        next = 0;
+        for (p = 0; p < REMAP_PLAYS_MAX; ++p) {
+            t_remap_play *play = &_remap_play[p];
+
+            while (play->remap && play->due_us <= (now = metrics_now_us())) play_step(play, now);
+
+            if (play->remap && (!next || play->due_us < next)) next = play->due_us;
+        }
+
+        // 0 disarms
+        memset(&its, 0, sizeof(its));
+        its.it_value.tv_sec  = next / 1000000;
+        its.it_value.tv_nsec = (next % 1000000) * 1000;
+        timerfd_settime(_remap_timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+    }
+
+    return NULL;
+}
+
+// Starts the macro player. Returns 1 on success, 0 on error
+static int remap_macro_start(void) {
+    int ret;
+
+    memset(&_remap_play[0], 0, sizeof(_remap_play));
+    _remap_queue_head = 0;
+    _remap_queue_tail = 0;
+
+    _remap_playfd  = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    _remap_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (_remap_playfd < 0 || _remap_timerfd < 0) {
+        elog("ERROR: Failed to create macro player fds: %s\n", strerror(errno));
+        ret = -1;
+    } else {
+        ret = pthread_create(&_remap_player, NULL, remap_macro_player, NULL);
+        if (ret != 0) elog("ERROR: Failed to start macro player: %s\n", strerror(ret));
+    }
+
+    if (ret == 0) return 1;
+
+    if (_remap_playfd  >= 0) close(_remap_playfd);
+    if (_remap_timerfd >= 0) close(_remap_timerfd);
+    _remap_playfd  = -1;
+    _remap_timerfd = -1;
+
+    return 0;
+}
+
+// Stops the macro player (after the reader, so nothing more is queued),
+// abandoning any macros part played
+static void remap_macro_stop(void) {
+    const uint64_t val = 1;
+
+    if (write(_remap_playfd, &val, sizeof(val)) < 0) {
+        dlog(LOG, "Failed to wake macro player: %s\n", strerror(errno));
+    }
+    pthread_join(_remap_player, NULL);
+
+    close(_remap_playfd);
+    close(_remap_timerfd);
+    _remap_playfd  = -1;
+    _remap_timerfd = -1;
+}
+
+// Starts reading input reports from 'endpoint'. Returns 1 on success, 0 on
+// error
+int remap_start(libusb_device_handle *usb_dev_handle, const unsigned char endpoint) {
+    int ret;
+
+    if (_remap_running || !usb_dev_handle) return 0;
+
+    _remap_usb  = usb_dev_handle;
+    _remap_ep   = endpoint;
+    _remap_stop = 0;
+
+    _remap_notifyfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (_remap_notifyfd < 0) {
+        elog("ERROR: Failed to create event fd: %s\n", strerror(errno));
+        return 0;
+    }
+
+    if (!remap_macro_start()) {
+        close(_remap_notifyfd);
+        _remap_notifyfd = -1;
+        return 0;
+    }
+
+    ret = pthread_create(&_remap_thread, NULL, remap_reader, NULL);
+    if (ret != 0) {
+        elog("ERROR: Failed to start input reader: %s\n", strerror(ret));
+        __atomic_store_n(&_remap_stop, 1, __ATOMIC_RELAXED);
+        remap_macro_stop();
+        close(_remap_notifyfd);
+        _remap_notifyfd = -1;
+        return 0;
+    }
+
+    _remap_running = 1;
+
+    return 1;
+}
+
+void remap_stop(void) {
+    if (!_remap_running) return;
+
+    __atomic_store_n(&_remap_stop, 1, __ATOMIC_RELAXED);
+    pthread_join(_remap_thread, NULL);
+    remap_macro_stop();
+
+    close(_remap_notifyfd);
+    _remap_notifyfd = -1;
+
+    _remap_running = 0;
+}
@@ -0,0 +1,87 @@
+/* vim:set ts=4 sw=4 tw=80 et cindent ai si cino=(0,ml,\:0:
+ * ( settings from: http://datapax.com.au/code_conventions/ )
+ */
+
+/**********************************************************************
+    RatSlap
+    Copyright (C) 2016-2020 Todd Harbour
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    version 2 ONLY, as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program, in the file COPYING or COPYING.txt; if
+    not, see http://www.gnu.org/licenses/ , or write to:
+      The Free Software Foundation, Inc.,
+      51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ **********************************************************************/
+
+#ifndef   REMAP_H
+#define   REMAP_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <libusb-1.0/libusb.h>
+
+#include "mode.h"
+#include "profile.h"
+
+// The mouse can only bind a single key (plus modifiers) to each button. When
+// running as a daemon, ratslap reads the (keyboard) input reports from the
+// interface it claims and re-emits them through uinput, replacing the keys
+// bound to remapped buttons with arbitrary sequences of key combos ("chords").
+//
+// A remap file looks like a text profile (see profile_parse()), eg.
+//     [F3]
+//     g8       LeftCtrl+C
+//     g9       LeftCtrl+LeftShift+T LeftCtrl+Tab
+// where each button lists the chords to send, in order, when it's pressed. A
+// remapped button must be bound to a key on the mouse (any otherwise unused
+// key, eg. F13), that's what identifies it in the input reports.
+//
+// Chords can be mixed with delays ("250ms", "1500us") and quoted text (typed a
+// character at a time, US layout, with \" \\ \n and \t escapes), eg.
+//     g7       LeftCtrl+L 100ms "example.com\n"
+// A remap with delays is a macro: rather than being sent straight away, it's
+// handed to a player thread that sends each step when it's due (timerfd), so
+// however long it runs, other buttons aren't held up.
+
+#define REMAP_CHORDS_MAX  64 // Steps, each character of text being one
+#define REMAP_BUTTONS     10 // Indexed by button number (1 - 9)
+#define REMAP_PLAYS_MAX    8 // Macros playing at once
+#define REMAP_DELAY_MAX   60000000 // us, per delay
+
+typedef struct s_remap_chord {
+    uint32_t delay_us; // Wait before sending (macros only)
+    uint8_t  mods;     // HID modifier bits (as per mode data)
+    uint8_t  key;      // HID usage, 0 for modifiers only (or just a delay)
+} t_remap_chord;
+
+typedef struct s_remap {
+    uint8_t       nchords; // 0 if not remapped
+    uint8_t       macro;   // Has delays, so is played (not sent in one go)
+    t_remap_chord chord[REMAP_CHORDS_MAX];
+} t_remap;
+
+typedef struct s_remap_table {
+    t_remap remap[mode_COUNT][REMAP_BUTTONS];
+} t_remap_table;
+
+int remap_parse(t_remap_table *tbl, FILE *fp, char *err, const size_t errlen);
+int remap_init(const t_remap_table *tbl, const t_profile *modes);
+void remap_set_mode(const t_mode mode);
+int remap_report(const unsigned char *rep, const int len);
+int remap_uinput_open(void);
+void remap_uinput_close(void);
+int remap_notify_fd(void);
+t_mode remap_notified(void);
+int remap_start(libusb_device_handle *usb_dev_handle, const unsigned char endpoint);
+void remap_stop(void);
+
+#endif /* REMAP_H */
@@ -0,0 +1,363 @@
+/* vim:set ts=4 sw=4 tw=80 et cindent ai si cino=(0,ml,\:0:
+ * ( settings from: http://datapax.com.au/code_conventions/ )
+ */
+
+/**********************************************************************
+    RatSlap
+    Copyright (C) 2016-2020 Todd Harbour
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    version 2 ONLY, as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program, in the file COPYING or COPYING.txt; if
+    not, see http://www.gnu.org/licenses/ , or write to:
+      The Free Software Foundation, Inc.,
+      51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ **********************************************************************/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "metrics.h"
+#include "replay.h"
+
+// Recording (--record)
+FILE          *_replay_record_fp     = NULL;
+const char    *_replay_record_path   = NULL;
+unsigned long  _replay_record_start  = 0;
+unsigned long  _replay_record_count  = 0;
+int            _replay_record_failed = 0;
+
+// Replaying (--replay)
+t_replay_xfer *_replay               = NULL;
+size_t         _replay_count         = 0;
+size_t         _replay_next          = 0;
+int            _replay_paced         = 0;
+unsigned long  _replay_mismatches    = 0;
+
+static void put16(unsigned char *p, const uint16_t v) {
+    p[0] = v & 0xff;
+    p[1] = v >> 8;
+}
+
+static void put32(unsigned char *p, const uint32_t v) {
+    put16(p, v & 0xffff);
+    put16(p + 2, v >> 16);
+}
+
+static uint16_t get16(const unsigned char *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const unsigned char *p) {
+    return get16(p) | ((uint32_t)get16(p + 2) << 16);
+}
+
+static void record(const t_replay_xfer *x) {
+    unsigned char hdr[REPLAY_HDR_LEN];
+
+    if (!_replay_record_fp || _replay_record_failed) return;
+
+    hdr[0] = x->kind;
+    hdr[1] = x->request_type;
+    hdr[2] = x->request;
+    hdr[3] = 0;
+    put16(&hdr[ 4], x->value);
+    put16(&hdr[ 6], x->index);
+    put16(&hdr[ 8], x->len);
+    put16(&hdr[10], x->datalen);
+    put32(&hdr[12], (uint32_t)x->ret);
+    put32(&hdr[16], x->when);
+    put32(&hdr[20], x->took);
+
+    if (fwrite(&hdr[0], sizeof(hdr), 1, _replay_record_fp) != 1
+     || (x->datalen && fwrite(&x->data[0], x->datalen, 1, _replay_record_fp) != 1)) {
+        elog("ERROR: Failed to write to recording %s: %s\n", _replay_record_path, strerror(errno));
+        _replay_record_failed = 1;
+        return;
+    }
+
+    ++_replay_record_count;
+}
+
+int replay_record_open(const char *path) {
+    if (_replay_record_fp) return 1;
+
+    _replay_record_fp = fopen(path, "wb");
+    if (!_replay_record_fp) {
+        elog("ERROR: Failed to create recording %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+
+    _replay_record_path   = path;
+    _replay_record_start  = metrics_now_us();
+    _replay_record_count  = 0;
+    _replay_record_failed = 0;
+
+    if (fwrite(REPLAY_MAGIC, REPLAY_MAGIC_LEN, 1, _replay_record_fp) != 1) {
+        elog("ERROR: Failed to write to recording %s: %s\n", path, strerror(errno));
+        _replay_record_failed = 1;
+    }
+
+    return 1;
+}
+
+// Returns -1 if anything failed to be recorded
+int replay_record_close(void) {
+    if (!_replay_record_fp) return 0;
+
+    if (fclose(_replay_record_fp) != 0 && !_replay_record_failed) {
+        elog("ERROR: Failed to write to recording %s: %s\n", _replay_record_path, strerror(errno));
+        _replay_record_failed = 1;
+    }
+    _replay_record_fp = NULL;
+
+    if (_replay_record_failed) return -1;
+
+    printf("Recorded %lu transfers: %s\n", _replay_record_count, _replay_record_path);
+
+    return 0;
+}
+
+// Loads the whole recording up front, so replaying costs nothing but the
+// lookup. With timed set, each transfer takes as long as it did when recorded
+int replay_open(const char *path, const int timed) {
+    unsigned char magic[REPLAY_MAGIC_LEN];
+    unsigned char hdr[REPLAY_HDR_LEN];
+    t_replay_xfer *x;
+    size_t alloc = 0;
+    size_t got;
+    FILE *fp;
+
+    fp = fopen(path, "rb");
+    if (!fp) {
+        elog("ERROR: Failed to open recording %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+
+    if (fread(&magic[0], sizeof(magic), 1, fp) != 1 || memcmp(&magic[0], REPLAY_MAGIC, REPLAY_MAGIC_LEN) != 0) {
+        elog("ERROR: Not a recording: %s\n", path);
+        fclose(fp);
+        return 0;
+    }
+
+    _replay_count = 0;
+    while ((got = fread(&hdr[0], 1, sizeof(hdr), fp)) == sizeof(hdr)) {
+        if (_replay_count == alloc) {
+            t_replay_xfer *grown;
+
+            alloc = alloc ? alloc * 2 : 64;
+            grown = realloc(_replay, alloc * sizeof(*_replay));
+            if (!grown) {
+                elog("ERROR: Failed to allocate memory for recording\n");
+                break;
+            }
+            _replay = grown;
+        }
+
+        x = &_replay[_replay_count];
+        x->kind         = hdr[0];
+        x->request_type = hdr[1];
+        x->request      = hdr[2];
+        x->value        = get16(&hdr[ 4]);
+        x->index        = get16(&hdr[ 6]);
+        x->len          = get16(&hdr[ 8]);
+        x->datalen      = get16(&hdr[10]);
+        x->ret          = (int32_t)get32(&hdr[12]);
+        x->when         = get32(&hdr[16]);
+        x->took         = get32(&hdr[20]);
+
+        if ((x->kind != replay_kind_control && x->kind != replay_kind_reset)
+         || x->datalen > REPLAY_DATA_MAX
+         || (x->datalen && fread(&x->data[0], x->datalen, 1, fp) != 1)) {
+            elog("ERROR: Corrupt recording %s (transfer %lu)\n", path, (unsigned long)_replay_count + 1);
+            break;
+        }
+
+        ++_replay_count;
+    }
+
+    // Anything left over means the recording stopped part way through a
+    // transfer (or we gave up on one above)
+    if (got && got < sizeof(hdr))
+        elog("ERROR: Corrupt recording %s (transfer %lu)\n", path, (unsigned long)_replay_count + 1);
+
+    if (got || !feof(fp) || ferror(fp)) {
+        fclose(fp);
+        free(_replay);
+        _replay = NULL;
+        _replay_count = 0;
+        return 0;
+    }
+
+    fclose(fp);
+
+    // An empty recording is still a recording, just one the mouse was never
+    // used in
+    if (!_replay && !(_replay = malloc(sizeof(*_replay)))) return 0;
+
+    _replay_next       = 0;
+    _replay_paced      = timed;
+    _replay_mismatches = 0;
+
+    printf("Replaying %lu transfers: %s\n", (unsigned long)_replay_count, path);
+
+    return 1;
+}
+
+// Returns -1 if the session didn't go as recorded
+int replay_close(void) {
+    int ret = 0;
+
+    if (!_replay) return 0;
+
+    if (_replay_next < _replay_count) {
+        elog("ERROR: Replay: %lu recorded transfers not made\n", (unsigned long)(_replay_count - _replay_next));
+        ret = -1;
+    }
+
+    if (_replay_mismatches) ret = -1;
+
+    printf("Replayed %lu of %lu transfers, %lu mismatches\n"
+        ,(unsigned long)_replay_next, (unsigned long)_replay_count, _replay_mismatches);
+
+    free(_replay);
+    _replay = NULL;
+
+    return ret;
+}
+
+int replay_active(void) {
+    return _replay != NULL;
+}
+
+int replay_timed(void) {
+    return _replay && _replay_paced;
+}
+
+// The next recorded transfer, if it's of the kind expected
+static const t_replay_xfer *replay_next(const uint8_t kind) {
+    const t_replay_xfer *x;
+
+    if (_replay_next >= _replay_count) {
+        elog("ERROR: Replay: transfer %lu wasn't recorded\n", (unsigned long)_replay_next + 1);
+        ++_replay_mismatches;
+        return NULL;
+    }
+
+    x = &_replay[_replay_next++];
+    if (x->kind != kind) {
+        elog("ERROR: Replay: transfer %lu was recorded as a %s\n"
+            ,(unsigned long)_replay_next, x->kind == replay_kind_reset ? "reset" : "control transfer");
+        ++_replay_mismatches;
+        return NULL;
+    }
+
+    return x;
+}
+
+// libusb_control_transfer() (wIndex included), recorded or replayed
+int replay_xfer(libusb_device_handle *usb_dev_handle, const uint8_t request_type, const uint8_t request, const uint16_t value, const uint16_t index, unsigned char *data, const uint16_t len, const unsigned int timeout) {
+    const int in = (request_type & LIBUSB_ENDPOINT_DIR_MASK) == LIBUSB_ENDPOINT_IN;
+    const t_replay_xfer *rx;
+    t_replay_xfer x;
+    unsigned long start;
+    int ret;
+
+    if (_replay) {
+        if (!(rx = replay_next(replay_kind_control))) return LIBUSB_ERROR_IO;
+
+        if (rx->request_type != request_type || rx->request != request || rx->value != value
+         || rx->index != index || rx->len != len) {
+            elog("ERROR: Replay: transfer %lu was recorded as %.2x %.2x %.4x %.4x %u, not %.2x %.2x %.4x %.4x %u\n"
+                ,(unsigned long)_replay_next
+                ,rx->request_type, rx->request, rx->value, rx->index, rx->len
+                ,request_type, request, value, index, len);
+            ++_replay_mismatches;
+            return LIBUSB_ERROR_IO;
+        }
+
+        if (!in && (rx->datalen != len || memcmp(&rx->data[0], data, len) != 0)) {
+            elog("ERROR: Replay: transfer %lu sent different data to that recorded\n", (unsigned long)_replay_next);
+            ++_replay_mismatches;
+            return LIBUSB_ERROR_IO;
+        }
+
+        // If it took longer than we're now allowing, it times out
+        if (timeout && rx->took > timeout * 1000UL) {
+            if (_replay_paced) usleep(timeout * 1000UL);
+            return LIBUSB_ERROR_TIMEOUT;
+        }
+
+        if (_replay_paced) usleep(rx->took);
+
+        if (in && rx->ret > 0) memcpy(data, &rx->data[0], rx->datalen < len ? rx->datalen : len);
+
+        return rx->ret;
+    }
+
+    start = metrics_now_us();
+    ret = libusb_control_transfer(usb_dev_handle, request_type, request, value, index, data, len, timeout);
+
+    if (_replay_record_fp) {
+        x.kind         = replay_kind_control;
+        x.request_type = request_type;
+        x.request      = request;
+        x.value        = value;
+        x.index        = index;
+        x.len          = len;
+        x.ret          = ret;
+        x.when         = start - _replay_record_start;
+        x.took         = metrics_now_us() - start;
+        x.datalen      = in ? (ret > 0 ? ret : 0) : len;
+        if (x.datalen > REPLAY_DATA_MAX) x.datalen = REPLAY_DATA_MAX;
+        if (x.datalen) memcpy(&x.data[0], data, x.datalen);
+
+        record(&x);
+    }
+
+    return ret;
+}
+
+// libusb_reset_device(), recorded or replayed
+int replay_reset(libusb_device_handle *usb_dev_handle) {
+    const t_replay_xfer *rx;
+    t_replay_xfer x;
+    unsigned long start;
+    int ret;
+
+    if (_replay) {
+        if (!(rx = replay_next(replay_kind_reset))) return LIBUSB_ERROR_IO;
+
+        if (_replay_paced) usleep(rx->took);
+
+        return rx->ret;
+    }
+
+    start = metrics_now_us();
+    ret = libusb_reset_device(usb_dev_handle);
+
+    if (_replay_record_fp) {
+        memset(&x, 0, sizeof(x) - sizeof(x.data));
+        x.kind = replay_kind_reset;
+        x.ret  = ret;
+        x.when = start - _replay_record_start;
+        x.took = metrics_now_us() - start;
+
+        record(&x);
+    }
+
+    return ret;
+}
@@ -0,0 +1,79 @@
+/* vim:set ts=4 sw=4 tw=80 et cindent ai si cino=(0,ml,\:0:
+ * ( settings from: http://datapax.com.au/code_conventions/ )
+ */
+
+/**********************************************************************
+    RatSlap
+    Copyright (C) 2016-2020 Todd Harbour
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    version 2 ONLY, as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program, in the file COPYING or COPYING.txt; if
+    not, see http://www.gnu.org/licenses/ , or write to:
+      The Free Software Foundation, Inc.,
+      51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ **********************************************************************/
+
+
+#ifndef   REPLAY_H
+#define   REPLAY_H
+
+#include <stdint.h>
+#include <libusb-1.0/libusb.h>
+
+// Device sessions can be recorded (--record) to a file, with every control
+// transfer made (and device reset), what it returned and how long it took.
+// Replaying one (--replay) serves the recorded responses in place of the
+// mouse, checking each request matches what was recorded, so runs can be
+// reproduced (and timed, with --metrics) without the mouse.
+//
+// The file starts with REPLAY_MAGIC, then each transfer, in order, as a
+// little endian header (REPLAY_HDR_LEN bytes):
+//     kind (1), request type (1), request (1), reserved (1), value (2),
+//     index (2), length (2), data length (2), result (4), when (4),
+//     took (4)
+// followed by data length bytes of data (as sent for OUT transfers, as
+// received for IN). when is since recording started, when and took are in us.
+
+#define REPLAY_MAGIC     "RSLPREC\x01"
+#define REPLAY_MAGIC_LEN 8
+#define REPLAY_HDR_LEN   24
+#define REPLAY_DATA_MAX  256
+
+typedef enum e_replay_kind {
+     replay_kind_control = 'C' // Control transfer
+    ,replay_kind_reset   = 'R' // Device reset
+} t_replay_kind;
+
+typedef struct s_replay_xfer {
+    uint8_t       kind;
+    uint8_t       request_type;
+    uint8_t       request;
+    uint16_t      value;
+    uint16_t      index;
+    uint16_t      len;
+    uint16_t      datalen;
+    int32_t       ret;
+    uint32_t      when;
+    uint32_t      took;
+    unsigned char data[REPLAY_DATA_MAX];
+} t_replay_xfer;
+
+int replay_record_open(const char *path);
+int replay_record_close(void);
+int replay_open(const char *path, const int timed);
+int replay_close(void);
+int replay_active(void);
+int replay_timed(void);
+int replay_xfer(libusb_device_handle *usb_dev_handle, const uint8_t request_type, const uint8_t request, const uint16_t value, const uint16_t index, unsigned char *data, const uint16_t len, const unsigned int timeout);
+int replay_reset(libusb_device_handle *usb_dev_handle);
+
+#endif /* REPLAY_H */
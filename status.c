@@ -0,0 +1,251 @@
+/* vim:set ts=4 sw=4 tw=80 et cindent ai si cino=(0,ml,\:0:
+ * ( settings from: http://datapax.com.au/code_conventions/ )
+ */
+
+/**********************************************************************
+    RatSlap
+    Copyright (C) 2016-2020 Todd Harbour
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    version 2 ONLY, as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program, in the file COPYING or COPYING.txt; if
+    not, see http://www.gnu.org/licenses/ , or write to:
+      The Free Software Foundation, Inc.,
+      51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ **********************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "log.h"
+#include "mode.h"
+#include "model.h"
+#include "status.h"
+
+// Gives up after this many torn reads (ie. the writer died mid update)
+#define STATUS_READ_TRIES 1000
+
+t_status *_status = NULL;
+int _status_fd = -1;
+
+
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Only one writer may be between status_begin() and status_end() at a time.
+// Writers in other ratslap processes are kept out by locking the page's file,
+// readers never take the lock.
+static void status_begin(void) {
+    uint32_t seq;
+
+    flock(_status_fd, LOCK_EX);
+
+    // Already odd if a previous writer died mid update
+    seq = _status->seq;
+    if (!(seq & 1)) ++seq;
+
+    __atomic_store_n(&_status->seq, seq, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void status_end(void) {
+    _status->pid     = getpid();
+    _status->updated = now_us();
+    ++_status->updates;
+
+    __atomic_store_n(&_status->seq, _status->seq + 1, __ATOMIC_RELEASE);
+
+    flock(_status_fd, LOCK_UN);
+}
+
+// Opens (creating if necessary) the status page for writing. Returns 1 on
+// success, 0 on error
+int status_open(const char *device) {
+    struct stat st;
+
+    if (_status) return 1;
+
+    _status_fd = shm_open(STATUS_SHM_NAME, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (_status_fd < 0) {
+        dlog(LOG, "Failed to open status page: %s\n", strerror(errno));
+        return 0;
+    }
+
+    // Anyone can create the page first, and could then shrink it under us
+    // (SIGBUS on the next update), so only root's (or our own) is used
+    if (fstat(_status_fd, &st) != 0 || (st.st_uid != 0 && st.st_uid != geteuid())) {
+        dlog(LOG, "Not publishing status, page isn't root's (or ours)\n");
+        close(_status_fd);
+        _status_fd = -1;
+        return 0;
+    }
+
+    // Readable by everyone (despite umask), it's nothing secret
+    fchmod(_status_fd, 0644);
+
+    flock(_status_fd, LOCK_EX);
+
+    if (fstat(_status_fd, &st) != 0
+     || (st.st_size != sizeof(t_status) && ftruncate(_status_fd, sizeof(t_status)) != 0)) {
+        dlog(LOG, "Failed to size status page: %s\n", strerror(errno));
+        flock(_status_fd, LOCK_UN);
+        close(_status_fd);
+        _status_fd = -1;
+        return 0;
+    }
+
+    _status = mmap(NULL, sizeof(t_status), PROT_READ | PROT_WRITE, MAP_SHARED, _status_fd, 0);
+    if (_status == MAP_FAILED) {
+        dlog(LOG, "Failed to map status page: %s\n", strerror(errno));
+        _status = NULL;
+        flock(_status_fd, LOCK_UN);
+        close(_status_fd);
+        _status_fd = -1;
+        return 0;
+    }
+
+    flock(_status_fd, LOCK_UN);
+
+    status_begin();
+
+    // New (or from an incompatible version), start afresh
+    if (_status->magic != STATUS_MAGIC || _status->version != STATUS_VERSION) {
+        uint32_t seq = _status->seq;
+
+        memset(_status, 0, sizeof(*_status));
+        _status->magic       = STATUS_MAGIC;
+        _status->version     = STATUS_VERSION;
+        _status->seq         = seq;
+        _status->active_mode = mode_COUNT;
+    }
+
+    // A different mouse, nothing we knew still applies
+    if (device && strncmp(&_status->device[0], device, sizeof(_status->device)) != 0) {
+        memset(&_status->mode[0], 0, sizeof(_status->mode));
+        _status->active_mode = mode_COUNT;
+
+        strncpy(&_status->device[0], device, sizeof(_status->device) - 1);
+        _status->device[sizeof(_status->device) - 1] = '\0';
+    }
+
+    status_end();
+
+    return 1;
+}
+
+void status_close(void) {
+    if (_status) munmap(_status, sizeof(t_status));
+    _status = NULL;
+
+    if (_status_fd >= 0) close(_status_fd);
+    _status_fd = -1;
+}
+
+void status_set_mode(const t_mode mode, const unsigned char *mode_data) {
+    const t_model *m = _model;
+    t_status_mode *sm;
+    int x;
+
+    if (!_status || !mode_data || mode >= mode_COUNT) return;
+
+    sm = &_status->mode[mode];
+
+    status_begin();
+
+    // F5040302 84060844 01000002 00000300 00040000 05000006 00000700 00080000 090000
+    //   ^^^^^^ ^^^^^^^^ ^^
+    memcpy(&sm->mode_data[0], mode_data, MODE_DATA_LEN);
+    sm->colour = mode_data[m->off_colour];
+    sm->rate   = mode_data[m->off_rate] < m->n_rates ? m->rates[mode_data[m->off_rate]] : 0;
+
+    sm->dpi_default = 0;
+    for (x = 0; x < m->n_dpi && x < 4; ++x) {
+        const unsigned char lvl = mode_data[m->off_dpi + x];
+
+        sm->dpi[x] = dpi_point(lvl & m->dpi_mask);
+        if (lvl & m->dpi_default) sm->dpi_default = x + 1;
+    }
+
+    sm->dpishift         = dpi_point(mode_data[m->off_dpishift] & m->dpi_mask);
+    sm->dpishift_enabled = !(mode_data[m->off_dpishift] & m->dpishift_disabled);
+    sm->valid            = 1;
+
+    status_end();
+}
+
+void status_set_active(const t_mode mode) {
+    if (!_status) return;
+
+    status_begin();
+    _status->active_mode = mode;
+    status_end();
+}
+
+// Maps the status page for reading, giving who created it in owner (if not
+// NULL). Returns NULL if there isn't one
+const t_status *status_map(uid_t *owner) {
+    const t_status *page;
+    struct stat st;
+    int fd;
+
+    fd = shm_open(STATUS_SHM_NAME, O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0) return NULL;
+
+    if (fstat(fd, &st) != 0 || st.st_size < sizeof(t_status)) {
+        close(fd);
+        return NULL;
+    }
+
+    if (owner) *owner = st.st_uid;
+
+    page = mmap(NULL, sizeof(t_status), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    return (page == MAP_FAILED) ? NULL : page;
+}
+
+// Takes a consistent copy of the status page. Returns 1 on success, 0 if the
+// page isn't valid (or never settled)
+int status_read(const t_status *page, t_status *out) {
+    uint32_t seq1, seq2;
+    int tries;
+
+    if (!page || !out) return 0;
+
+    for (tries = 0; tries < STATUS_READ_TRIES; ++tries) {
+        seq1 = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE);
+        if (seq1 & 1) continue;
+
+        memcpy(out, (const void *)page, sizeof(*out));
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        seq2 = __atomic_load_n(&page->seq, __ATOMIC_RELAXED);
+
+        if (seq1 == seq2) {
+            return (out->magic == STATUS_MAGIC && out->version == STATUS_VERSION);
+        }
+    }
+
+    return 0;
+}
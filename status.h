@@ -0,0 +1,79 @@
+/* vim:set ts=4 sw=4 tw=80 et cindent ai si cino=(0,ml,\:0:
+ * ( settings from: http://datapax.com.au/code_conventions/ )
+ */
+
+/**********************************************************************
+    RatSlap
+    Copyright (C) 2016-2020 Todd Harbour
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    version 2 ONLY, as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program, in the file COPYING or COPYING.txt; if
+    not, see http://www.gnu.org/licenses/ , or write to:
+      The Free Software Foundation, Inc.,
+      51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ **********************************************************************/
+
+#ifndef   STATUS_H
+#define   STATUS_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "mode.h"
+
+// The mouse's state, as last seen by ratslap, is published in a small shared
+// memory page (/dev/shm/ratslap-status) so status bars, launchers etc. can
+// read it without touching the mouse.
+//
+// The page is protected by a sequence lock: 'seq' is odd while an update is
+// in progress. Readers copy the page and retry if 'seq' changed (or was odd)
+// in the meantime, so reading never blocks the writer and, once mapped, costs
+// no system calls (see status_read()).
+
+#define STATUS_SHM_NAME  "/ratslap-status"
+#define STATUS_MAGIC     0x52534c50 // "RSLP"
+#define STATUS_VERSION   1
+
+typedef struct s_status_mode {
+    uint8_t  valid;                      // 0 until loaded/saved at least once
+    uint8_t  colour;                     // t_colour
+    uint16_t rate;                       // Report rate (Hz)
+    uint16_t dpi[4];
+    uint8_t  dpi_default;                // Level (1 - 4)
+    uint8_t  dpishift_enabled;
+    uint16_t dpishift;
+    uint8_t  mode_data[MODE_DATA_LEN];   // Raw, as per mode_load()
+} t_status_mode;
+
+typedef struct s_status {
+    uint32_t      magic;
+    uint32_t      version;
+    uint32_t      seq;
+    int32_t       pid;                   // Last writer
+    uint64_t      updated;               // Last update (us since epoch)
+    uint32_t      updates;
+    int32_t       active_mode;           // t_mode, mode_COUNT if unknown
+    char          device[32];            // Device (sysfs) name, eg. "2-1.4"
+    t_status_mode mode[mode_COUNT];
+} t_status;
+
+// Writer
+int status_open(const char *device);
+void status_close(void);
+void status_set_mode(const t_mode mode, const unsigned char *mode_data);
+void status_set_active(const t_mode mode);
+
+// Reader
+const t_status *status_map(uid_t *owner);
+int status_read(const t_status *page, t_status *out);
+
+#endif /* STATUS_H */
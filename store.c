@@ -0,0 +1,479 @@
+/* vim:set ts=4 sw=4 tw=80 et cindent ai si cino=(0,ml,\:0:
+ * ( settings from: http://datapax.com.au/code_conventions/ )
+ */
+
+/**********************************************************************
+    RatSlap
+    Copyright (C) 2016-2020 Todd Harbour
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    version 2 ONLY, as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program, in the file COPYING or COPYING.txt; if
+    not, see http://www.gnu.org/licenses/ , or write to:
+      The Free Software Foundation, Inc.,
+      51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "log.h"
+#include "mode.h"
+#include "profile.h"
+#include "store.h"
+
+#define STORE_MAGIC "RSLSTOR1"
+#define STORE_SLOTS 64 // Of each table, in a new store
+
+typedef struct s_store_hdr {
+    char     magic[8];
+    uint32_t blob_slots;
+    uint32_t nblobs;
+    uint32_t rec_slots;
+    uint32_t nrecs;
+} t_store_hdr;
+
+typedef struct s_store_blob {
+    uint64_t      hash;  // 0 for an empty slot
+    uint32_t      refs;  // Record modes pointing at it
+    unsigned char mode_data[MODE_DATA_LEN];
+} t_store_blob;
+
+typedef struct s_store_rec {
+    char     name[STORE_NAME_LEN]; // Empty for an empty slot
+    uint32_t kind;                 // t_store_kind
+    uint32_t present;              // Bit per mode (1 << t_mode)
+    uint64_t hash[mode_COUNT];     // Of each mode's blob
+    uint64_t updated;              // Unix time
+} t_store_rec;
+
+static const char *s_store_kind[] = {
+     "profile"
+    ,"device"
+    ,"INVALID"
+};
+
+int            _store_fd  = -1;
+unsigned char *_store_map = NULL;
+size_t         _store_len = 0;
+int            _store_rdonly = 0; // Opened (and mapped) read only
+
+
+
+static size_t store_size(const uint32_t blob_slots, const uint32_t rec_slots) {
+    return sizeof(t_store_hdr) + blob_slots * sizeof(t_store_blob) + rec_slots * sizeof(t_store_rec);
+}
+
+static t_store_hdr *store_hdr(unsigned char *map) {
+    return (t_store_hdr *)map;
+}
+
+static t_store_blob *store_blobs(unsigned char *map) {
+    return (t_store_blob *)(map + sizeof(t_store_hdr));
+}
+
+static t_store_rec *store_recs(unsigned char *map) {
+    return (t_store_rec *)(map + sizeof(t_store_hdr) + store_hdr(map)->blob_slots * sizeof(t_store_blob));
+}
+
+// A mode's hash, never 0 (that's an empty slot)
+static uint64_t blob_hash(const unsigned char *mode_data) {
+    const uint64_t hash = profile_hash(mode_data, MODE_DATA_LEN);
+
+    return hash ? hash : 1;
+}
+
+// The blob with hash, or the empty slot it'd go in
+static t_store_blob *blob_find(unsigned char *map, const uint64_t hash) {
+    const uint32_t mask = store_hdr(map)->blob_slots - 1;
+    t_store_blob *blob = store_blobs(map);
+    uint32_t i = hash & mask;
+
+    while (blob[i].hash && blob[i].hash != hash) i = (i + 1) & mask;
+
+    return &blob[i];
+}
+
+// The record called name, or the empty slot it'd go in
+static t_store_rec *rec_find(unsigned char *map, const char *name) {
+    const uint32_t mask = store_hdr(map)->rec_slots - 1;
+    t_store_rec *rec = store_recs(map);
+    uint32_t i = profile_hash((const unsigned char *)name, strlen(name)) & mask;
+
+    while (rec[i].name[0] && strcmp(rec[i].name, name) != 0) i = (i + 1) & mask;
+
+    return &rec[i];
+}
+
+// Maps the store (again, if another process has grown it). Returns 1 on
+// success, 0 on error
+static int store_remap(void) {
+    const t_store_hdr *hdr;
+    struct stat st;
+    void *map;
+
+    if (fstat(_store_fd, &st) != 0) {
+        elog("ERROR: Failed to stat store: %s\n", strerror(errno));
+        return 0;
+    }
+
+    if (_store_map && (size_t)st.st_size == _store_len) return 1;
+
+    if (_store_map) munmap(_store_map, _store_len);
+    _store_map = NULL;
+    _store_len = 0;
+
+    if ((size_t)st.st_size < sizeof(t_store_hdr)) {
+        elog("ERROR: Store truncated\n");
+        return 0;
+    }
+
+    map = mmap(NULL, st.st_size, _store_rdonly ? PROT_READ : PROT_READ | PROT_WRITE, MAP_SHARED, _store_fd, 0);
+    if (map == MAP_FAILED) {
+        elog("ERROR: Failed to map store: %s\n", strerror(errno));
+        return 0;
+    }
+
+    hdr = (const t_store_hdr *)map;
+    if (memcmp(&hdr->magic[0], STORE_MAGIC, sizeof(hdr->magic)) != 0
+     || !hdr->blob_slots || (hdr->blob_slots & (hdr->blob_slots - 1))
+     || !hdr->rec_slots  || (hdr->rec_slots  & (hdr->rec_slots  - 1))
+     || store_size(hdr->blob_slots, hdr->rec_slots) != (size_t)st.st_size) {
+        elog("ERROR: Not a store (or corrupt)\n");
+        munmap(map, st.st_size);
+        return 0;
+    }
+
+    _store_map = map;
+    _store_len = st.st_size;
+
+    return 1;
+}
+
+// Rebuilds the store with (at least) room for blobs and recs more entries,
+// keeping each table at most half full. Blobs no record uses any more are
+// dropped on the way, so the store only grows with the modes in use. Must hold
+// the exclusive lock. Returns 1 on success, 0 on error
+static int store_grow(const uint32_t blobs, const uint32_t recs) {
+    const t_store_hdr *old = store_hdr(_store_map);
+    uint32_t blob_slots = old->blob_slots;
+    uint32_t rec_slots  = old->rec_slots;
+    uint32_t live = 0;
+    unsigned char *buf;
+    size_t len;
+    uint32_t i;
+
+    if ((old->nblobs + blobs) * 2 <= blob_slots && (old->nrecs + recs) * 2 <= rec_slots) return 1;
+
+    for (i = 0; i < old->blob_slots; ++i) {
+        const t_store_blob *blob = &store_blobs(_store_map)[i];
+
+        if (blob->hash && blob->refs) ++live;
+    }
+
+    while ((live       + blobs) * 2 > blob_slots) blob_slots *= 2;
+    while ((old->nrecs + recs)  * 2 > rec_slots)  rec_slots  *= 2;
+
+    len = store_size(blob_slots, rec_slots);
+    buf = calloc(1, len);
+    if (!buf) {
+        elog("ERROR: Failed to allocate %zu bytes for store\n", len);
+        return 0;
+    }
+
+    memcpy(buf, old, sizeof(*old));
+    store_hdr(buf)->blob_slots = blob_slots;
+    store_hdr(buf)->rec_slots  = rec_slots;
+    store_hdr(buf)->nblobs     = live;
+
+    for (i = 0; i < old->blob_slots; ++i) {
+        const t_store_blob *blob = &store_blobs(_store_map)[i];
+
+        if (blob->hash && blob->refs) *blob_find(buf, blob->hash) = *blob;
+    }
+    for (i = 0; i < old->rec_slots; ++i) {
+        const t_store_rec *rec = &store_recs(_store_map)[i];
+
+        if (rec->name[0]) *rec_find(buf, rec->name) = *rec;
+    }
+
+    // Written through the file, as the old mapping no longer describes it
+    if (ftruncate(_store_fd, len) != 0 || pwrite(_store_fd, buf, len, 0) != (ssize_t)len) {
+        elog("ERROR: Failed to grow store: %s\n", strerror(errno));
+        free(buf);
+        return 0;
+    }
+
+    free(buf);
+
+    return store_remap();
+}
+
+// Opens (creating if necessary) the store at path. Returns 1 on success, 0 on
+// error
+int store_open(const char *path) {
+    t_store_hdr hdr;
+    struct stat st;
+    int ok = 1;
+
+    if (!path) return 0;
+
+    store_close();
+
+    _store_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (_store_fd < 0 && (errno == EACCES || errno == EROFS)) {
+        _store_fd = open(path, O_RDONLY | O_CLOEXEC);
+        _store_rdonly = 1;
+    }
+    if (_store_fd < 0) {
+        elog("ERROR: Failed to open store %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+
+    flock(_store_fd, LOCK_EX);
+
+    // New, so set up (empty) tables
+    if (fstat(_store_fd, &st) == 0 && st.st_size == 0) {
+        memset(&hdr, 0, sizeof(hdr));
+        memcpy(&hdr.magic[0], STORE_MAGIC, sizeof(hdr.magic));
+        hdr.blob_slots = STORE_SLOTS;
+        hdr.rec_slots  = STORE_SLOTS;
+
+        ok = (ftruncate(_store_fd, store_size(STORE_SLOTS, STORE_SLOTS)) == 0
+           && pwrite(_store_fd, &hdr, sizeof(hdr), 0) == sizeof(hdr));
+        if (!ok) elog("ERROR: Failed to create store %s: %s\n", path, strerror(errno));
+    }
+
+    if (ok && !store_remap()) {
+        elog("ERROR: Failed to open store %s\n", path);
+        ok = 0;
+    }
+
+    flock(_store_fd, LOCK_UN);
+
+    if (!ok) store_close();
+
+    return ok;
+}
+
+void store_close(void) {
+    if (_store_map) munmap(_store_map, _store_len);
+    if (_store_fd >= 0) close(_store_fd);
+
+    _store_map = NULL;
+    _store_len = 0;
+    _store_fd  = -1;
+    _store_rdonly = 0;
+}
+
+// Returns 1 if there's a store open that can be saved to, 0 if not (none, or
+// it's read only)
+int store_writable(void) {
+    return _store_fd >= 0 && !_store_rdonly;
+}
+
+// Reads record name into prof. Returns the number of modes read, or -1 on
+// error (eg. no such record)
+int store_get(const char *name, t_profile *prof) {
+    const t_store_rec *rec;
+    int n = -1;
+    t_mode m;
+
+    if (_store_fd < 0 || !name || !prof) return -1;
+
+    flock(_store_fd, LOCK_SH);
+
+    if (!store_remap()) goto done;
+
+    rec = rec_find(_store_map, name);
+    if (!rec->name[0]) {
+        elog("ERROR: No %c%s in store\n", STORE_PREFIX, name);
+        goto done;
+    }
+
+    memset(prof, 0, sizeof(*prof));
+    for (n = 0, m = 0; m < mode_COUNT; ++m) {
+        const t_store_blob *blob;
+
+        if (!(rec->present & (1 << m))) continue;
+
+        blob = blob_find(_store_map, rec->hash[m]);
+        if (!blob->hash) {
+            elog("ERROR: Mode %s of %c%s missing from store\n", s_mode[m], STORE_PREFIX, name);
+            n = -1;
+            goto done;
+        }
+
+        profile_set(prof, m, &blob->mode_data[0]);
+        ++n;
+    }
+
+done:
+    flock(_store_fd, LOCK_UN);
+
+    return n;
+}
+
+// Saves prof as record name. A profile is replaced as a whole, a device only
+// has the modes in prof updated (the rest are as last seen). Returns the
+// number of modes saved, or -1 on error
+int store_put(const char *name, const t_store_kind kind, const t_profile *prof) {
+    t_store_blob *blob;
+    t_store_rec *rec;
+    int n = -1;
+    t_mode m;
+
+    if (_store_fd < 0 || !name || !prof || kind >= store_COUNT) return -1;
+
+    if (!name[0] || strlen(name) >= STORE_NAME_LEN) {
+        elog("ERROR: Invalid store name: %s\n", name);
+        return -1;
+    }
+
+    if (_store_rdonly) {
+        elog("ERROR: Store is read only, can't save %c%s\n", STORE_PREFIX, name);
+        return -1;
+    }
+
+    flock(_store_fd, LOCK_EX);
+
+    if (!store_remap() || !store_grow(mode_COUNT, 1)) goto done;
+
+    rec = rec_find(_store_map, name);
+    if (rec->name[0] && rec->kind != kind) {
+        elog("ERROR: %c%s is a %s in the store, not a %s\n", STORE_PREFIX, name, s_store_kind[rec->kind < store_COUNT ? rec->kind : store_COUNT], s_store_kind[kind]);
+        goto done;
+    }
+
+    // Check for (vanishingly unlikely) collisions before changing anything
+    for (m = 0; m < mode_COUNT; ++m) {
+        if (!(prof->present & (1 << m))) continue;
+
+        blob = blob_find(_store_map, blob_hash(&prof->mode_data[m][0]));
+        if (blob->hash && memcmp(&blob->mode_data[0], &prof->mode_data[m][0], MODE_DATA_LEN) != 0) {
+            elog("ERROR: Hash collision storing mode %s of %c%s\n", s_mode[m], STORE_PREFIX, name);
+            goto done;
+        }
+    }
+
+    if (!rec->name[0]) {
+        memset(rec, 0, sizeof(*rec));
+        snprintf(&rec->name[0], sizeof(rec->name), "%s", name);
+        rec->kind = kind;
+        ++store_hdr(_store_map)->nrecs;
+    }
+
+    for (n = 0, m = 0; m < mode_COUNT; ++m) {
+        const int had = rec->present & (1 << m);
+
+        if (!(prof->present & (1 << m))) {
+            if (kind == store_device || !had) continue;
+
+            // Dropped from the profile
+            blob = blob_find(_store_map, rec->hash[m]);
+            if (blob->hash && blob->refs) --blob->refs;
+            rec->present &= ~(1 << m);
+            continue;
+        }
+
+        blob = blob_find(_store_map, blob_hash(&prof->mode_data[m][0]));
+        if (!blob->hash) {
+            blob->hash = blob_hash(&prof->mode_data[m][0]);
+            blob->refs = 0;
+            memcpy(&blob->mode_data[0], &prof->mode_data[m][0], MODE_DATA_LEN);
+            ++store_hdr(_store_map)->nblobs;
+        }
+        ++blob->refs;
+
+        if (had) {
+            t_store_blob *prev = blob_find(_store_map, rec->hash[m]);
+
+            if (prev->hash && prev->refs) --prev->refs;
+        }
+
+        rec->hash[m] = blob->hash;
+        rec->present |= (1 << m);
+        ++n;
+    }
+
+    rec->updated = time(NULL);
+
+done:
+    flock(_store_fd, LOCK_UN);
+
+    return n;
+}
+
+// Lists the devices whose modes (as last seen) aren't those of record name.
+// Returns the number of devices drifting, or -1 on error
+int store_drift(FILE *strm, const char *name) {
+    const t_store_rec *want;
+    const t_store_rec *rec;
+    unsigned int devices = 0;
+    int n = -1;
+    uint32_t i;
+    t_mode m;
+
+    if (_store_fd < 0 || !strm || !name) return -1;
+
+    flock(_store_fd, LOCK_SH);
+
+    if (!store_remap()) goto done;
+
+    want = rec_find(_store_map, name);
+    if (!want->name[0]) {
+        elog("ERROR: No %c%s in store\n", STORE_PREFIX, name);
+        goto done;
+    }
+
+    n = 0;
+    for (i = 0; i < store_hdr(_store_map)->rec_slots; ++i) {
+        unsigned int differ  = 0;
+        unsigned int unknown = 0;
+
+        rec = &store_recs(_store_map)[i];
+        if (!rec->name[0] || rec->kind != store_device || rec == want) continue;
+
+        ++devices;
+
+        for (m = 0; m < mode_COUNT; ++m) {
+            if (!(want->present & (1 << m))) continue;
+
+            if (!(rec->present & (1 << m)))      unknown |= (1 << m);
+            else if (rec->hash[m] != want->hash[m]) differ  |= (1 << m);
+        }
+
+        if (!differ && !unknown) continue;
+
+        ++n;
+        fprintf(strm, "%s:", &rec->name[0]);
+        for (m = 0; m < mode_COUNT; ++m) {
+            if (differ  & (1 << m)) fprintf(strm, " %s", s_mode[m]);
+            if (unknown & (1 << m)) fprintf(strm, " %s (unknown)", s_mode[m]);
+        }
+        fprintf(strm, "\n");
+    }
+
+    fprintf(strm, "Drifting from %c%s: %d of %u devices\n", STORE_PREFIX, name, n, devices);
+
+done:
+    flock(_store_fd, LOCK_UN);
+
+    return n;
+}
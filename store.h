@@ -0,0 +1,63 @@
+/* vim:set ts=4 sw=4 tw=80 et cindent ai si cino=(0,ml,\:0:
+ * ( settings from: http://datapax.com.au/code_conventions/ )
+ */
+
+/**********************************************************************
+    RatSlap
+    Copyright (C) 2016-2020 Todd Harbour
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    version 2 ONLY, as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program, in the file COPYING or COPYING.txt; if
+    not, see http://www.gnu.org/licenses/ , or write to:
+      The Free Software Foundation, Inc.,
+      51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ **********************************************************************/
+
+#ifndef   STORE_H
+#define   STORE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "mode.h"
+#include "profile.h"
+
+// Content addressed profile store (--store). Mode data is kept once per
+// distinct blob, keyed by its hash (profile_hash()), and named records (saved
+// profiles, and the last known state of each device) just point at a blob per
+// mode. A fleet of mice sharing a handful of modes costs a handful of blobs.
+//
+// The store is a single file, mapped as is: a header, then open addressed
+// tables of blobs (by hash) and records (by name), each a power of two in size
+// and doubled when half full, so lookups are O(1). Writers lock the file
+// exclusively, readers shared.
+//
+// Profile arguments naming a record ("@<name>") read from and write to the
+// store rather than a file.
+
+#define STORE_NAME_LEN  128 // Including the NUL (same as DEVSEL_SERIAL_LEN)
+#define STORE_PREFIX    '@' // Marks a profile argument as a store record
+
+typedef enum e_store_kind {
+     store_profile = 0 // Saved (eg. by --snapshot), written as a whole
+    ,store_device      // A mouse's modes as last seen, updated mode by mode
+    ,store_COUNT
+} t_store_kind;
+
+int store_open(const char *path);
+void store_close(void);
+int store_writable(void);
+int store_get(const char *name, t_profile *prof);
+int store_put(const char *name, const t_store_kind kind, const t_profile *prof);
+int store_drift(FILE *strm, const char *name);
+
+#endif /* STORE_H */